@@ -10,15 +10,65 @@ Terms:
 #include <chrono>
 #include <ctime>
 #include <iomanip>
+#include <cerrno>
 #include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <charconv>
+#include <cstdint>
+#include <random>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <numeric>
 
 #ifdef _WIN32
 #include <windows.h>
+#include <conio.h>
+#include <io.h>
+#else
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAS_X86_SIMD 1
+#include <immintrin.h>
+#else
+#define HAS_X86_SIMD 0
 #endif
 
 using namespace std;
 
 typedef long long bigInt;
+typedef unsigned long long uBigInt;
+
+#if defined(__SIZEOF_INT128__)
+#define HAS_INT128 1
+typedef unsigned __int128 uInt128;
+#else
+#define HAS_INT128 0
+#endif
 
 // UI Constants - ANSI Colors
 const string RESET = "\033[0m";
@@ -31,24 +81,611 @@ const string MAGENTA = "\033[35m";
 
 bool showSteps = false;
 
+/*
+Pacing of the interactive UI. Animations (loading bar, typing effect, menu reveal) only play when
+stdin and stdout are terminals and neither --no-animation nor --fast is given. While they play the
+terminal is left in non-canonical mode, so a keypress is seen at once: it cuts every animation short
+until the next prompt, and the keys are kept as typeahead for that prompt.
+*/
+struct RenderTiming
+{
+    bool animate = false;
+    bool skipped = false; // a key was pressed since the last prompt
+    bool rawMode = false;
+    string typeahead;
+#ifndef _WIN32
+    termios saved; // terminal settings to restore for prompts and on exit
+#endif
+};
+
+RenderTiming renderTiming;
+
+/*
+Output of the interactive UI. Everything written to cout is collected into one frame, which is
+handed to the terminal with a single write() when it is presented (cout.flush(): before a prompt
+waits for input and between two animation frames) instead of a write per line or character.
+*/
+struct FrameBuffer : streambuf
+{
+    int fd = 1;
+    bool writeThrough = false; // present after every insertion (the unbuffered reference in --bench)
+    string frame;
+
+    int overflow(int ch) override
+    {
+        if (ch != EOF)
+            frame += (char)ch;
+        return writeThrough && sync() != 0 ? EOF : ch;
+    }
+
+    streamsize xsputn(const char *text, streamsize size) override
+    {
+        frame.append(text, size);
+        return writeThrough && sync() != 0 ? 0 : size;
+    }
+
+    int sync() override
+    {
+        size_t written = 0;
+        while (written < frame.size())
+        {
+#ifdef _WIN32
+            int n = _write(fd, frame.data() + written, (unsigned)(frame.size() - written));
+#else
+            ssize_t n = write(fd, frame.data() + written, frame.size() - written);
+            if (n < 0 && errno == EINTR)
+                continue;
+#endif
+            if (n <= 0)
+                break;
+            written += n;
+        }
+        bool complete = written == frame.size();
+        frame.clear();
+        return complete ? 0 : -1;
+    }
+};
+
 struct TestCase
 {
     bigInt b, n, m, expected, result;
 };
 
+/*
+All solutions of ax ≡ b (mod m) in [0, m): first, first + step, ..., first + (count-1)*step, with
+step = m/g and count = g = gcd(a, m) (count = 0 when there is none). g can be close to m, so
+the solutions are produced on demand instead of stored; iterating visits them in increasing order.
+*/
+template <typename T>
+struct CongruenceSolutions
+{
+    T first = T(0), step = T(1), count = T(0);
+
+    T at(T k) const { return first + k * step; }
+    T last() const { return at(count - T(1)); }
+
+    struct Iterator
+    {
+        T index, value, step;
+        T operator*() const { return value; }
+        Iterator &operator++()
+        {
+            index = index + T(1);
+            value = value + step;
+            return *this;
+        }
+        bool operator!=(const Iterator &other) const { return index != other.index; }
+    };
+    Iterator begin() const { return {T(0), first, step}; }
+    Iterator end() const { return {count, T(0), step}; }
+};
+
+/*
+Precomputed values for Montgomery multiplication modulo an odd 'm' (R = 2^64).
+Numbers are kept in Montgomery form (x*R mod m) so every multiplication is reduced with
+shifts and multiplies instead of a hardware division.
+*/
+struct MontgomeryContext
+{
+    uBigInt m = 0;
+    uBigInt inv = 0;    // m^-1 mod R
+    uBigInt r1 = 0;     // R mod m (the number 1 in Montgomery form)
+    uBigInt r2 = 0;     // R^2 mod m (used to convert into Montgomery form)
+    bool isOdd = false; // even moduli fall back to modularExponentiation()
+};
+
+/*
+Precomputed reciprocal for Barrett reduction modulo 'm'.
+For m < 2^32 a product of two residues fits in 64 bits and is reduced with one high
+multiply instead of a division; larger moduli use the 128-bit mulMod().
+*/
+struct BarrettContext
+{
+    uBigInt m = 0;
+    uBigInt mu = 0; // floor((2^64 - 1) / m)
+};
+
+// Divisibility by a fixed odd d without a division: n is a multiple of d exactly when
+// n * d^-1 mod 2^64 <= (2^64 - 1) / d.
+struct DivisibilityTest
+{
+    uBigInt inverse = 0;
+    uBigInt limit = 0;
+};
+
+// One prime power p^e of a factorization.
+struct PrimeFactor
+{
+    uBigInt prime;
+    int exponent;
+};
+
+/*
+The square roots of a modulo m: residues[i] + j * modulus for every i and every j < m / modulus.
+The residues are sorted, so listing them for j = 0, 1, ... gives the roots in increasing order.
+*/
+struct SquareRootSet
+{
+    uBigInt m = 0, modulus = 1;
+    vector<uBigInt> residues;
+    uBigInt count = 0;
+};
+
+/*
+One slot of the baby-step table: 8 bytes, so a cache line holds 8 of them. Only 32 hash bits
+of the key are kept; a matching tag is confirmed by recomputing base^exponent, which is rare
+enough (true hits plus about one false hit in 2^31 probes) to cost nothing.
+*/
+struct BabyStepEntry
+{
+    uint32_t tag;      // 0 for an empty slot, odd otherwise
+    uint32_t exponent;
+};
+
+// The baby steps base^j -> j (j < steps) of the last baby-step giant-step search, in an
+// open-addressing table with linear probing. Kept so that the next search with the same base
+// and modulus can skip building it.
+struct BabyStepTable
+{
+    uBigInt base = 0, m = 0, steps = 0;
+    int shift = 64; // slot = (key * golden ratio) >> shift
+    vector<BabyStepEntry> slots;
+};
+
+// Longest transform of the polynomial multiplier: products of up to 2^23 coefficients.
+const int NTT_MAX_LOG = 23;
+// Values per cache-resident chunk of a transform (16 KiB).
+const size_t NTT_CHUNK = 1 << 12;
+
+/*
+A prime p < 2^30 for the number-theoretic transform, with 2^maxLog dividing p - 1, and its
+twiddle table (see prepareNttPrime()). Values are kept below 4p < 2^32 during a transform.
+*/
+struct NttPrime
+{
+    uint32_t p = 0, root = 0; // root: a primitive 2^maxLog-th root of unity
+    int maxLog = 0;
+    uint32_t minusOne = 0, minusOneShoup = 0;
+    vector<uint32_t> roots, rootsShoup; // twiddles in bit-reversed order, grown on demand
+};
+
+typedef void (*NttKernel)(uint32_t *a, int log, const NttPrime &prime, bool inverse);
+typedef void (*LevelKernel)(uint32_t *a, size_t len, size_t first, size_t last, const NttPrime &prime);
+
+// Reusable state of multiplyPolynomials(): the primes with their tables and the scratch buffers.
+struct NttEngine
+{
+    vector<NttPrime> primes; // CRT primes, largest first
+    NttPrime direct;         // the modulus itself when it is an NTT prime
+    NttKernel kernel = nullptr;
+    vector<uint32_t> left, right, digits;
+};
+
+// A dense k x k matrix over Z/mZ, row-major, entries in [0, m).
+struct ModMatrix
+{
+    size_t k = 0;
+    uBigInt m = 1;
+    vector<uBigInt> entries;
+};
+
+// Columns per tile of multiplyMatrices() (the 128-bit row accumulators take 1 KiB).
+const size_t MATRIX_TILE = 64;
+// Recurrence order from which Kitamasa's method switches from schoolbook to NTT products (the
+// measured crossover is near 60 for an NTT prime modulus and near 170 for 61-bit moduli).
+const size_t KITAMASA_NTT_ORDER = 128;
+
+typedef vector<uint32_t> Limbs;
+
+/*
+Signed arbitrary-precision integer for moduli that don't fit in bigInt (e.g. RSA-sized).
+The magnitude is stored as little-endian base 2^32 limbs without leading zero limbs, so
+zero is an empty vector. Division truncates toward zero like the built-in types, which lets
+the templated kernels use the same '%' idioms for both.
+*/
+struct BigNumber
+{
+    Limbs limbs;
+    bool negative = false;
+
+    BigNumber() {}
+    BigNumber(long long value);
+
+    bool isZero() const { return limbs.empty(); }
+    bool isOdd() const { return !limbs.empty() && (limbs[0] & 1); }
+    size_t bitLength() const;
+    bool testBit(size_t) const;
+};
+
+// Montgomery constants for an odd BigNumber modulus with 'n' limbs (R = 2^(32n)).
+struct BigMontgomeryContext
+{
+    Limbs m;
+    Limbs r1; // R mod m
+    Limbs r2; // R^2 mod m
+    uint32_t negInv = 0; // -m^-1 mod 2^32
+    size_t n = 0;
+};
+
+/*
+Precomputed powers of one base modulo m for fixed-base exponentiation.
+The exponent is split into 'rows' digits of 'window' bits and
+    table[i * 2^window + d] = base^(d * 2^(i * window))
+so b^n is the product of one table entry per non-zero digit, with no squarings at all.
+Entries are in Montgomery form when m is odd.
+*/
+struct FixedBaseContext
+{
+    bigInt base = 0, m = 0;
+    int window = 0; // 0 when the memory budget is too small for any table
+    int rows = 0;
+    MontgomeryContext montgomery;
+    BarrettContext barrett;
+    vector<uBigInt> table;
+};
+
+// Settings for a batch run taken from the command line.
+struct BenchmarkOptions
+{
+    string format = "table"; // table, csv or json
+    int warmup = 2;          // untimed runs before the timed ones
+    int repetitions = 15;    // timed runs, for the median and p99
+};
+
+// One timed kernel; times are per operation.
+struct BenchmarkResult
+{
+    string name;
+    int size;          // modulus bits, block bits or code digits
+    double medianNs, p99Ns;
+    double bytesPerOp; // input bytes per operation, 0 when GB/s doesn't apply
+    double writesPerOp = -1; // write() system calls per operation, -1 where they can't be counted
+};
+
+struct BenchmarkSuite
+{
+    BenchmarkOptions options;
+    vector<BenchmarkResult> results;
+    uint64_t sink = 0; // checksums of every run, so that no run can be optimized away
+};
+
+/*
+Memoized results of modexp and inverse (--cache-memory). The entries are split into shards, each
+made of 4-way sets of one cache line per entry; an (op, operands) key can only live in the set
+its hash picks. Lookups take no lock: every entry has a sequence lock ('version' is odd while a
+writer changes it), and a reader that sees it move discards what it read. Inserts lock their
+shard and, when the set is full, evict with CLOCK: a hit sets an entry's 'referenced' bit, and
+the set's own hand (kept in its first entry) passes over (and clears) set bits until it finds an
+entry without one.
+*/
+const uint8_t CACHE_MODEXP = 1;
+const uint8_t CACHE_INVERSE = 2;
+const int CACHE_WAYS = 4;
+const int CACHE_SHARD_BITS = 4;
+
+struct alignas(64) CacheEntry
+{
+    atomic<uint64_t> version{0};
+    atomic<uint64_t> op{0}, a{0}, b{0}, c{0}; // op 0: empty
+    atomic<uint64_t> value{0};
+    atomic<uint8_t> referenced{0};
+    uint8_t hand = 0; // first entry of a set: the set's CLOCK hand (changed under the shard lock only)
+};
+
+struct alignas(64) CacheShard
+{
+    mutex lock; // taken by inserts only
+    unique_ptr<CacheEntry[]> entries;
+    size_t setMask = 0;
+    atomic<uint64_t> hits{0}, misses{0}, evictions{0};
+};
+
+struct ResultCache
+{
+    unique_ptr<CacheShard[]> shards;
+    size_t capacity = 0; // entries; 0 when the cache is off
+};
+
+// Shared by every thread of a batch run, the server and the menu.
+ResultCache resultCache;
+
+/*
+Instrumentation for --metrics: calls, errors and a latency histogram per batch/server operation,
+the division steps of every extended Euclid run, and how often a 64-bit path had to be redone
+with big numbers. Release builds (-DNDEBUG) compile all of it out: every recording function
+starts with 'if constexpr (METRICS_ENABLED)', so with CALC_METRICS 0 the calls are empty and
+vanish; -DCALC_METRICS=0 or 1 overrides the default. Built in, it still costs nothing until
+--metrics switches it on at run time.
+
+Every thread records into its own MetricsBlock, so recording takes no lock and no atomic
+read-modify-write; the dump adds the blocks up. The histograms are HDR-style: exact below 32,
+then 16 buckets per power of two, so any value is known to within 1/16.
+*/
+#ifndef CALC_METRICS
+#ifdef NDEBUG
+#define CALC_METRICS 0
+#else
+#define CALC_METRICS 1
+#endif
+#endif
+const bool METRICS_ENABLED = CALC_METRICS;
+
+const int METRIC_SUB_BITS = 4;
+const int METRIC_MAX_BITS = 40; // larger values (over 18 minutes in ns) count in the last bucket
+const int METRIC_BUCKETS = (METRIC_MAX_BITS - METRIC_SUB_BITS + 1) << METRIC_SUB_BITS;
+
+// The batch operations (and the server's, under the same names); "other" takes unknown ones.
+const char *const METRIC_OPERATIONS[] = {"modexp", "inv", "lincong", "batchinv", "crt", "isprime",
+                                         "nextprime", "factor", "totient", "carmichael", "order", "dlog",
+                                         "sqrt", "linrec", "matpow", "upc", "isbn", "other"};
+const int METRIC_OPERATION_COUNT = sizeof(METRIC_OPERATIONS) / sizeof(METRIC_OPERATIONS[0]);
+
+// Why a 64-bit operation was redone over BigNumber.
+const int FALLBACK_BIGNUM_INPUT = 0; // a number of the line didn't fit in 64 bits
+const int FALLBACK_CRT_MODULUS = 1;  // the CRT modulus grew past 64 bits
+const char *const METRIC_FALLBACKS[] = {"bignum-input", "crt-modulus"};
+const int METRIC_FALLBACK_COUNT = 2;
+
+// Written only by the owning thread; atomic so that a dump can read them at any time.
+struct MetricHistogram
+{
+    atomic<uint64_t> count{0}, sum{0}, max{0};
+    atomic<uint64_t> buckets[METRIC_BUCKETS] = {};
+};
+
+struct OperationMetrics
+{
+    MetricHistogram latency; // ns; its count is the number of calls
+    atomic<uint64_t> errors{0};
+};
+
+struct MetricsBlock
+{
+    OperationMetrics operations[METRIC_OPERATION_COUNT];
+    MetricHistogram euclidSteps; // division steps per Euclid run
+    atomic<uint64_t> fallbacks[METRIC_FALLBACK_COUNT] = {};
+};
+
+// A histogram added up over all threads, for the dump.
+struct HistogramTotals
+{
+    uint64_t count = 0, sum = 0, max = 0;
+    vector<uint64_t> buckets = vector<uint64_t>(METRIC_BUCKETS);
+};
+
+struct MetricsRegistry
+{
+    bool active = false; // --metrics; set before any worker thread starts
+    mutex lock;          // guards 'blocks'
+    vector<unique_ptr<MetricsBlock>> blocks; // one per thread that recorded anything, kept after it ends
+};
+
+MetricsRegistry metrics;
+
+struct BatchOptions
+{
+    bool summary = false;
+    bool filterPrimes = false;         // input lines are plain numbers; echo the prime ones
+    size_t fixedBaseMemory = 32 << 10; // bytes per fixed-base table
+    int threads = 0;                   // 0: one per core
+    size_t dlogMemory = 64 << 20;      // bytes per baby-step table
+    size_t cacheMemory = 0;            // bytes for memoized modexp/inverse results, 0: no cache
+    string metricsFormat;              // --metrics: "json" or "prometheus", empty: no metrics
+};
+
+// Counters reported at the end of a batch run.
+struct BatchStats
+{
+    long long lines = 0, errors = 0;
+};
+
+// One worker's tasks: the owner takes from the back, other workers steal from the front.
+struct WorkQueue
+{
+    mutex lock;
+    deque<size_t> tasks;
+};
+
+/*
+A fixed set of workers, each with its own task queue. runOnPool() deals the tasks of a job out
+evenly and the workers steal from each other once their own queue runs dry. The thread calling
+runOnPool() works as worker 0, so a pool of one thread starts no threads at all.
+*/
+struct WorkStealingPool
+{
+    vector<thread> threads;
+    vector<unique_ptr<WorkQueue>> queues;
+    mutex lock;
+    condition_variable wake, done;
+    const function<void(size_t, int)> *body = nullptr; // the current job: body(task, worker)
+    atomic<size_t> remaining{0};
+    uint64_t generation = 0; // bumped for every job, under 'lock'
+    bool stopping = false;
+};
+
+struct BatchState;
+
+// Handles one input line of a batch run, appending its output.
+typedef void (*LineProcessor)(const char *begin, const char *end, string &output, BatchState &state);
+
+// Scratch storage reused across batch lines so that no allocation happens per operation.
+struct BatchState
+{
+    vector<bigInt> numbers;
+    vector<bigInt *> crtRows;
+    MontgomeryContext montgomery; // reused while consecutive lines share the modulus
+    FixedBaseContext fixedBase;   // built once a (base, modulus) pair keeps repeating
+    bigInt lastBase = 0, lastMod = 0;
+    int baseRepeats = 0;
+    size_t fixedBaseMemory = 0;
+    BabyStepTable babySteps;      // reused while consecutive dlog lines share the base
+    size_t dlogMemory = 0;
+    bigInt sqrtModulus = 0;       // the last sqrt modulus and its factorization
+    vector<PrimeFactor> sqrtFactors;
+    SquareRootSet squareRoots;
+    BatchStats stats;
+};
+
+// A fixed-length check-digit code: the code is valid when the weighted digit sum is
+// divisible by the modulus.
+struct BarcodeFormat
+{
+    const char *name;
+    int length;
+    int modulus;
+    bool allowX;        // 'X' (value 10) is accepted as the check digit
+    signed char weights[16];
+};
+
+const BarcodeFormat UPC_FORMAT = {"upc", 12, 10, false, {3, 1, 3, 1, 3, 1, 3, 1, 3, 1, 3, 1}};
+const BarcodeFormat ISBN10_FORMAT = {"isbn", 10, 11, true, {1, 2, 3, 4, 5, 6, 7, 8, 9, 10}};
+
+// Counters reported at the end of a validation run.
+struct BarcodeStats
+{
+    long long lines = 0, valid = 0, invalid = 0, malformed = 0;
+};
+
+struct ValidateOptions
+{
+    const BarcodeFormat *format = nullptr;
+    bool summary = false; // print the counters instead of the failing lines
+};
+
+// Validates the fixed-width lines at the start of [p, end), stopping at the first line that
+// needs the careful path; returns where it stopped.
+typedef const char *(*BarcodeKernel)(const char *p, const char *end, const BarcodeFormat &format,
+                                     BarcodeStats &stats, string *failures);
+
+// A bit string packed 64 bits per word: bit i is bit i % 64 of words[i / 64].
+struct BitString
+{
+    vector<uint64_t> words;
+    size_t length = 0;
+};
+
+// Counts the one bits of 'words' 64-bit words starting at 'data' (any alignment).
+typedef uint64_t (*PopcountKernel)(const unsigned char *data, size_t words);
+
+struct ParityOptions
+{
+    size_t blockBits = 0;  // 0: the whole input is a single block
+    string verifyPath;     // stored block parities to check the input against
+    bool summary = false;
+};
+
+// Per-block parity over a stream of bits. Blocks may straddle the chunks the stream is fed in;
+// finished parity bits are packed 64 per word, first block in the lowest bit.
+struct ParityEngine
+{
+    PopcountKernel kernel = nullptr;
+    size_t blockBits = 0;
+    size_t filled = 0;        // bits of the current block seen so far
+    uint64_t blockOnes = 0;
+    uint64_t pending = 0;     // parity bits not yet a whole word
+    int pendingCount = 0;
+    vector<uint64_t> parities;
+    int lastWordBytes = 8;    // bytes of parities.back() in use once the stream is finished
+    uint64_t bits = 0, ones = 0, blocks = 0;
+};
+
+/*
+Server protocol (--serve). Every message is a frame of a 32-bit length (of the rest of the frame),
+the 32-bit request id chosen by the client and echoed in its response, and an op (request) or
+status (response) byte, all little-endian. Requests carry signed 64-bit arguments, except the
+check-digit ops, which carry the code as ASCII digits. A SERVER_OK response carries the 64-bit
+results, SERVER_NONE the two contradicting equations (1-based) of a CRT request and nothing
+otherwise, SERVER_ERROR a message. Responses come back in request order, so requests can be
+pipelined.
+*/
+const uint8_t SERVER_MODEXP = 1;      // b n m           -> b^n mod m
+const uint8_t SERVER_INVERSE = 2;     // a m             -> a^-1 mod m, or none
+const uint8_t SERVER_LINCONG = 3;     // a b m           -> x with ax = b (mod m/g), or none
+const uint8_t SERVER_CRT = 4;         // a1 m1 a2 m2 ... -> x M, or none i j
+const uint8_t SERVER_UPC_CHECK = 5;   // 11 digits       -> the check digit
+const uint8_t SERVER_UPC_VERIFY = 6;  // 12 digits       -> 1 if valid, 0 if not
+const uint8_t SERVER_ISBN_CHECK = 7;  // 9 digits        -> the check digit (10 for 'X')
+const uint8_t SERVER_ISBN_VERIFY = 8; // 10 characters   -> 1 if valid, 0 if not
+
+const uint8_t SERVER_OK = 0;
+const uint8_t SERVER_NONE = 1;
+const uint8_t SERVER_ERROR = 2;
+
+const size_t SERVER_MAX_FRAME = 1 << 20;   // a longer request closes the connection
+const size_t SERVER_CHUNK = 256;           // requests per worker task
+const size_t SERVER_READ_LIMIT = 1 << 20;  // bytes read from one connection per event loop round
+const size_t SERVER_MAX_PENDING = 4 << 20; // unsent response bytes before a connection is no longer read
+
+struct LoadTestOptions
+{
+    string endpoint;
+    int connections = 4;
+    int pipeline = 32;           // requests in flight per connection
+    long long requests = 100000; // per connection
+};
+
+// One client of the server: requests received but not yet answered, and answers not yet sent.
+struct ServerConnection
+{
+    int fd = -1;
+    string input, output;
+    size_t parsed = 0;    // input bytes handed to workers in this round
+    uint32_t events = 0;  // what epoll watches for
+    bool inputDone = false; // the client shut down its side; close once everything is sent
+    bool broken = false;
+};
+
+// A run of complete request frames of one connection, answered by one worker.
+struct ServerTask
+{
+    ServerConnection *connection;
+    size_t begin, end, requests;
+    string output;
+};
+
 // ************ Utility Functions **************
 void setupConsole();
 void clearScreen();
 void drawLine(int width = 60);
 void printCentered(string text, string color = RESET, bool newLine = true);
 void sleep(int);
+void configureAnimations(bool);
+void restoreTerminal();
+void setTerminalLineMode(bool);
+bool animating();
+void takeTypeahead();
+void animationPause(int);
+void readInputLine(string &);
 bigInt toNumber(string);
 void pressEnterToContinue(string message = "Press Enter to continue");
 int getChoice(string text = "Enter choice: ");
-int menuBuilder(string[], int, string = "Menu");
+int menuBuilder(string[], int, string = "Menu", string = "");
+void drawMenu(string[], int, string, string = "");
 bool isValidNumber(string, bool isMod = false);
 bool isValidChoice(int, int, int);
 bigInt getNumberInput(string text = "Enter input", bool isMod = false);
+string getNumberString(string text = "Enter input", bool isMod = false);
+BigNumber getBigNumberInput(string text = "Enter input", bool isMod = false);
 bool isValidBinaryString(string);
 bool isValidISBN(string);
 void typeWrite(string text, int speed = 20);
@@ -68,20 +705,325 @@ void showCRTScreen();
 void showParityBitScreen();
 void showUPCScreen();
 void showISBNScreen();
+void showNumberTheoryMenu();
+void showPrimalityScreen();
+void showFactorizationScreen();
+void showOrderScreen();
+void showDiscreteLogScreen();
+void showSqrtModScreen();
+void showLinearRecurrenceScreen();
 
 // ************ Main Logic Functions ******************
-bigInt gcd(bigInt, bigInt);
-bigInt modularExponentiation(bigInt, bigInt, bigInt);
-bigInt extendedGcd(bigInt, bigInt, bigInt &, bigInt &, bool showSteps);
-bigInt modInverse(bigInt, bigInt);
-bigInt linearCongruence(bigInt, bigInt, bigInt);
-bigInt chineseRemainderTheorem(bigInt **, bigInt &, int);
+// These are templates so they can also run over BigNumber; the bigInt specializations are
+// the 64-bit implementations and cost nothing extra.
+template <typename T> T gcd(T, T);
+template <typename T> T modularExponentiation(T, T, T);
+template <typename T> T extendedGcd(T, T, T &, T &, bool showSteps);
+template <typename T> T modInverse(T, T);
+template <typename T> T linearCongruence(T, T, T);
+template <typename T> CongruenceSolutions<T> linearCongruenceSolutions(T, T, T);
+template <typename T> T chineseRemainderTheorem(T **, T &, int, int *conflict = nullptr);
+template <typename T> int findConflictingEquation(T **, int);
+template <typename T> T noSolution();
+template <> bigInt gcd<bigInt>(bigInt, bigInt);
+template <> bigInt modularExponentiation<bigInt>(bigInt, bigInt, bigInt);
+template <> bigInt extendedGcd<bigInt>(bigInt, bigInt, bigInt &, bigInt &, bool showSteps);
+template <> bigInt modInverse<bigInt>(bigInt, bigInt);
+template <> bigInt linearCongruence<bigInt>(bigInt, bigInt, bigInt);
+template <> bigInt chineseRemainderTheorem<bigInt>(bigInt **, bigInt &, int, int *);
+template <> bigInt noSolution<bigInt>();
+template <> BigNumber modularExponentiation<BigNumber>(BigNumber, BigNumber, BigNumber);
+template <> BigNumber gcd<BigNumber>(BigNumber, BigNumber);
+template <> BigNumber extendedGcd<BigNumber>(BigNumber, BigNumber, BigNumber &, BigNumber &, bool showSteps);
+template <typename T> T extendedGcdWithSteps(T, T, T &, T &);
+int countTrailingZeros(uBigInt);
+uBigInt binaryGcd(uBigInt, uBigInt);
+BigNumber lehmerExtendedGcd(BigNumber, BigNumber, BigNumber *, BigNumber *);
+vector<bigInt> batchModInverse(const vector<bigInt> &, bigInt);
+bool garnerCRT(bigInt **, int, vector<bigInt> &);
+bigInt mixedRadixMod(const vector<bigInt> &, bigInt **, bigInt);
+BigNumber mixedRadixToBigNumber(const vector<bigInt> &, bigInt **, BigNumber &);
 void runSampleTests();
 bool verifyCongruence(bigInt, bigInt, bigInt);
 
-int main()
+// ************ Overflow-Free Arithmetic ******************
+bigInt normalizeMod(bigInt, bigInt);
+uBigInt addMod(uBigInt, uBigInt, uBigInt);
+uBigInt subMod(uBigInt, uBigInt, uBigInt);
+uBigInt mulMod(uBigInt, uBigInt, uBigInt);
+BarrettContext makeBarrettContext(bigInt);
+uBigInt barrettMulMod(const BarrettContext &, uBigInt, uBigInt);
+
+// ************ Montgomery Arithmetic ******************
+MontgomeryContext makeMontgomeryContext(uBigInt);
+uBigInt montgomeryMultiply(const MontgomeryContext &, uBigInt, uBigInt);
+uBigInt toMontgomery(const MontgomeryContext &, uBigInt);
+uBigInt fromMontgomery(const MontgomeryContext &, uBigInt);
+bigInt montgomeryModPow(const MontgomeryContext &, bigInt, bigInt);
+uBigInt modPow64(const MontgomeryContext &, uBigInt, uBigInt);
+
+// ************ Windowed Exponentiation ******************
+size_t numberBitLength(bigInt);
+size_t numberBitLength(const BigNumber &);
+bool numberTestBit(bigInt, size_t);
+bool numberTestBit(const BigNumber &, size_t);
+template <typename Element, typename Exponent, typename Multiply>
+Element slidingWindowPow(const Element &, const Exponent &, const Element &, Multiply);
+bigInt slidingWindowModPow(const MontgomeryContext &, bigInt, bigInt);
+FixedBaseContext makeFixedBaseContext(bigInt, bigInt, size_t);
+bigInt fixedBaseModPow(const FixedBaseContext &, bigInt);
+
+// ************ Arbitrary-Precision Arithmetic ******************
+void trimLimbs(Limbs &);
+int compareLimbs(const Limbs &, const Limbs &);
+Limbs addLimbs(const Limbs &, const Limbs &);
+Limbs subLimbs(const Limbs &, const Limbs &);
+void addLimbsAt(Limbs &, const Limbs &, size_t);
+void mulLimbsSchoolbook(const uint32_t *, size_t, const uint32_t *, size_t, uint32_t *);
+Limbs mulLimbsKaratsuba(const uint32_t *, const uint32_t *, size_t);
+Limbs mulLimbs(const Limbs &, const Limbs &);
+uint32_t divModLimbsSmall(Limbs &, uint32_t);
+void divModLimbs(const Limbs &, const Limbs &, Limbs &, Limbs &);
+bool parseBigNumber(const string &, BigNumber &);
+string numberToString(bigInt);
+string numberToString(const BigNumber &);
+bool fitsInBigInt(const string &);
+bool fitsInBigInt(const BigNumber &);
+bigInt toBigInt(const BigNumber &);
+bool fitsInUBigInt(const BigNumber &);
+uBigInt toUBigInt(const BigNumber &);
+BigNumber operator-(const BigNumber &);
+BigNumber operator+(const BigNumber &, const BigNumber &);
+BigNumber operator-(const BigNumber &, const BigNumber &);
+BigNumber operator*(const BigNumber &, const BigNumber &);
+BigNumber operator/(const BigNumber &, const BigNumber &);
+BigNumber operator%(const BigNumber &, const BigNumber &);
+int compareBigNumbers(const BigNumber &, const BigNumber &);
+bool operator==(const BigNumber &, const BigNumber &);
+bool operator!=(const BigNumber &, const BigNumber &);
+bool operator<(const BigNumber &, const BigNumber &);
+bool operator>(const BigNumber &, const BigNumber &);
+bool operator<=(const BigNumber &, const BigNumber &);
+bool operator>=(const BigNumber &, const BigNumber &);
+BigMontgomeryContext makeBigMontgomeryContext(const BigNumber &);
+void bigMontgomeryMultiply(const BigMontgomeryContext &, const uint32_t *, const uint32_t *, uint32_t *);
+
+// ************ Primality Functions ******************
+DivisibilityTest makeDivisibilityTest(uBigInt);
+const vector<uint32_t> &smallOddPrimes();
+const vector<DivisibilityTest> &smallPrimeTests();
+bool isStrongProbablePrime(const MontgomeryContext &, uBigInt);
+bool isPrime(uBigInt);
+bool isPrime(const BigNumber &);
+uBigInt nextPrime(uBigInt);
+BigNumber nextPrime(const BigNumber &);
+int jacobiSymbol(uBigInt, uBigInt);
+int jacobiSymbol(bigInt, const BigNumber &);
+bool isPerfectSquare(const BigNumber &);
+uint32_t remainderLimbs(const Limbs &, uint32_t);
+void bigModSub(const BigMontgomeryContext &, const uint32_t *, const uint32_t *, uint32_t *);
+bool isStrongLucasProbablePrime(const BigNumber &, bigInt);
+uBigInt integerSqrt(uBigInt);
+vector<uint32_t> sievePrimes(uint32_t);
+void sieveSegment(uBigInt, size_t, const vector<uint32_t> &, vector<uint8_t> &);
+int runPrimeSieve(uBigInt, uBigInt, FILE *);
+
+// ************ Factorization Functions ******************
+uBigInt pollardBrent(uBigInt, uBigInt);
+vector<PrimeFactor> factorize(uBigInt);
+uBigInt eulerTotient(uBigInt);
+uBigInt carmichaelLambda(uBigInt);
+uBigInt multiplicativeOrder(uBigInt, uBigInt);
+void appendFactorization(string &, const vector<PrimeFactor> &);
+
+// ************ Discrete Logarithm Functions ******************
+bigInt babyStepGiantStep(BabyStepTable &, const MontgomeryContext &, uBigInt, uBigInt, uBigInt, size_t);
+bigInt pohligHellman(BabyStepTable &, uBigInt, uBigInt, uBigInt, size_t);
+bigInt discreteLog(bigInt, bigInt, bigInt, BabyStepTable &, size_t);
+
+// ************ Modular Square Root Functions ******************
+uBigInt tonelliShanks(const MontgomeryContext &, uBigInt);
+uBigInt cipolla(const MontgomeryContext &, uBigInt);
+bool sqrtModPrime(const MontgomeryContext &, uBigInt, uBigInt &);
+bool unitSqrtModPrimePower(uBigInt, uBigInt, int, vector<uBigInt> &);
+bool sqrtModPrimePower(uBigInt, uBigInt, int, uBigInt &, vector<uBigInt> &);
+bool sqrtMod(bigInt, bigInt, SquareRootSet &, const vector<PrimeFactor> *factors = nullptr);
+uBigInt squareRootAt(const SquareRootSet &, uBigInt);
+
+// ************ Polynomial Functions ******************
+uint32_t shoupPrecompute(uint32_t, uint32_t);
+uint32_t shoupMultiply(uint32_t, uint32_t, uint32_t, uint32_t);
+NttPrime makeNttPrime(uint32_t);
+void prepareNttPrime(NttPrime &, int);
+void forwardLevel(uint32_t *, size_t, size_t, size_t, const NttPrime &);
+void inverseTwiddle(const NttPrime &, size_t, uint32_t &, uint32_t &);
+void inverseLevel(uint32_t *, size_t, size_t, size_t, const NttPrime &);
+template <LevelKernel Forward, LevelKernel Inverse, size_t Fused>
+void runNtt(uint32_t *, int, const NttPrime &, bool);
+void nttScalar(uint32_t *, int, const NttPrime &, bool);
+#if HAS_X86_SIMD
+void forwardButterfliesAVX2(__m256i, __m256i, __m256i, __m256i, __m256i, __m256i, __m256i &, __m256i &);
+void inverseButterfliesAVX2(__m256i, __m256i, __m256i, __m256i, __m256i, __m256i, __m256i &, __m256i &);
+void forwardLevelAVX2(uint32_t *, size_t, size_t, size_t, const NttPrime &);
+void inverseLevelAVX2(uint32_t *, size_t, size_t, size_t, const NttPrime &);
+void nttAVX2(uint32_t *, int, const NttPrime &, bool);
+#endif
+NttKernel selectNttKernel();
+const NttPrime &nttCrtPrime(NttEngine &, size_t);
+void convolveModPrime(NttEngine &, vector<uint32_t> &, vector<uint32_t> &, int, NttPrime &);
+bool multiplyPolynomials(NttEngine &, const vector<uBigInt> &, const vector<uBigInt> &, uBigInt, vector<uBigInt> &);
+vector<uBigInt> multiplyPolynomialsNaive(const vector<uBigInt> &, const vector<uBigInt> &, uBigInt);
+
+// ************ Matrix and Recurrence Functions ******************
+size_t lazyProductLimit(uBigInt);
+ModMatrix identityMatrix(size_t, uBigInt);
+ModMatrix multiplyMatrices(const ModMatrix &, const ModMatrix &);
+template <typename T, typename Square, typename Step>
+T powerBySquaring(uBigInt, T, Square, Step);
+ModMatrix matrixPower(const ModMatrix &, uBigInt);
+uBigInt linearRecurrenceMatrix(const vector<uBigInt> &, const vector<uBigInt> &, uBigInt, uBigInt);
+uBigInt linearRecurrenceKitamasa(const vector<uBigInt> &, const vector<uBigInt> &, uBigInt, uBigInt);
+uBigInt lazyDotProduct(const uBigInt *, const uBigInt *, size_t, uBigInt, size_t, bool);
+vector<uBigInt> inversePowerSeries(NttEngine &, const vector<uBigInt> &, size_t, uBigInt);
+uBigInt linearRecurrence(const vector<uBigInt> &, const vector<uBigInt> &, uBigInt, uBigInt);
+
+// ************ Result Cache Functions ******************
+void configureResultCache(ResultCache &, size_t);
+uint64_t cacheHash(uint64_t, uint64_t, uint64_t, uint64_t);
+bool lookupResult(ResultCache &, uint8_t, bigInt, bigInt, bigInt, bigInt &);
+void storeResult(ResultCache &, uint8_t, bigInt, bigInt, bigInt, bigInt);
+template <typename Compute>
+bigInt memoizedResult(uint8_t, bigInt, bigInt, bigInt, Compute);
+string describeResultCache(const ResultCache &);
+
+// ************ Metrics Functions ******************
+int metricBucket(uint64_t);
+uint64_t metricBucketLimit(int);
+MetricsBlock &threadMetrics();
+uint64_t metricClock();
+void recordMetric(MetricHistogram &, uint64_t);
+void recordOperation(int, uint64_t, bool);
+void countEuclidSteps(uint64_t);
+void countFallback(int);
+int metricOperation(const string &);
+void addHistogram(HistogramTotals &, const MetricHistogram &);
+uint64_t histogramQuantile(const HistogramTotals &, double);
+string formatMetrics(const string &);
+void startMetrics(const string &);
+void dumpRequestedMetrics(const string &);
+
+// ************ Benchmark Functions ******************
+void printBenchmarkResult(const BenchmarkResult &);
+template <typename Body>
+uint64_t measureBenchmark(BenchmarkSuite &, const string &, int, double, Body, double);
+void writeBenchmarkResults(const BenchmarkSuite &, FILE *);
+bool countWriteSyscalls(uint64_t &);
+BigNumber randomBigNumber(mt19937_64 &, int);
+#ifndef _WIN32
+uint64_t runToFirstPrompt(const char *, const char *);
+#endif
+int runBenchmarks(const BenchmarkOptions &);
+
+// ************ Thread Pool Functions ******************
+void startWorkers(WorkStealingPool &, int);
+void stopWorkers(WorkStealingPool &);
+void workerLoop(WorkStealingPool &, int);
+bool takeTask(WorkStealingPool &, int, size_t &);
+void drainTasks(WorkStealingPool &, int);
+void runOnPool(WorkStealingPool &, size_t, const function<void(size_t, int)> &);
+
+// ************ Batch Mode Functions ******************
+int runCommandLine(int, char *[]);
+void printUsage();
+int runBatchMode(const string &, FILE *, const BatchOptions &);
+const char *runBatchChunks(WorkStealingPool &, vector<BatchState> &, vector<string> &, const char *, const char *, bool, FILE *,
+                           LineProcessor);
+void processBatchLine(const char *, const char *, string &, BatchState &);
+void filterPrimeLine(const char *, const char *, string &, BatchState &);
+bool parseBatchNumber(const char *&, const char *, bigInt &);
+template <typename T>
+const char *runBatchOperation(const string &, vector<T> &, string &, BatchState &);
+template <typename T>
+const char *toUnsignedArguments(const vector<T> &, vector<uBigInt> &);
+void appendNumber(string &, bigInt);
+void appendNumber(string &, uBigInt);
+void appendNumber(string &, const BigNumber &);
+bigInt cachedModPow(BatchState &, bigInt, bigInt, bigInt);
+
+// ************ Streaming Input Functions ******************
+template <typename Consumer>
+bool streamInput(const string &, size_t, Consumer);
+
+// ************ Barcode Validation Functions ******************
+int barcodeWeightedSum(const string &, const BarcodeFormat &);
+int checkBarcodeLine(const char *, const char *, const BarcodeFormat &);
+void recordBarcodeLine(const char *, const char *, const BarcodeFormat &, BarcodeStats &, string *);
+const char *validateBarcodesScalar(const char *, const char *, const BarcodeFormat &, BarcodeStats &, string *);
+#if HAS_X86_SIMD
+const char *validateBarcodesSSE2(const char *, const char *, const BarcodeFormat &, BarcodeStats &, string *);
+const char *validateBarcodesAVX2(const char *, const char *, const BarcodeFormat &, BarcodeStats &, string *);
+#endif
+BarcodeKernel selectBarcodeKernel();
+const char *validateBarcodeBlock(const char *, const char *, bool, const BarcodeFormat &, BarcodeKernel, BarcodeStats &, string *);
+int runBarcodeValidation(const string &, FILE *, const ValidateOptions &);
+
+// ************ Parity Functions ******************
+BitString packBits(const string &);
+uint64_t popcountScalar(const unsigned char *, size_t);
+#if HAS_X86_SIMD
+uint64_t popcountPopcnt(const unsigned char *, size_t);
+uint64_t popcountAVX2(const unsigned char *, size_t);
+uint64_t popcountAVX512(const unsigned char *, size_t);
+#endif
+PopcountKernel selectPopcountKernel();
+uint64_t countOnes(const BitString &);
+uint64_t countOnesInRange(const unsigned char *, size_t, size_t, PopcountKernel);
+void emitParityBits(ParityEngine &, uint64_t, int);
+template <int Block>
+void feedParityWords(ParityEngine &, const unsigned char *, size_t);
+void feedParity(ParityEngine &, const unsigned char *, size_t);
+void finishParity(ParityEngine &);
+int runParity(const string &, FILE *, const ParityOptions &);
+
+// ************ Server Functions ******************
+void appendLittleEndian(string &, uint64_t, int);
+uint64_t loadLittleEndian(const char *, int);
+void appendRequest(string &, uint32_t, uint8_t, const string &);
+void answerRequest(const char *, size_t, string &, BatchState &);
+int runServer(const string &, const BatchOptions &);
+int runLoadTest(const LoadTestOptions &);
+#ifdef __linux__
+int openSocket(const string &, bool);
+void appendLoadRequest(string &, uint32_t, mt19937_64 &);
+#endif
+
+int main(int argc, char *argv[])
 {
+    bool animate = true;
+    size_t cacheMemory = 0;
+    int commandLineOptions = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--no-animation" || arg == "--fast")
+            animate = false;
+        else if (arg == "--cache-memory" && i + 1 < argc)
+            cacheMemory = strtoull(argv[++i], nullptr, 10);
+        else
+            commandLineOptions++;
+    }
+    if (commandLineOptions)
+        return runCommandLine(argc, argv);
+
     setupConsole();
+    configureAnimations(animate);
+    configureResultCache(resultCache, cacheMemory);
+    static FrameBuffer renderer;
+    static streambuf *console = cout.rdbuf(&renderer);
+    atexit([]() {
+        cout.flush();
+        cout.rdbuf(console);
+    });
     srand(time(0));
     showLoadingScreen();
     do
@@ -95,17 +1037,19 @@ int main()
 void setupConsole()
 {
 #ifdef _WIN32
-    system("chcp 65001 > nul");
+    // UTF-8 output and ANSI escape sequences (colors, clearScreen())
+    SetConsoleOutputCP(CP_UTF8);
+    HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE);
+    DWORD mode = 0;
+    if (GetConsoleMode(console, &mode))
+        SetConsoleMode(console, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
 #endif
 }
 
+// Cursor home, clear the screen and the scrollback, like clear(1) but without starting a process.
 void clearScreen()
 {
-#if defined(_WIN32) || defined(_WIN64)
-    system("cls");
-#else
-    system("clear");
-#endif
+    cout << "\033[H\033[2J\033[3J";
 }
 
 void sleep(int milliseconds)
@@ -117,58 +1061,207 @@ void sleep(int milliseconds)
 #endif
 }
 
-// Our implementation of 'string-to-integer' function.
-//
-// Args:
-//   str: The string to convert.
-// Returns:
-//   The converted integer.
-bigInt toNumber(string str)
+// Turns animations on when they were not switched off and both ends of the UI are a terminal.
+void configureAnimations(bool requested)
 {
-    bigInt num = 0;
-    bool isNegative = false;
-    for (int i = 0; i < str.length(); i++)
-    {
-        if (i == 0 && str[i] == '-')
-        {
-            isNegative = true;
-            continue;
-        }
-        num = num * 10 + (str[i] - '0');
-    }
+#ifdef _WIN32
+    renderTiming.animate = requested && _isatty(_fileno(stdin)) && _isatty(_fileno(stdout));
+#else
+    renderTiming.animate = requested && isatty(STDIN_FILENO) && isatty(STDOUT_FILENO) &&
+                           tcgetattr(STDIN_FILENO, &renderTiming.saved) == 0;
+    if (!renderTiming.animate)
+        return;
 
-    if (isNegative)
-        return -num;
-    return num;
+    // The terminal must not stay without echo, however the program ends.
+    atexit(restoreTerminal);
+    for (int sig : {SIGINT, SIGTERM, SIGHUP, SIGQUIT})
+        signal(sig, [](int sig) {
+            restoreTerminal();
+            signal(sig, SIG_DFL);
+            raise(sig);
+        });
+    setTerminalLineMode(false);
+#endif
 }
 
-void pressEnterToContinue(string message)
+void restoreTerminal()
 {
-    char temp;
-    cout << "\n";
-    printCentered(message, CYAN, false);
-    cin.get(temp);
+#ifndef _WIN32
+    if (renderTiming.rawMode)
+        tcsetattr(STDIN_FILENO, TCSANOW, &renderTiming.saved);
+#endif
 }
 
-// Prompts the user for a numeric menu choice and returns it.
-//
-// Args:
-//   text: The prompt text to display.
-// Returns:
-//   The chosen integer.
-int getChoice(string text)
+// Line mode (canonical, with echo) for prompts; otherwise keys are readable one at a time, unechoed.
+void setTerminalLineMode(bool lineMode)
 {
-    int choice;
-    string s_choice;
-    do
+#ifndef _WIN32
+    if (!renderTiming.animate)
+        return;
+    termios settings = renderTiming.saved;
+    if (!lineMode)
     {
-        cout << "\n";
-        printCentered(text, CYAN);
-        cout << string(43, ' ') << ">> ";
-        getline(cin, s_choice);
-    } while (!isValidNumber(s_choice));
-    choice = toNumber(s_choice);
-    return choice;
+        settings.c_lflag &= ~(ICANON | ECHO);
+        settings.c_cc[VMIN] = 1;
+        settings.c_cc[VTIME] = 0;
+    }
+    tcsetattr(STDIN_FILENO, TCSANOW, &settings);
+    renderTiming.rawMode = !lineMode;
+#endif
+}
+
+// True while animations play: they are on and no key has been pressed since the last prompt.
+bool animating()
+{
+    return renderTiming.animate && !renderTiming.skipped;
+}
+
+// Moves the keys waiting on the terminal into the typeahead and skips the rest of the animations.
+// Backspace edits the typeahead; an Enter at the start of a line only skips.
+void takeTypeahead()
+{
+    string keys;
+#ifdef _WIN32
+    while (_kbhit())
+    {
+        int key = _getch();
+        keys += key == '\r' ? '\n' : (char)key;
+    }
+#else
+    pollfd input = {STDIN_FILENO, POLLIN, 0};
+    char buffer[256];
+    while (poll(&input, 1, 0) > 0)
+    {
+        ssize_t n = read(STDIN_FILENO, buffer, sizeof buffer);
+        if (n <= 0)
+            break;
+        keys.append(buffer, n);
+    }
+#endif
+    string &typeahead = renderTiming.typeahead;
+    for (char key : keys)
+    {
+        if (key == 127 || key == '\b')
+        {
+            if (!typeahead.empty() && typeahead.back() != '\n')
+                typeahead.pop_back();
+        }
+        else if (key != '\n' || (!typeahead.empty() && typeahead.back() != '\n'))
+            typeahead += key;
+    }
+    renderTiming.skipped = true;
+}
+
+// Waits 'milliseconds' between two animation frames, or returns as soon as a key is pressed.
+void animationPause(int milliseconds)
+{
+    if (!animating())
+        return;
+
+    cout << flush;
+#ifdef _WIN32
+    for (int waited = 0; waited < milliseconds; waited += 10)
+    {
+        if (_kbhit())
+        {
+            takeTypeahead();
+            return;
+        }
+        sleep(min(10, milliseconds - waited));
+    }
+#else
+    pollfd input = {STDIN_FILENO, POLLIN, 0};
+    if (poll(&input, 1, milliseconds) > 0)
+        takeTypeahead();
+#endif
+}
+
+/*
+Reads one line of input for a prompt, starting with whatever was typed during the animations
+(echoed, since the terminal did not echo it). The end of the input (Ctrl-D, a closed pipe) ends
+the program.
+*/
+void readInputLine(string &line)
+{
+    if (renderTiming.rawMode)
+        takeTypeahead();
+    string &typeahead = renderTiming.typeahead;
+    size_t end = typeahead.find('\n');
+    if (end != string::npos)
+    {
+        line = typeahead.substr(0, end);
+        typeahead.erase(0, end + 1);
+        cout << line << "\n";
+    }
+    else
+    {
+        cout << typeahead << flush;
+        setTerminalLineMode(true);
+        bool ok = (bool)getline(cin, line);
+        setTerminalLineMode(false);
+        if (!ok)
+        {
+            cout << "\n";
+            exit(0);
+        }
+        line = typeahead + line;
+        typeahead.clear();
+    }
+    renderTiming.skipped = false;
+}
+
+// Our implementation of 'string-to-integer' function.
+//
+// Args:
+//   str: The string to convert.
+// Returns:
+//   The converted integer.
+bigInt toNumber(string str)
+{
+    bigInt num = 0;
+    bool isNegative = false;
+    for (int i = 0; i < str.length(); i++)
+    {
+        if (i == 0 && str[i] == '-')
+        {
+            isNegative = true;
+            continue;
+        }
+        num = num * 10 + (str[i] - '0');
+    }
+
+    if (isNegative)
+        return -num;
+    return num;
+}
+
+void pressEnterToContinue(string message)
+{
+    string line;
+    cout << "\n";
+    printCentered(message, CYAN, false);
+    readInputLine(line);
+}
+
+// Prompts the user for a numeric menu choice and returns it.
+//
+// Args:
+//   text: The prompt text to display.
+// Returns:
+//   The chosen integer.
+int getChoice(string text)
+{
+    int choice;
+    string s_choice;
+    do
+    {
+        cout << "\n";
+        printCentered(text, CYAN);
+        cout << string(43, ' ') << ">> ";
+        readInputLine(s_choice);
+    } while (!isValidNumber(s_choice));
+    choice = toNumber(s_choice);
+    return choice;
 }
 
 // Validates whether a string represents a valid integer (optionally negative).
@@ -291,37 +1384,67 @@ bool isValidChoice(int choice, int start, int end)
 //   size: Number of options.
 // Returns:
 //   The selected option index (1-based).
-int menuBuilder(string options[], int size, string title)
+int menuBuilder(string options[], int size, string title, string footer)
 {
     int choice;
     do
     {
-        clearScreen();
-        showLogo();
-        showHeader(title);
-        cout << "\n\n";
-        for (int i = 0; i < size; i++)
-        {
-            string optionLine = "[ " + to_string(i + 1) + " ]  " + options[i];
-            printRightAligned(optionLine, RESET);
-            sleep(50);
-        }
-
+        drawMenu(options, size, title, footer);
         choice = getChoice();
     } while (!isValidChoice(choice, 1, size));
     return choice;
 }
 
-bigInt getNumberInput(string text, bool isMod)
+// Draws a menu screen, revealing the options one by one while animations play.
+void drawMenu(string options[], int size, string title, string footer)
+{
+    clearScreen();
+    showLogo();
+    showHeader(title);
+    cout << "\n\n";
+    for (int i = 0; i < size; i++)
+    {
+        string optionLine = "[ " + to_string(i + 1) + " ]  " + options[i];
+        printRightAligned(optionLine, RESET);
+        animationPause(50);
+    }
+    if (!footer.empty())
+    {
+        cout << "\n";
+        printCentered(footer, MAGENTA);
+    }
+}
+
+// Reads a number as a digit string, so values of any length can be entered.
+string getNumberString(string text, bool isMod)
 {
     string input;
-    bigInt n;
     do
     {
         printCentered(text + ": ", YELLOW, false);
-        getline(cin, input);
+        readInputLine(input);
     } while (!isValidNumber(input, isMod));
-    return toNumber(input);
+    return input;
+}
+
+BigNumber getBigNumberInput(string text, bool isMod)
+{
+    BigNumber value;
+    parseBigNumber(getNumberString(text, isMod), value);
+    return value;
+}
+
+bigInt getNumberInput(string text, bool isMod)
+{
+    while (true)
+    {
+        string input = getNumberString(text, isMod);
+        if (fitsInBigInt(input))
+            return toNumber(input);
+
+        printCentered("Number is too large", RED);
+        pressEnterToContinue("Press enter to try again.");
+    }
 }
 
 // This function validates whether a string is a valid ISBN number.
@@ -347,47 +1470,37 @@ void printCentered(string text, string color, bool newLine)
     }
 }
 
-// This function simulates typing effect
+// This function simulates typing effect, one character (UTF-8 sequence) per animation frame.
 void typeWrite(string text, int speed)
 {
     int padding = 25;
 
-    cout << string(padding, ' ');
+    cout << string(padding, ' ') << YELLOW;
 
-    for (int i = 0; i < text.length();)
+    for (size_t i = 0; i < text.length();)
     {
-        
-        if (i + 2 < text.length())
-        { // This is a naive workaround to print '≡' properly
-            unsigned char b1 = text[i];
-            unsigned char b2 = text[i + 1];
-            unsigned char b3 = text[i + 2];
-
-            if (b1 == 0xE2 && b2 == 0x89 && b3 == 0xA1)
-            {
-                cout << YELLOW << "≡" << RESET << flush;
-                i += 3; 
-                sleep(speed);
-                continue;
-            }
-        }
-
-        cout << YELLOW << text[i] << RESET << flush;
+        size_t next = i + 1;
+        while (next < text.length() && ((unsigned char)text[next] & 0xC0) == 0x80)
+            next++;
+        cout.write(text.data() + i, next - i);
 
         if (text[i] == '\n')
             cout << string(padding, ' ');
 
-        i += 1;
-        sleep(speed);
+        i = next;
+        animationPause(speed);
     }
 
-    cout << "\n";
+    cout << RESET << "\n";
 }
 
 // ************ UI Functions ******************
 
 void showLoadingScreen()
 {
+    if (!animating())
+        return;
+
     clearScreen();
     cout << "\n\n\n\n\n";
     showLogo();
@@ -402,6 +1515,8 @@ void showLoadingScreen()
 
     for (int i = 0; i <= 100; i += 2)
     {
+        if (!animating())
+            i = 100;
         cout << "\r" << string(pad, ' ');
         cout << GREEN << "[";
 
@@ -415,10 +1530,10 @@ void showLoadingScreen()
             else
                 cout << " ";
         }
-        cout << "] " << i << "%" << RESET << flush;
-        sleep(20);
+        cout << "] " << i << "%" << RESET;
+        animationPause(20);
     }
-    sleep(500);
+    animationPause(500);
 }
 
 void showLogo()
@@ -468,11 +1583,12 @@ void showMainMenu()
                         "Solve linear congruence ax ≡ b (mod m)",
                         "Chinese Remainder Theorem",
                         "Applications of congruences",
+                        "Number theory tools",
                         "Run sample tests",
                         "Exit program"};
     do
     {
-        choice = menuBuilder(options, 7, "Main Menu");
+        choice = menuBuilder(options, 8, "Main Menu", resultCache.capacity ? describeResultCache(resultCache) : "");
         switch (choice)
         {
         case 1:
@@ -491,19 +1607,22 @@ void showMainMenu()
             showApplicationsMenu();
             break;
         case 6:
-            runSampleTests();
+            showNumberTheoryMenu();
             break;
         case 7:
+            runSampleTests();
+            break;
+        case 8:
             clearScreen();
             printCentered("Exiting... Goodbye!", GREEN);
-            sleep(1000);
+            animationPause(1000);
             exit(0);
             break;
 
         default:
             break;
         }
-    } while (choice != 7);
+    } while (choice != 8);
 }
 
 void showApplicationsMenu()
@@ -538,6 +1657,48 @@ void showApplicationsMenu()
     } while (choice != 4);
 }
 
+void showNumberTheoryMenu()
+{
+    int choice;
+    string options[] = {"Primality test",
+                        "Prime factorization, totient and Carmichael function",
+                        "Multiplicative order (a^t ≡ 1 mod n)",
+                        "Discrete logarithm (b^x ≡ y mod m)",
+                        "Modular square root (x² ≡ a mod m)",
+                        "Linear recurrence (n-th term mod m)",
+                        "Back to Main Menu"};
+    do
+    {
+        choice = menuBuilder(options, 7, "Number Theory Menu");
+        switch (choice)
+        {
+        case 1:
+            showPrimalityScreen();
+            break;
+        case 2:
+            showFactorizationScreen();
+            break;
+        case 3:
+            showOrderScreen();
+            break;
+        case 4:
+            showDiscreteLogScreen();
+            break;
+        case 5:
+            showSqrtModScreen();
+            break;
+        case 6:
+            showLinearRecurrenceScreen();
+            break;
+        case 7:
+            return;
+            break;
+        default:
+            break;
+        }
+    } while (choice != 7);
+}
+
 void showModularExpScreen()
 {
     string choice;
@@ -553,7 +1714,7 @@ while continually reducing mod m.)";
     do
     {
         printCentered("Do you want to calculate any modular exponentiation equation? [y/n]: ", RESET, false);
-        getline(cin, choice);
+        readInputLine(choice);
     } while (!(choice == "y" || choice == "n" || choice == "Y" || choice == "N"));
 
     if (choice == "n" || choice == "N")
@@ -561,22 +1722,31 @@ while continually reducing mod m.)";
         return;
     }
 
-    bigInt b, n, m;
-    bigInt res;
+    BigNumber b, n, m;
+    string res;
 
-    b = getNumberInput("Enter the value of b (the base)");
-    n = getNumberInput("Enter the value of n (the exponent)");
-    m = getNumberInput("Enter the value of m (mod)", true);
+    b = getBigNumberInput("Enter the value of b (the base)");
+    n = getBigNumberInput("Enter the value of n (the exponent)");
+    m = getBigNumberInput("Enter the value of m (mod)", true);
 
-    res = modularExponentiation(b, n, m);
+    if (fitsInBigInt(b) && fitsInBigInt(n) && fitsInBigInt(m))
+    {
+        bigInt base = toBigInt(b), exponent = toBigInt(n), mod = toBigInt(m);
+        res = to_string(memoizedResult(CACHE_MODEXP, base, exponent, mod, [&]() {
+            MontgomeryContext ctx = makeMontgomeryContext(mod);
+            return (bigInt)montgomeryModPow(ctx, base, exponent);
+        }));
+    }
+    else
+        res = numberToString(modularExponentiation(b, n, m));
 
     cout << "\n";
     printCentered("Calculating...", YELLOW);
-    sleep(300);
+    animationPause(300);
 
     cout << "\n";
     printCentered("RESULT", GREEN);
-    string resultStr = to_string(b) + "^" + to_string(n) + " mod " + to_string(m) + " = " + to_string(res);
+    string resultStr = numberToString(b) + "^" + numberToString(n) + " mod " + numberToString(m) + " = " + res;
     printCentered(resultStr, BOLD + CYAN);
     pressEnterToContinue();
 }
@@ -599,7 +1769,7 @@ The standard form of this equation is 'a^-1 mod m')";
     do
     {
         printCentered("Do you want to calculate modular inverse of 'a' mod 'm'? [y/n]:", RESET, false);
-        getline(cin, choice);
+        readInputLine(choice);
     } while (!(choice == "y" || choice == "n" || choice == "Y" || choice == "N"));
 
     if (choice == "n" || choice == "N")
@@ -607,19 +1777,19 @@ The standard form of this equation is 'a^-1 mod m')";
         return;
     }
 
-    bigInt a, m;
-    bigInt res;
+    BigNumber a, m;
+    string res;
 
     cout << "\n";
 
-    a = getNumberInput("Enter the value of a");
-    m = getNumberInput("Enter the value of m (mod)", true);
+    a = getBigNumberInput("Enter the value of a");
+    m = getBigNumberInput("Enter the value of m (mod)", true);
 
     do
     {
         drawLine();
         printCentered("Do you want to see the detailed steps of Extended Euclidean Algorithm? [y/n]:", RESET, false);
-        getline(cin, choice);
+        readInputLine(choice);
     } while (!(choice == "y" || choice == "n" || choice == "Y" || choice == "N"));
 
     if (choice == "y" || choice == "Y")
@@ -627,17 +1797,30 @@ The standard form of this equation is 'a^-1 mod m')";
     else
         showSteps = false;
 
-    res = modInverse(a, m);
+    if (fitsInBigInt(a) && fitsInBigInt(m))
+    {
+        // the steps are only shown when it is actually computed
+        auto compute = [&]() { return modInverse(toBigInt(a), toBigInt(m)); };
+        bigInt inverse = showSteps ? compute() : memoizedResult(CACHE_INVERSE, toBigInt(a), toBigInt(m), 0, compute);
+        if (inverse != LLONG_MIN)
+            res = to_string(inverse);
+    }
+    else
+    {
+        BigNumber inverse = modInverse(a, m);
+        if (inverse >= BigNumber(0))
+            res = numberToString(inverse);
+    }
 
     cout << "\n";
-    if (res == LLONG_MIN)
+    if (res.empty())
     {
         printCentered("Inverse does not exist!", RED);
         printCentered("(a and m are not coprime)", RED);
     }
     else
     {
-        string str = "Answer: " + to_string(a) + "^-1 mod " + to_string(m) + " = " + to_string(res);
+        string str = "Answer: " + numberToString(a) + "^-1 mod " + numberToString(m) + " = " + res;
         printCentered(str, GREEN);
     }
     pressEnterToContinue();
@@ -658,7 +1841,7 @@ The standard form of this equation is 'ax ≡ b (mod m)')";
     do
     {
         printCentered("Do you want to solve a linear congruence equation? [y/n]: ", RESET, false);
-        getline(cin, choice);
+        readInputLine(choice);
     } while (!(choice == "y" || choice == "n" || choice == "Y" || choice == "N"));
 
     if (choice == "n" || choice == "N")
@@ -666,20 +1849,19 @@ The standard form of this equation is 'ax ≡ b (mod m)')";
         return;
     }
 
-    bigInt a, b, m;
-    bigInt res;
+    BigNumber a, b, m;
 
     cout << "\n";
 
-    a = getNumberInput("Enter the value of a");
-    b = getNumberInput("Enter the value of b");
-    m = getNumberInput("Enter the value of m (mod)", true);
+    a = getBigNumberInput("Enter the value of a");
+    b = getBigNumberInput("Enter the value of b");
+    m = getBigNumberInput("Enter the value of m (mod)", true);
 
     do
     {
         drawLine();
         printCentered("Do you want to see the detailed steps of Extended Euclidean Algorithm? [y/n]:", RESET, false);
-        getline(cin, choice);
+        readInputLine(choice);
     } while (!(choice == "y" || choice == "n" || choice == "Y" || choice == "N"));
 
     if (choice == "y" || choice == "Y")
@@ -687,17 +1869,44 @@ The standard form of this equation is 'ax ≡ b (mod m)')";
     else
         showSteps = false;
 
-    res = linearCongruence(a, b, m);
+    // Only the first few solutions and the last one are ever generated, however many there are.
+    const int shownLimit = 10;
+    string count, step, last;
+    vector<string> listed;
+    auto describe = [&](const auto &solutions) {
+        using T = decltype(solutions.count);
+        if (solutions.count == T(0))
+            return;
+        count = numberToString(solutions.count);
+        step = numberToString(solutions.step);
+        T shown = T(0);
+        for (auto it = solutions.begin(); shown < T(shownLimit) && it != solutions.end(); ++it, shown = shown + T(1))
+            listed.push_back(numberToString(*it));
+        if (shown < solutions.count)
+            last = numberToString(solutions.last());
+    };
+    if (fitsInBigInt(a) && fitsInBigInt(b) && fitsInBigInt(m))
+        describe(linearCongruenceSolutions(toBigInt(a), toBigInt(b), toBigInt(m)));
+    else
+        describe(linearCongruenceSolutions(a, b, m));
 
     cout << "\n";
-    if (res == LLONG_MIN)
+    if (listed.empty())
     {
         printCentered("No solution exists for the given linear congruence.", RED);
     }
     else
     {
-        string str = "Answer: The solution x ≡ " + to_string(res) + " (mod " + to_string(m) + ")";
+        string str = "Answer: The solution x ≡ " + listed[0] + " (mod " + step + ")";
         printCentered(str, GREEN);
+        printCentered(count + (count == "1" ? " solution" : " solutions") + " modulo " + numberToString(m) + ":", CYAN);
+        for (const string &x : listed)
+            printCentered("x = " + x, CYAN);
+        if (!last.empty())
+        {
+            printCentered("...", CYAN);
+            printCentered("x = " + last, CYAN);
+        }
     }
     pressEnterToContinue();
     showSteps = false;
@@ -710,8 +1919,10 @@ void showCRTScreen()
         R"(The Chinese Remainder Theorem (CRT) is a
 powerful tool in number theory that
 provides a way to solve systems of
-simultaneous linear congruences with
-pairwise coprime moduli.
+simultaneous linear congruences. When
+the moduli share factors, a solution
+exists only if the equations agree
+modulo each shared gcd.
 
 The standard form of this equation is a system of congruences like:
 x ≡ a1 (mod m1)
@@ -722,7 +1933,7 @@ x ≡ ak (mod mk))";
     do
     {
         printCentered("Do you want to solve a system of linear congruences? [y/n]:", RESET, false);
-        getline(cin, choice);
+        readInputLine(choice);
     } while (!(choice == "y" || choice == "n" || choice == "Y" || choice == "N"));
 
     if (choice == "n" || choice == "N")
@@ -730,7 +1941,7 @@ x ≡ ak (mod mk))";
         return;
     }
 
-    bigInt res, M;
+    BigNumber res, M;
     int numEquations;
 
     numEquations = getNumberInput("Enter number of equations", true);
@@ -742,24 +1953,26 @@ x ≡ ak (mod mk))";
         return;
     }
 
-    bigInt **equations = new bigInt *[numEquations];
+    BigNumber **equations = new BigNumber *[numEquations];
+    bool allFit = true;
 
     for (int i = 0; i < numEquations; i++)
-        equations[i] = new bigInt[2];
+        equations[i] = new BigNumber[2];
 
     for (int i = 0; i < numEquations; i++)
     {
         cout << "\n";
         printCentered("--- Equation " + to_string(i + 1) + " ---", YELLOW);
-        equations[i][0] = getNumberInput("Enter the value of a");
-        equations[i][1] = getNumberInput("Enter the value of m (mod)", true);
+        equations[i][0] = getBigNumberInput("Enter the value of a");
+        equations[i][1] = getBigNumberInput("Enter the value of m (mod)", true);
+        allFit = allFit && fitsInBigInt(equations[i][0]) && fitsInBigInt(equations[i][1]);
     }
 
     do
     {
         drawLine();
         printCentered("Do you want to see the detailed steps of Extended Euclidean Algorithm? [y/n]:", RESET, false);
-        getline(cin, choice);
+        readInputLine(choice);
     } while (!(choice == "y" || choice == "n" || choice == "Y" || choice == "N"));
 
     if (choice == "y" || choice == "Y")
@@ -767,21 +1980,42 @@ x ≡ ak (mod mk))";
     else
         showSteps = false;
 
-    res = chineseRemainderTheorem(equations, M, numEquations);
+    // The 64-bit solver reports M = 0 when the lcm of the moduli doesn't fit;
+    // the system is then solved again over BigNumber.
+    bigInt smallM = 0;
+    int conflict[2];
+    if (allFit)
+    {
+        bigInt **smallEquations = new bigInt *[numEquations];
+        for (int i = 0; i < numEquations; i++)
+            smallEquations[i] = new bigInt[2]{toBigInt(equations[i][0]), toBigInt(equations[i][1])};
+
+        bigInt smallRes = chineseRemainderTheorem(smallEquations, smallM, numEquations, conflict);
+        res = smallRes == LLONG_MIN ? BigNumber(-1) : BigNumber(smallRes);
+        M = BigNumber(smallM);
+
+        for (int i = 0; i < numEquations; i++)
+            delete[] smallEquations[i];
+        delete[] smallEquations;
+    }
+    if (!allFit || smallM == 0)
+        res = chineseRemainderTheorem(equations, M, numEquations, conflict);
 
     for (int i = 0; i < numEquations; i++)
         delete[] equations[i];
     delete[] equations;
 
     cout << "\n";
-    if (res == LLONG_MIN)
+    if (res < BigNumber(0))
     {
-        printCentered("No solution exists for the given system of linear", RED);
-        printCentered("congruences as mods are not relatively prime", RED);
+        printCentered("No solution exists for the given system of linear congruences", RED);
+        printCentered("as equations " + to_string(conflict[0] + 1) + " and " + to_string(conflict[1] + 1) +
+                          " contradict each other modulo gcd of their mods",
+                      RED);
     }
     else
     {
-        string str = "Answer: The solution x ≡ " + to_string(res) + " (mod " + to_string(M) + ")";
+        string str = "Answer: The solution x ≡ " + numberToString(res) + " (mod " + numberToString(M) + ")";
         printCentered(str, GREEN);
     }
     pressEnterToContinue();
@@ -813,13 +2047,10 @@ appended to each block.)";
             {
                 drawLine();
                 printCentered("Enter the data bits (sequence of 0s and 1s) to generate parity bit: ");
-                getline(cin, data);
+                readInputLine(data);
             } while (!isValidBinaryString(data));
 
-            for (int i = 0; i < data.length(); i++)
-            {
-                digitSum += (data[i] - '0');
-            }
+            digitSum = countOnes(packBits(data));
             printCentered("Parity bit: " + to_string(digitSum % 2), GREEN);
             pressEnterToContinue();
         }
@@ -832,12 +2063,9 @@ appended to each block.)";
             {
                 drawLine();
                 printCentered("Enter the data bits (sequence of 0s and 1s) to check validity: ");
-                getline(cin, data);
+                readInputLine(data);
             } while (!isValidBinaryString(data));
-            for (int i = 0; i < data.length(); i++)
-            {
-                digitSum += (data[i] - '0');
-            }
+            digitSum = countOnes(packBits(data));
             if (digitSum % 2 == 0)
             {
                 printCentered("Data is valid", GREEN);
@@ -887,16 +2115,10 @@ and data entry.)";
             {
                 drawLine();
                 printCentered("Enter the first 11 digits of the UPC code: ");
-                getline(cin, upc);
+                readInputLine(upc);
             } while (!isValidNumber(upc, true) || upc.length() != 11);
 
-            for (int i = 0; i < 11; i++)
-            {
-                if (i % 2 == 0)
-                    sum += (upc[i] - '0');
-                else
-                    sum += 3 * (upc[i] - '0');
-            }
+            sum = barcodeWeightedSum(upc, UPC_FORMAT);
 
             checkDigit = (10 - (sum % 10)) % 10;
 
@@ -912,16 +2134,10 @@ and data entry.)";
             {
                 drawLine();
                 printCentered("Enter the UPC code: ");
-                getline(cin, upc);
+                readInputLine(upc);
             } while (!isValidNumber(upc, true) || upc.length() != 12);
 
-            for (int i = 0; i < 12; i++)
-            {
-                if (i % 2 == 0)
-                    sum += (upc[i] - '0');
-                else
-                    sum += 3 * (upc[i] - '0');
-            }
+            sum = barcodeWeightedSum(upc, UPC_FORMAT);
 
             cout << "\n";
             if (verifyCongruence(sum, 0, 10))
@@ -972,13 +2188,10 @@ the integrity of book.)";
             {
                 drawLine();
                 printCentered("Enter the first 9 digits of the ISBN-10 code: ");
-                getline(cin, isbn);
+                readInputLine(isbn);
             } while (!isValidISBN(isbn) || isbn.length() != 9);
 
-            for (int i = 0; i < 9; i++)
-            {
-                sum += (i + 1) * (isbn[i] - '0');
-            }
+            sum = barcodeWeightedSum(isbn, ISBN10_FORMAT);
 
             checkDigit = sum % 11;
 
@@ -1002,20 +2215,10 @@ the integrity of book.)";
             {
                 drawLine();
                 printCentered("Enter the ISBN code: ");
-                getline(cin, isbn);
+                readInputLine(isbn);
             } while (!isValidISBN(isbn) || isbn.length() != 10);
 
-            for (int i = 0; i < 10; i++)
-            {
-                if (isbn[i] == 'X')
-                {
-                    res += (i + 1) * 10;
-                }
-                else
-                {
-                    res += (i + 1) * (isbn[i] - '0');
-                }
-            }
+            res = barcodeWeightedSum(isbn, ISBN10_FORMAT);
 
             cout << "\n";
             if (verifyCongruence(res, 0, 11))
@@ -1039,76 +2242,405 @@ the integrity of book.)";
     } while (choice != 3);
 }
 
-// ************ Main Logic Functions ******************
-bigInt gcd(bigInt a, bigInt b)
+void showPrimalityScreen()
 {
-    if (a == 0)
-        return b;
-    return gcd(b % a, a);
-}
+    string choice;
+    string desc =
+        R"(A positive integer p greater than 1 is prime
+if its only positive factors are 1 and p.
+Numbers below 2^64 are tested exactly with
+Miller-Rabin over a fixed set of bases; larger
+ones get the Baillie-PSW test, which no known
+composite passes.)";
+    showScreenIntro("Primality Test", desc);
+    do
+    {
+        printCentered("Do you want to test whether a number is prime? [y/n]: ", RESET, false);
+        readInputLine(choice);
+    } while (!(choice == "y" || choice == "n" || choice == "Y" || choice == "N"));
 
-/*
-This function takes congruence (of form ax≡b(mod m)) and returns whether it is solvable or not
-The logic of this function is described in the 'book' in proof of Theorem 4 from chapter 4(Page 255 of 8th edition).
-*/
-bool verifyCongruence(bigInt a, bigInt b, bigInt m)
-{
-    return (a - b) % m == 0;
-}
+    if (choice == "n" || choice == "N")
+    {
+        return;
+    }
 
-/*
-Computes (b^n) mod m using fast modular exponentiation
-The algorith from this function was given in the book's chapter number 4, section 4.2.4 (Page 268 of 8th edition).
-This algorithm uses the concept of binary expansion
-*/
-bigInt modularExponentiation(bigInt b, bigInt n, bigInt m)
-{
-    bigInt x = 1;
-    bigInt power = b % m;
+    BigNumber n = getBigNumberInput("Enter the value of n");
 
-    while (n > 0)
-    {
-        if (n % 2 == 1) // if current bit a_i = 1
-            x = (x * power) % m;
+    cout << "\n";
+    printCentered("Testing...", YELLOW);
+    animationPause(300);
 
-        power = (power * power) % m; // square for next bit
-        n /= 2;                      // move to next bit
+    cout << "\n";
+    printCentered("RESULT", GREEN);
+    if (isPrime(n))
+        printCentered(numberToString(n) + " is prime", BOLD + CYAN);
+    else
+    {
+        printCentered(numberToString(n) + " is not prime", BOLD + CYAN);
+        printCentered("Next prime: " + numberToString(nextPrime(n)), CYAN);
     }
-
-    return x; // equals b^n mod m
+    pressEnterToContinue();
 }
 
-// extended gcd: returns gcd(a,b) and sets x,y such that a*x + b*y = gcd(a,b)
-/*
-=> The algorithm for this function is learned online (https://www.geeksforgeeks.org/dsa/euclidean-algorithms-basic-and-extended/).
-*/
-bigInt extendedGcd(bigInt a, bigInt b, bigInt &s, bigInt &t, bool showSteps)
+void showFactorizationScreen()
 {
-    if (b == 0)
+    string choice;
+    string desc =
+        R"(Every integer n > 1 is a product of primes
+in exactly one way (the Fundamental Theorem of
+Arithmetic). From the factorization follow
+Euler's phi(n), the count of 1..n coprime to n,
+and Carmichael's lambda(n), the smallest t with
+a^t ≡ 1 (mod n) for every a coprime to n.)";
+    showScreenIntro("Prime Factorization", desc);
+    do
     {
-        s = 1;
-        t = 0;
-        return a;
-    }
-    if (a >= b && showSteps)
+        printCentered("Do you want to factor a number? [y/n]: ", RESET, false);
+        readInputLine(choice);
+    } while (!(choice == "y" || choice == "n" || choice == "Y" || choice == "N"));
+
+    if (choice == "n" || choice == "N")
     {
-        string step = to_string(a) + " = " + to_string(b) + "*" + to_string(a / b) + " + " + to_string(a % b);
-        printCentered(step, YELLOW);
-        sleep(100);
+        return;
     }
-    bigInt s1, t1;
-    bigInt g = extendedGcd(b, a % b, s1, t1, showSteps);
-    s = t1;
-    t = s1 - (a / b) * t1;
-    return g;
-}
+
+    BigNumber n = getBigNumberInput("Enter the value of n", true);
+    cout << "\n";
+    if (!fitsInUBigInt(n))
+    {
+        printCentered("n must be below 2^64", RED);
+        pressEnterToContinue();
+        return;
+    }
+
+    uBigInt value = toUBigInt(n);
+    string factors;
+    appendFactorization(factors, factorize(value));
+    printCentered("Factoring...", YELLOW);
+    animationPause(300);
+
+    cout << "\n";
+    printCentered("RESULT", GREEN);
+    printCentered(numberToString(n) + " = " + (factors.empty() ? "1" : factors), BOLD + CYAN);
+    printCentered("phi(" + numberToString(n) + ") = " + to_string(eulerTotient(value)), CYAN);
+    printCentered("lambda(" + numberToString(n) + ") = " + to_string(carmichaelLambda(value)), CYAN);
+    pressEnterToContinue();
+}
+
+void showOrderScreen()
+{
+    string choice;
+    string desc =
+        R"(The multiplicative order of a modulo n is the
+smallest t > 0 with a^t ≡ 1 (mod n): the length
+of the cycle a, a^2, a^3, ... runs through. It
+exists when a and n are coprime and always
+divides Carmichael's lambda(n).)";
+    showScreenIntro("Multiplicative Order", desc);
+    do
+    {
+        printCentered("Do you want to find the order of 'a' mod 'n'? [y/n]: ", RESET, false);
+        readInputLine(choice);
+    } while (!(choice == "y" || choice == "n" || choice == "Y" || choice == "N"));
+
+    if (choice == "n" || choice == "N")
+    {
+        return;
+    }
+
+    BigNumber a = getBigNumberInput("Enter the value of a");
+    BigNumber n = getBigNumberInput("Enter the value of n (mod)", true);
+    cout << "\n";
+    if (!fitsInUBigInt(n))
+    {
+        printCentered("n must be below 2^64", RED);
+        pressEnterToContinue();
+        return;
+    }
+
+    BigNumber reduced = (a % n + n) % n;
+    uBigInt order = multiplicativeOrder(toUBigInt(reduced), toUBigInt(n));
+    if (order == 0)
+    {
+        printCentered("Order does not exist!", RED);
+        printCentered("(a and n are not coprime)", RED);
+    }
+    else
+        printCentered("ord_" + numberToString(n) + "(" + numberToString(a) + ") = " + to_string(order), GREEN);
+    pressEnterToContinue();
+}
+
+void showDiscreteLogScreen()
+{
+    string choice;
+    string desc =
+        R"(The discrete logarithm undoes modular
+exponentiation: given b, y and m it finds the
+smallest x with b^x ≡ y (mod m). The search
+splits the order of b into prime powers
+(Pohlig-Hellman) and solves each part with
+baby-step giant-step, so it is fast when the
+order has only small prime factors.)";
+    showScreenIntro("Discrete Logarithm", desc);
+    do
+    {
+        printCentered("Do you want to solve b^x ≡ y (mod m)? [y/n]: ", RESET, false);
+        readInputLine(choice);
+    } while (!(choice == "y" || choice == "n" || choice == "Y" || choice == "N"));
+
+    if (choice == "n" || choice == "N")
+    {
+        return;
+    }
+
+    BigNumber b = getBigNumberInput("Enter the value of b (the base)");
+    BigNumber y = getBigNumberInput("Enter the value of y");
+    BigNumber m = getBigNumberInput("Enter the value of m (mod)", true);
+    cout << "\n";
+    if (!fitsInBigInt(b) || !fitsInBigInt(y) || !fitsInBigInt(m))
+    {
+        printCentered("b, y and m must fit in 64 bits", RED);
+        pressEnterToContinue();
+        return;
+    }
+
+    printCentered("Searching...", YELLOW);
+    BabyStepTable table;
+    bigInt x = discreteLog(toBigInt(b), toBigInt(y), toBigInt(m), table, 64 << 20);
+
+    cout << "\n";
+    if (x == LLONG_MIN)
+    {
+        printCentered("No solution exists!", RED);
+        printCentered("(y is not a power of b mod m)", RED);
+    }
+    else
+    {
+        printCentered("RESULT", GREEN);
+        printCentered("x = " + to_string(x), BOLD + CYAN);
+        printCentered(numberToString(b) + "^" + to_string(x) + " ≡ " + numberToString(y) + " (mod " + numberToString(m) + ")", CYAN);
+    }
+    pressEnterToContinue();
+}
+
+void showSqrtModScreen()
+{
+    string choice;
+    string desc =
+        R"(A modular square root of a is any x with
+x² ≡ a (mod m). For a prime m there are at most
+two (Tonelli-Shanks or Cipolla's algorithm);
+for a composite m the roots modulo each prime
+power are lifted with Hensel's lemma and joined
+with the Chinese Remainder Theorem, so there can
+be many more.)";
+    showScreenIntro("Modular Square Root", desc);
+    do
+    {
+        printCentered("Do you want to solve x² ≡ a (mod m)? [y/n]: ", RESET, false);
+        readInputLine(choice);
+    } while (!(choice == "y" || choice == "n" || choice == "Y" || choice == "N"));
+
+    if (choice == "n" || choice == "N")
+    {
+        return;
+    }
+
+    BigNumber a = getBigNumberInput("Enter the value of a");
+    BigNumber m = getBigNumberInput("Enter the value of m (mod)", true);
+    cout << "\n";
+    if (!fitsInBigInt(a) || !fitsInBigInt(m))
+    {
+        printCentered("a and m must fit in 64 bits", RED);
+        pressEnterToContinue();
+        return;
+    }
+
+    SquareRootSet roots;
+    if (!sqrtMod(toBigInt(a), toBigInt(m), roots))
+    {
+        printCentered("No solution exists!", RED);
+        printCentered("(a is not a square mod m)", RED);
+        pressEnterToContinue();
+        return;
+    }
+
+    const uBigInt shownLimit = 20;
+    printCentered("RESULT", GREEN);
+    printCentered(to_string(roots.count) + (roots.count == 1 ? " root" : " roots") + " in [0, " + numberToString(m) + ")", BOLD + CYAN);
+    for (uBigInt i = 0; i < roots.count && i < shownLimit; i++)
+        printCentered("x = " + to_string(squareRootAt(roots, i)), CYAN);
+    if (roots.count > shownLimit)
+        printCentered("... and " + to_string(roots.count - shownLimit) + " more", CYAN);
+    pressEnterToContinue();
+}
+
+void showLinearRecurrenceScreen()
+{
+    string choice;
+    string desc =
+        R"(A linear recurrence of order k defines each
+term from the k before it:
+a_i = c1·a_(i-1) + c2·a_(i-2) + ... + ck·a_(i-k).
+Given the coefficients and a_0 ... a_(k-1), the
+term a_n mod m is found with O(k² log n) work
+(Kitamasa's method), so n can be as large as
+10^18; Fibonacci is k = 2, c1 = c2 = 1.)";
+    showScreenIntro("Linear Recurrence", desc);
+    do
+    {
+        printCentered("Do you want to compute a term of a recurrence? [y/n]: ", RESET, false);
+        readInputLine(choice);
+    } while (!(choice == "y" || choice == "n" || choice == "Y" || choice == "N"));
+
+    if (choice == "n" || choice == "N")
+    {
+        return;
+    }
+
+    bigInt k = getNumberInput("Enter the order k", true);
+    bigInt m = getNumberInput("Enter the value of m (mod)", true);
+    bigInt n = getNumberInput("Enter the index n");
+    if (k > 64 || n < 0)
+    {
+        cout << "\n";
+        printCentered(n < 0 ? "n can't be negative" : "Enter at most 64 terms here (use --batch linrec for more)", RED);
+        pressEnterToContinue();
+        return;
+    }
+    vector<uBigInt> coefficients(k), initial(k);
+    cout << "\n";
+    for (bigInt i = 0; i < k; i++)
+        coefficients[i] = normalizeMod(getNumberInput("Enter c" + to_string(i + 1)), m);
+    cout << "\n";
+    for (bigInt i = 0; i < k; i++)
+        initial[i] = normalizeMod(getNumberInput("Enter a_" + to_string(i)), m);
+
+    cout << "\n";
+    printCentered("RESULT", GREEN);
+    printCentered("a_" + to_string(n) + " ≡ " + to_string(linearRecurrence(coefficients, initial, n, m)) + " (mod " + to_string(m) + ")", BOLD + CYAN);
+    pressEnterToContinue();
+}
+
+// ************ Main Logic Functions ******************
+// gcd of the magnitudes of a and b (binaryGcd() below).
+template <>
+bigInt gcd<bigInt>(bigInt a, bigInt b)
+{
+    uBigInt x = a < 0 ? 0 - (uBigInt)a : a;
+    uBigInt y = b < 0 ? 0 - (uBigInt)b : b;
+    return binaryGcd(x, y);
+}
+
+/*
+This function takes congruence (of form ax≡b(mod m)) and returns whether it is solvable or not
+The logic of this function is described in the 'book' in proof of Theorem 4 from chapter 4(Page 255 of 8th edition).
+*/
+bool verifyCongruence(bigInt a, bigInt b, bigInt m)
+{
+    return normalizeMod(a, m) == normalizeMod(b, m);
+}
+
+/*
+Computes (b^n) mod m using fast modular exponentiation
+The algorith from this function was given in the book's chapter number 4, section 4.2.4 (Page 268 of 8th edition).
+This algorithm uses the concept of binary expansion
+*/
+template <>
+bigInt modularExponentiation<bigInt>(bigInt b, bigInt n, bigInt m)
+{
+    BarrettContext ctx = makeBarrettContext(m);
+    uBigInt x = 1 % m;
+    uBigInt power = normalizeMod(b, m);
+
+    while (n > 0)
+    {
+        if (n % 2 == 1) // if current bit a_i = 1
+            x = barrettMulMod(ctx, x, power);
+
+        power = barrettMulMod(ctx, power, power); // square for next bit
+        n /= 2;                      // move to next bit
+    }
+
+    return x; // equals b^n mod m
+}
+
+// extended gcd: returns gcd(a,b) and sets x,y such that a*x + b*y = gcd(a,b)
+/*
+=> The algorithm for this function is learned online (https://www.geeksforgeeks.org/dsa/euclidean-algorithms-basic-and-extended/).
+It runs as a loop that keeps the Bezout coefficients of the current pair, with a single
+division per step; the step display is left to extendedGcdWithSteps().
+*/
+template <>
+bigInt extendedGcd<bigInt>(bigInt a, bigInt b, bigInt &s, bigInt &t, bool showSteps)
+{
+    if (showSteps)
+        return extendedGcdWithSteps(a, b, s, t);
+
+    bigInt s0 = 1, s1 = 0, t0 = 0, t1 = 1;
+    uint64_t steps = 0;
+    while (b != 0)
+    {
+        bigInt q = a / b;
+        bigInt r = a - q * b;
+        a = b;
+        b = r;
+        bigInt next = s0 - q * s1;
+        s0 = s1;
+        s1 = next;
+        next = t0 - q * t1;
+        t0 = t1;
+        t1 = next;
+        steps++;
+    }
+    countEuclidSteps(steps);
+    s = s0;
+    t = t0;
+    return a;
+}
+
+/*
+Stein's binary GCD: common factors of two are taken out with one count-trailing-zeros each,
+after which every step is a subtraction and a shift instead of a division.
+*/
+uBigInt binaryGcd(uBigInt a, uBigInt b)
+{
+    if (a == 0)
+        return b;
+    if (b == 0)
+        return a;
+
+    int shift = countTrailingZeros(a | b);
+    a >>= countTrailingZeros(a);
+    while (b != 0)
+    {
+        // min/max instead of a swap branch compiles to conditional moves.
+        b >>= countTrailingZeros(b);
+        uBigInt smaller = min(a, b);
+        b = max(a, b) - smaller;
+        a = smaller;
+    }
+    return a << shift;
+}
+
+int countTrailingZeros(uBigInt x)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return (int)index;
+#else
+    return __builtin_ctzll(x);
+#endif
+}
 
 /*
 modular inverse of a modulo m using Extended Euclidean Algorithm
 returns inverse in range [0, m-1] if it exists, otherwise returns LLONG_MIN
 Concept of this function is taken from 'book', chapter 4, section 4.4.2 Theorem 1 (Page 291 of 8th edition).
 */
-bigInt modInverse(bigInt a, bigInt m)
+template <>
+bigInt modInverse<bigInt>(bigInt a, bigInt m)
 {
     bigInt s, t;
     if (showSteps)
@@ -1129,20 +2661,23 @@ bigInt modInverse(bigInt a, bigInt m)
         }
     }
 
-    a = (a % m + m) % m; // make sure a >= 0 and a < m
+    a = normalizeMod(a, m); // make sure a >= 0 and a < m
     bigInt g = extendedGcd(a, m, s, t, showSteps);
 
     if (g != 1)
         return LLONG_MIN;   // inverse doesn't exist when gcd != 1
-    return (s % m + m) % m; // returning +ve result
+    return normalizeMod(s, m); // returning +ve result
 }
 
 /*
 This function solves linearCongruence of Form ax≡b (mod m). Just give the value of a, b and m and this function returns (if possible) the value of x, otherwise LLONG_MIN
 Concept of this function is taken from 'book', chapter 4, section 4.4.2 Theorem 1 (Page 291 of 8th edition).
 */
-bigInt linearCongruence(bigInt a, bigInt b, bigInt m)
+template <>
+bigInt linearCongruence<bigInt>(bigInt a, bigInt b, bigInt m)
 {
+    a = normalizeMod(a, m);
+    b = normalizeMod(b, m);
     bigInt g = gcd(a, m);
     bigInt x;
 
@@ -1163,48 +2698,184 @@ bigInt linearCongruence(bigInt a, bigInt b, bigInt m)
     {
         return LLONG_MIN;
     }
-    x = (b * inv) % m;
+    x = mulMod(b, inv, m);
     return x;
 }
 
 /*
 This function solves system of linear congruences using Chinese Remainder Theorem.
 Steps to implement this function is taken from 'https://brilliant.org/wiki/chinese-remainder-theorem/'
+The congruences are merged one at a time. If x ≡ r (mod M) solves the first i equations and
+g = gcd(M, m) = s*M + t*m, then x ≡ a (mod m) can also hold only if g divides (a - r); in
+that case x = r + M*u with u ≡ ((a - r)/g) * s (mod m/g), and the combined modulus is
+lcm(M, m) = M*(m/g). One extended GCD per equation covers both coprime and non-coprime
+moduli, so there is no pairwise gcd check.
+Returns LLONG_MIN with M = LLONG_MIN when the system is inconsistent (the 0-based indices of
+two contradicting equations go to conflict[0] and conflict[1] if given), or with M = 0 when
+the solution's modulus doesn't fit in 64 bits (see garnerCRT() for that case).
 */
-bigInt chineseRemainderTheorem(bigInt **equations, bigInt &M, int k)
+template <>
+bigInt chineseRemainderTheorem<bigInt>(bigInt **equations, bigInt &M, int k, int *conflict)
 {
-    bigInt x = 0;
-    M = 1;
-    bigInt y, z;
-    for (int i = 0; i < k-1; i++)
+    M = equations[0][1];
+    bigInt x = normalizeMod(equations[0][0], M);
+
+    for (int i = 1; i < k; i++)
     {
-        for (int j = i + 1; j < k; j++)
+        bigInt m = equations[i][1];
+        bigInt a = normalizeMod(equations[i][0], m);
+        bigInt s, t;
+        if (showSteps)
+        {
+            cout << "\n";
+            printCentered("Merging equation " + to_string(i + 1), YELLOW);
+        }
+        bigInt g = extendedGcd(M % m, m, s, t, showSteps);
+        bigInt diff = subMod(a, x % m, m);
+        if (diff % g != 0)
         {
-            if(gcd(equations[i][1], equations[j][1]) != 1){
-                // => CRT could not apply as mods are not relatively co-prime.
-                M = LLONG_MIN;
-                return LLONG_MIN;
+            // => no x satisfies equation i together with the ones before it.
+            if (conflict)
+            {
+                conflict[0] = findConflictingEquation(equations, i);
+                conflict[1] = i;
             }
+            M = LLONG_MIN;
+            return LLONG_MIN;
+        }
+
+        bigInt step = m / g;
+        bigInt u = mulMod(diff / g, normalizeMod(s, step), step);
+        bigInt combined;
+        if (__builtin_mul_overflow(M, step, &combined))
+        {
+            // => the solution can't be represented in 64 bits.
+            countFallback(FALLBACK_CRT_MODULUS);
+            M = 0;
+            return LLONG_MIN;
         }
-        
+        x += M * u; // u < m/g, so this stays below lcm(M, m)
+        M = combined;
     }
-    
+    return x;
+}
+
+/*
+Garner's algorithm: writes the solution in mixed radix form
+    x = v0 + v1*m0 + v2*m0*m1 + ... + v(k-1)*m0*...*m(k-2),   0 <= vi < mi
+where each digit is found modulo its own mi, so no intermediate value ever exceeds the
+largest modulus however large the product is. It needs one inverse per modulus and O(k^2)
+multiplications to evaluate the partial sums.
+Returns false if the moduli aren't pairwise coprime.
+*/
+bool garnerCRT(bigInt **equations, int k, vector<bigInt> &digits)
+{
+    digits.assign(k, 0);
     for (int i = 0; i < k; i++)
     {
-        M *= equations[i][1];
+        bigInt m = equations[i][1];
+        BarrettContext ctx = makeBarrettContext(m);
+        uBigInt partial = 0, product = 1 % m; // (v0 + ... ) mod m and m0*...*m(i-1) mod m
+        for (int j = 0; j < i; j++)
+        {
+            partial = addMod(partial, barrettMulMod(ctx, digits[j] % m, product), m);
+            product = barrettMulMod(ctx, product, equations[j][1] % m);
+        }
+
+        bigInt inv = modInverse((bigInt)product, m);
+        if (inv == LLONG_MIN)
+            return false;
+        digits[i] = barrettMulMod(ctx, subMod(normalizeMod(equations[i][0], m), partial, m), inv);
     }
-    for (int i = 0; i < k; i++)
+    return true;
+}
+
+// Evaluates Garner's mixed radix digits modulo 'target' (Horner's rule from the top digit).
+bigInt mixedRadixMod(const vector<bigInt> &digits, bigInt **equations, bigInt target)
+{
+    uBigInt x = 0;
+    for (size_t i = digits.size(); i-- > 0;)
+        x = addMod(mulMod(x, normalizeMod(equations[i][1], target), target), digits[i] % target, target);
+    return x;
+}
+
+// Evaluates Garner's mixed radix digits exactly; also returns the product of the moduli.
+BigNumber mixedRadixToBigNumber(const vector<bigInt> &digits, bigInt **equations, BigNumber &M)
+{
+    BigNumber x(0);
+    M = BigNumber(1);
+    for (size_t i = digits.size(); i-- > 0;)
     {
-        y = M / equations[i][1];
-        z = modInverse(y, equations[i][1]);
-        x += (equations[i][0] * y * z);
+        x = x * BigNumber(equations[i][1]) + BigNumber(digits[i]);
+        M = M * BigNumber(equations[i][1]);
     }
-    x %= M;
-    if (x < 0)
-        x += M;
     return x;
 }
 
+/*
+Inverts every value modulo m with Montgomery's trick: with prefix products
+p_i = a_0 * ... * a_i, a single inverse of p_(n-1) gives every a_i^-1 by walking back
+    a_i^-1 = p_(i-1) * (p_i)^-1,    (p_(i-1))^-1 = a_i * (p_i)^-1
+so n inverses cost about 3n multiplications and one extended GCD. For odd m the values stay
+in plain form and are multiplied with Montgomery's REDC anyway: each product then carries one
+factor R^-1 per value, the inverse of the full product is A^-1 * R^n, and walking back hands
+exactly one R to every a_i^-1, so no value is ever converted to or from Montgomery form.
+Values that share a factor with m get LLONG_MIN. Zeros are skipped up front; any other such
+value is found with a gcd check only when the product turns out not to be invertible.
+*/
+vector<bigInt> batchModInverse(const vector<bigInt> &values, bigInt m)
+{
+    size_t n = values.size();
+    vector<bigInt> inverses(n, LLONG_MIN);
+    vector<uBigInt> residues(n), prefix(n);
+    vector<bool> excluded(n, false);
+    MontgomeryContext mont = makeMontgomeryContext(m);
+    BarrettContext barrett = makeBarrettContext(m);
+    auto multiply = [&](uBigInt a, uBigInt b)
+    {
+        return mont.isOdd ? montgomeryMultiply(mont, a, b) : barrettMulMod(barrett, a, b);
+    };
+
+    for (size_t i = 0; i < n; i++)
+    {
+        residues[i] = normalizeMod(values[i], m);
+        excluded[i] = residues[i] == 0 && m != 1;
+    }
+
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        uBigInt product = 1 % m;
+        for (size_t i = 0; i < n; i++)
+        {
+            prefix[i] = product; // product of the included values before i
+            if (!excluded[i])
+                product = multiply(product, residues[i]);
+        }
+
+        bigInt inv = modInverse((bigInt)product, m);
+        if (inv == LLONG_MIN)
+        {
+            if (attempt == 1)
+                break;
+            for (size_t i = 0; i < n; i++)
+                excluded[i] = excluded[i] || gcd((bigInt)residues[i], m) != 1;
+            continue;
+        }
+
+        // Inverse of the product of the included values up to i (times R^count for odd m).
+        uBigInt suffixInverse = inv;
+        for (size_t i = n; i-- > 0;)
+        {
+            if (excluded[i])
+                continue;
+            inverses[i] = multiply(suffixInverse, prefix[i]);
+            suffixInverse = multiply(suffixInverse, residues[i]);
+        }
+        break;
+    }
+    return inverses;
+}
+
 void runSampleTests()
 {
     string desc =
@@ -1232,7 +2903,7 @@ void runSampleTests()
     printCentered("Input: b = " + to_string(t1.b) + ", n = " + to_string(t1.n) + ", m = " + to_string(t1.m), YELLOW);
     printCentered("Expected Output: " + to_string(t1.expected), YELLOW);
     printCentered("Actual Output: " + to_string(t1.result), YELLOW);
-    cout << endl;
+    cout << "\n";
 
     // Sample Test 2: Modular Inverse
     TestCase t2;
@@ -1245,7 +2916,7 @@ void runSampleTests()
     printCentered("Input: a = " + to_string(t2.b) + ", m = " + to_string(t2.m), YELLOW);
     printCentered("Expected Output: " + to_string(t2.expected), YELLOW);
     printCentered("Actual Output: " + to_string(t2.result), YELLOW);
-    cout << endl;
+    cout << "\n";
 
     // Sample Test 3: Linear Congruence Solver
     TestCase t3;
@@ -1259,7 +2930,7 @@ void runSampleTests()
     printCentered("Input: a = " + to_string(t3.b) + ", b = " + to_string(t3.n) + ", m = " + to_string(t3.m), YELLOW);
     printCentered("Expected Output: " + to_string(t3.expected), YELLOW);
     printCentered("Actual Output: " + to_string(t3.result), YELLOW);
-    cout << endl;
+    cout << "\n";
 
     // Sample Test 4: Chinese Remainder Theorem
     bigInt *equations[2];
@@ -1272,7 +2943,6988 @@ void runSampleTests()
     printCentered("Input: x ≡ 2 (mod 3), x ≡ 3 (mod 5)", YELLOW);
     printCentered("Expected Output: 8", YELLOW);
     printCentered("Actual Output: " + to_string(result4), YELLOW);
-    cout << endl;
+    cout << "\n";
+
+    // Sample Test 5: Chinese Remainder Theorem with non-coprime mods
+    bigInt *sharedEquations[2];
+    sharedEquations[0] = new bigInt[2]{2, 4};
+    sharedEquations[1] = new bigInt[2]{4, 6};
+    bigInt M5;
+    bigInt result5 = chineseRemainderTheorem(sharedEquations, M5, 2);
+
+    printCentered("Chinese Remainder Theorem Test (Non-Coprime Mods): ", YELLOW);
+    printCentered("Input: x ≡ 2 (mod 4), x ≡ 4 (mod 6)", YELLOW);
+    printCentered("Expected Output: 10 (mod 12)", YELLOW);
+    printCentered("Actual Output: " + to_string(result5) + " (mod " + to_string(M5) + ")", YELLOW);
+    cout << "\n";
+
+    // Sample Test 6: Primality of the Mersenne number 2^61 - 1
+    uBigInt mersenne = (1ULL << 61) - 1;
+
+    printCentered("Primality Test: ", YELLOW);
+    printCentered("Input: n = " + to_string(mersenne), YELLOW);
+    printCentered("Expected Output: prime", YELLOW);
+    printCentered(string("Actual Output: ") + (isPrime(mersenne) ? "prime" : "not prime"), YELLOW);
+    cout << "\n";
 
     pressEnterToContinue("Press enter to continue.");
-}
\ No newline at end of file
+}
+
+// ************ Generic Main Logic ******************
+// These are the textbook versions of the main logic functions for any integer-like type
+// (used with BigNumber); bigInt has its own specializations above.
+
+template <typename T>
+T noSolution()
+{
+    return T(-1); // every valid result is non-negative
+}
+
+template <>
+bigInt noSolution<bigInt>()
+{
+    return LLONG_MIN;
+}
+
+template <typename T>
+T gcd(T a, T b)
+{
+    while (a != T(0))
+    {
+        T r = b % a;
+        b = a;
+        a = r;
+    }
+    return b;
+}
+
+template <typename T>
+T modularExponentiation(T b, T n, T m)
+{
+    T x = T(1) % m;
+    T power = (b % m + m) % m;
+
+    while (n > T(0))
+    {
+        if (n % T(2) == T(1))
+            x = (x * power) % m;
+
+        power = (power * power) % m;
+        n = n / T(2);
+    }
+    return x;
+}
+
+template <typename T>
+T extendedGcd(T a, T b, T &s, T &t, bool showSteps)
+{
+    if (showSteps)
+        return extendedGcdWithSteps(a, b, s, t);
+
+    T s0 = T(1), s1 = T(0), t0 = T(0), t1 = T(1);
+    uint64_t steps = 0;
+    while (b != T(0))
+    {
+        T q = a / b;
+        T r = a - q * b;
+        a = b;
+        b = r;
+        T next = s0 - q * s1;
+        s0 = s1;
+        s1 = next;
+        next = t0 - q * t1;
+        t0 = t1;
+        t1 = next;
+        steps++;
+    }
+    countEuclidSteps(steps);
+    s = s0;
+    t = t0;
+    return a;
+}
+
+/*
+The extended Euclidean algorithm as shown on the screens: every division step
+'a = b*q + r' is printed, with a short pause so it can be followed.
+*/
+template <typename T>
+T extendedGcdWithSteps(T a, T b, T &s, T &t)
+{
+    T s0 = T(1), s1 = T(0), t0 = T(0), t1 = T(1);
+    while (b != T(0))
+    {
+        T q = a / b;
+        T r = a % b;
+        if (a >= b)
+        {
+            string step = numberToString(a) + " = " + numberToString(b) + "*" + numberToString(q) + " + " + numberToString(r);
+            printCentered(step, YELLOW);
+            animationPause(100);
+        }
+        a = b;
+        b = r;
+        T next = s0 - q * s1;
+        s0 = s1;
+        s1 = next;
+        next = t0 - q * t1;
+        t0 = t1;
+        t1 = next;
+    }
+    s = s0;
+    t = t0;
+    return a;
+}
+
+template <typename T>
+T modInverse(T a, T m)
+{
+    T s, t;
+    a = (a % m + m) % m;
+    T g = extendedGcd(a, m, s, t, showSteps);
+
+    if (g != T(1))
+        return noSolution<T>();
+    return (s % m + m) % m;
+}
+
+template <typename T>
+T linearCongruence(T a, T b, T m)
+{
+    a = (a % m + m) % m;
+    b = (b % m + m) % m;
+    T g = gcd(a, m);
+
+    if (b % g != T(0))
+        return noSolution<T>();
+    a = a / g;
+    b = b / g;
+    m = m / g;
+
+    T inv = modInverse(a, m);
+    if (inv < T(0))
+        return noSolution<T>();
+    return (b * inv) % m;
+}
+
+/*
+Every solution of ax ≡ b (mod m), not just the one modulo m/g: if x0 solves the reduced
+congruence (a/g)x ≡ b/g (mod m/g), the solutions modulo m are exactly x0 + k*(m/g) for
+k = 0, ..., g-1 (same theorem as linearCongruence()). Only x0 and g are computed here.
+*/
+template <typename T>
+CongruenceSolutions<T> linearCongruenceSolutions(T a, T b, T m)
+{
+    CongruenceSolutions<T> solutions;
+    T x = linearCongruence(a, b, m);
+    if (x < T(0))
+        return solutions;
+
+    T g = gcd((a % m + m) % m, m);
+    solutions.first = x;
+    solutions.step = m / g;
+    solutions.count = g;
+    return solutions;
+}
+
+// Incremental gcd/lcm merge, as in the bigInt version.
+template <typename T>
+T chineseRemainderTheorem(T **equations, T &M, int k, int *conflict)
+{
+    M = equations[0][1];
+    T x = (equations[0][0] % M + M) % M;
+
+    for (int i = 1; i < k; i++)
+    {
+        T m = equations[i][1];
+        T s, t;
+        if (showSteps)
+        {
+            cout << "\n";
+            printCentered("Merging equation " + to_string(i + 1), YELLOW);
+        }
+        T g = extendedGcd(M % m, m, s, t, showSteps);
+        T diff = ((equations[i][0] - x) % m + m) % m;
+        if (diff % g != T(0))
+        {
+            if (conflict)
+            {
+                conflict[0] = findConflictingEquation(equations, i);
+                conflict[1] = i;
+            }
+            M = noSolution<T>();
+            return noSolution<T>();
+        }
+
+        T step = m / g;
+        T u = diff / g * ((s % step + step) % step) % step;
+        x = x + M * u;
+        M = M * step;
+    }
+    return x;
+}
+
+/*
+Equation i contradicts the system formed by the equations before it. A system of congruences
+is solvable exactly when every pair is (ai ≡ aj mod gcd(mi, mj)), so one of the earlier
+equations must contradict equation i on its own; returns its index.
+*/
+template <typename T>
+int findConflictingEquation(T **equations, int i)
+{
+    for (int j = 0; j < i; j++)
+    {
+        T g = gcd(equations[i][1], equations[j][1]);
+        if ((equations[i][0] % g + g) % g != (equations[j][0] % g + g) % g)
+            return j;
+    }
+    return 0;
+}
+
+/*
+Computes (b^n) mod m for big numbers: Montgomery multiplication with a sliding window when m
+is odd (the usual case for RSA-style moduli), plain multiply-and-divide otherwise.
+*/
+template <>
+BigNumber modularExponentiation<BigNumber>(BigNumber b, BigNumber n, BigNumber m)
+{
+    if (m == BigNumber(1))
+        return BigNumber(0);
+    b = (b % m + m) % m;
+    if (n <= BigNumber(0))
+        return BigNumber(1);
+
+    if (!m.isOdd())
+    {
+        return slidingWindowPow(b, n, BigNumber(1), [&](const BigNumber &x, const BigNumber &y)
+                                { return x * y % m; });
+    }
+
+    BigMontgomeryContext ctx = makeBigMontgomeryContext(m);
+    Limbs base = b.limbs;
+    base.resize(ctx.n, 0);
+    bigMontgomeryMultiply(ctx, base.data(), ctx.r2.data(), base.data()); // into Montgomery form
+
+    Limbs result = slidingWindowPow(base, n, ctx.r1, [&](const Limbs &x, const Limbs &y)
+                                    {
+                                        Limbs product(ctx.n);
+                                        bigMontgomeryMultiply(ctx, x.data(), y.data(), product.data());
+                                        return product; });
+
+    Limbs one(ctx.n, 0);
+    one[0] = 1;
+    bigMontgomeryMultiply(ctx, result.data(), one.data(), result.data()); // out of Montgomery form
+    BigNumber x;
+    x.limbs = result;
+    trimLimbs(x.limbs);
+    return x;
+}
+
+template <>
+BigNumber gcd<BigNumber>(BigNumber a, BigNumber b)
+{
+    return lehmerExtendedGcd(a, b, nullptr, nullptr);
+}
+
+template <>
+BigNumber extendedGcd<BigNumber>(BigNumber a, BigNumber b, BigNumber &s, BigNumber &t, bool showSteps)
+{
+    if (showSteps)
+        return extendedGcdWithSteps(a, b, s, t);
+    return lehmerExtendedGcd(a, b, &s, &t);
+}
+
+/*
+Lehmer's gcd for big numbers (Knuth, The Art of Computer Programming, Vol. 2, Algorithm 4.5.2L).
+The Euclidean quotients are almost always decided by the leading bits alone, so they are
+computed on the top 61 bits of a and b in machine words, collected into a 2x2 matrix
+[A B; C D], and applied to the full numbers at once. When the leading bits can't decide a
+quotient, one full-precision division step is taken instead.
+Optionally keeps Bezout coefficients with s*a + t*b = gcd (pass nullptr to skip them).
+Works on the magnitudes of a and b.
+*/
+BigNumber lehmerExtendedGcd(BigNumber a, BigNumber b, BigNumber *s, BigNumber *t)
+{
+    bool negA = a.negative, negB = b.negative;
+    a.negative = b.negative = false;
+    bool swapped = a < b;
+    if (swapped)
+        swap(a, b);
+
+    bool wantCoefficients = s && t;
+    BigNumber sa(1), sb(0), ta(0), tb(1); // a = sa*a0 + ta*b0, b = sb*a0 + tb*b0
+    uint64_t steps = 0; // Euclidean quotients, whether taken in machine words or at full precision
+
+    while (!b.isZero())
+    {
+        size_t bits = a.bitLength();
+        long long A = 1, B = 0, C = 0, D = 1;
+        if (bits - b.bitLength() < 32)
+        {
+            // x, y: bits [shift, shift + 61) of a and b.
+            size_t shift = bits > 61 ? bits - 61 : 0;
+            long long x = 0, y = 0;
+            for (size_t i = 61; i-- > 0;)
+            {
+                x = (x << 1) | a.testBit(shift + i);
+                y = (y << 1) | b.testBit(shift + i);
+            }
+
+            while (y + C > 0 && y + D > 0)
+            {
+                long long q = (x + A) / (y + C);
+                if (q != (x + B) / (y + D))
+                    break;
+                long long temp = A - q * C;
+                A = C;
+                C = temp;
+                temp = B - q * D;
+                B = D;
+                D = temp;
+                temp = x - q * y;
+                x = y;
+                y = temp;
+                steps++;
+            }
+        }
+
+        if (B == 0)
+        {
+            steps++;
+            BigNumber q = a / b;
+            BigNumber r = a - q * b;
+            a = b;
+            b = r;
+            if (wantCoefficients)
+            {
+                BigNumber next = sa - q * sb;
+                sa = sb;
+                sb = next;
+                next = ta - q * tb;
+                ta = tb;
+                tb = next;
+            }
+            continue;
+        }
+
+        BigNumber bigA(A), bigB(B), bigC(C), bigD(D);
+        BigNumber nextA = bigA * a + bigB * b;
+        b = bigC * a + bigD * b;
+        a = nextA;
+        if (wantCoefficients)
+        {
+            BigNumber next = bigA * sa + bigB * sb;
+            sb = bigC * sa + bigD * sb;
+            sa = next;
+            next = bigA * ta + bigB * tb;
+            tb = bigC * ta + bigD * tb;
+            ta = next;
+        }
+    }
+    countEuclidSteps(steps);
+
+    if (wantCoefficients)
+    {
+        if (swapped)
+            swap(sa, ta);
+        *s = negA ? -sa : sa;
+        *t = negB ? -ta : ta;
+    }
+    return a;
+}
+
+// ************ Overflow-Free Arithmetic ******************
+
+// Returns a mod m in the range [0, m-1], also for negative a.
+bigInt normalizeMod(bigInt a, bigInt m)
+{
+    bigInt r = a % m;
+    return r < 0 ? r + m : r;
+}
+
+// (a + b) mod m for a, b < m; compares against m - b so the sum never leaves 64 bits.
+uBigInt addMod(uBigInt a, uBigInt b, uBigInt m)
+{
+    return a >= m - b ? a - (m - b) : a + b;
+}
+
+uBigInt subMod(uBigInt a, uBigInt b, uBigInt m)
+{
+    return a >= b ? a - b : a + (m - b);
+}
+
+/*
+(a * b) mod m without overflow for any m < 2^64, using a 128-bit intermediate.
+Compilers without __int128 get the slow but exact double-and-add loop.
+*/
+uBigInt mulMod(uBigInt a, uBigInt b, uBigInt m)
+{
+#if HAS_INT128
+    return (uBigInt)((uInt128)a * b % m);
+#else
+    a %= m;
+    b %= m;
+    uBigInt r = 0;
+    while (b)
+    {
+        if (b & 1)
+            r = addMod(r, a, m);
+        a = addMod(a, a, m);
+        b >>= 1;
+    }
+    return r;
+#endif
+}
+
+BarrettContext makeBarrettContext(bigInt m)
+{
+    BarrettContext ctx;
+    ctx.m = m;
+    ctx.mu = ~0ULL / ctx.m;
+    return ctx;
+}
+
+/*
+(a * b) mod m for a, b < m.
+With x = a*b < m^2 the estimate q = (x*mu) >> 64 is at most one below x/m, so a single
+conditional subtraction finishes the reduction.
+*/
+uBigInt barrettMulMod(const BarrettContext &ctx, uBigInt a, uBigInt b)
+{
+    if (ctx.m >> 32)
+        return mulMod(a, b, ctx.m);
+
+    uBigInt x = a * b;
+#if HAS_INT128
+    uBigInt q = (uBigInt)(((uInt128)x * ctx.mu) >> 64);
+    uBigInt r = x - q * ctx.m;
+    return r >= ctx.m ? r - ctx.m : r;
+#else
+    return x % ctx.m;
+#endif
+}
+
+// ************ Montgomery Arithmetic ******************
+
+/*
+Builds the Montgomery constants for modulus m (0 < m < 2^64).
+m^-1 mod 2^64 is found with Newton's iteration: every step doubles the number of correct
+low bits, and m itself is already an inverse of m modulo 8 for odd m.
+*/
+MontgomeryContext makeMontgomeryContext(uBigInt m)
+{
+    MontgomeryContext ctx;
+    ctx.m = m;
+    ctx.isOdd = (m & 1) && HAS_INT128;
+    if (!ctx.isOdd)
+        return ctx;
+
+#if HAS_INT128
+    uBigInt inv = ctx.m;
+    for (int i = 0; i < 5; i++)
+        inv *= 2 - ctx.m * inv;
+    ctx.inv = inv;
+    ctx.r1 = (0 - ctx.m) % ctx.m; // 2^64 mod m
+    ctx.r2 = (uBigInt)((uInt128)ctx.r1 * ctx.r1 % ctx.m);
+#endif
+    return ctx;
+}
+
+/*
+Returns a*b*R^-1 mod m for a, b in Montgomery form (REDC).
+With q = t*m^-1 mod R, t and q*m agree in their low 64 bits, so (t - q*m)/R is just the
+difference of the high halves. Both halves are below m, so nothing can overflow even for
+moduli up to 2^64 and one conditional addition finishes the reduction.
+*/
+uBigInt montgomeryMultiply(const MontgomeryContext &ctx, uBigInt a, uBigInt b)
+{
+#if HAS_INT128
+    uInt128 t = (uInt128)a * b;
+    uBigInt q = (uBigInt)t * ctx.inv;
+    uBigInt high = (uBigInt)(t >> 64);
+    uBigInt qm = (uBigInt)(((uInt128)q * ctx.m) >> 64);
+    return high >= qm ? high - qm : high - qm + ctx.m;
+#else
+    return 0;
+#endif
+}
+
+uBigInt toMontgomery(const MontgomeryContext &ctx, uBigInt x)
+{
+    return montgomeryMultiply(ctx, x % ctx.m, ctx.r2);
+}
+
+uBigInt fromMontgomery(const MontgomeryContext &ctx, uBigInt x)
+{
+    return montgomeryMultiply(ctx, x, 1);
+}
+
+/*
+Computes (b^n) mod ctx.m with the same binary expansion as modularExponentiation(), but the
+base and the accumulator stay in Montgomery form for the whole ladder, so the only division
+is the one converting b. Even moduli use modularExponentiation() instead.
+*/
+bigInt montgomeryModPow(const MontgomeryContext &ctx, bigInt b, bigInt n)
+{
+    bigInt m = ctx.m;
+    if (!ctx.isOdd)
+        return modularExponentiation(b, n, m);
+
+    uBigInt x = ctx.r1;
+    uBigInt power = toMontgomery(ctx, normalizeMod(b, m));
+
+    while (n > 0)
+    {
+        if (n & 1)
+            x = montgomeryMultiply(ctx, x, power);
+
+        power = montgomeryMultiply(ctx, power, power);
+        n >>= 1;
+    }
+
+    return fromMontgomery(ctx, x);
+}
+
+/*
+(b^n) mod ctx.m like montgomeryModPow(), but for any modulus below 2^64 and an unsigned
+exponent; even moduli multiply with mulMod() instead.
+*/
+uBigInt modPow64(const MontgomeryContext &ctx, uBigInt b, uBigInt n)
+{
+    uBigInt m = ctx.m;
+    if (!ctx.isOdd)
+    {
+        uBigInt x = 1 % m, power = b % m;
+        for (; n; n >>= 1)
+        {
+            if (n & 1)
+                x = mulMod(x, power, m);
+            power = mulMod(power, power, m);
+        }
+        return x;
+    }
+
+    uBigInt x = ctx.r1, power = toMontgomery(ctx, b);
+    for (; n; n >>= 1)
+    {
+        if (n & 1)
+            x = montgomeryMultiply(ctx, x, power);
+        power = montgomeryMultiply(ctx, power, power);
+    }
+    return fromMontgomery(ctx, x);
+}
+
+// ************ Windowed Exponentiation ******************
+
+size_t numberBitLength(bigInt n)
+{
+    return n <= 0 ? 0 : 64 - __builtin_clzll(n);
+}
+
+size_t numberBitLength(const BigNumber &n)
+{
+    return n.negative ? 0 : n.bitLength();
+}
+
+bool numberTestBit(bigInt n, size_t i)
+{
+    return (n >> i) & 1;
+}
+
+bool numberTestBit(const BigNumber &n, size_t i)
+{
+    return n.testBit(i);
+}
+
+/*
+Left-to-right sliding-window exponentiation (base^e) for any element type.
+Only odd powers base^1, base^3, ..., base^(2^w - 1) are precomputed; runs of zero bits cost
+a squaring each and every window of up to w bits costs a single multiplication.
+*/
+template <typename Element, typename Exponent, typename Multiply>
+Element slidingWindowPow(const Element &base, const Exponent &e, const Element &one, Multiply multiply)
+{
+    size_t bits = numberBitLength(e);
+    if (bits == 0)
+        return one;
+
+    int w = bits <= 16 ? 1 : bits <= 128 ? 3 : bits <= 512 ? 4 : bits <= 1536 ? 5 : 6;
+    vector<Element> oddPowers(1, base);
+    if (w > 1)
+    {
+        Element square = multiply(base, base);
+        for (int i = 1; i < (1 << (w - 1)); i++)
+            oddPowers.push_back(multiply(oddPowers.back(), square));
+    }
+
+    Element result = one;
+    bool started = false;
+    long long i = bits - 1;
+    while (i >= 0)
+    {
+        if (!numberTestBit(e, i))
+        {
+            if (started)
+                result = multiply(result, result);
+            i--;
+            continue;
+        }
+
+        // Longest window [low, i] of at most w bits that ends in a 1 bit.
+        long long low = max(i - w + 1, 0LL);
+        while (!numberTestBit(e, low))
+            low++;
+        int value = 0;
+        for (long long j = i; j >= low; j--)
+        {
+            value = (value << 1) | numberTestBit(e, j);
+            if (started)
+                result = multiply(result, result);
+        }
+        result = started ? multiply(result, oddPowers[value >> 1]) : oddPowers[value >> 1];
+        started = true;
+        i = low - 1;
+    }
+    return result;
+}
+
+/*
+Variable-base (b^n) mod ctx.m with a left-to-right sliding window in Montgomery form.
+It needs fewer multiplications than montgomeryModPow(), but each one waits for the previous
+result, whereas the right-to-left ladder overlaps its multiply with the next squaring; at
+64 bits the ladder is usually faster (see --bench), so this is not the default path.
+*/
+bigInt slidingWindowModPow(const MontgomeryContext &ctx, bigInt b, bigInt n)
+{
+    bigInt m = ctx.m;
+    if (!ctx.isOdd)
+        return modularExponentiation(b, n, m);
+    if (n <= 0)
+        return 1 % m;
+
+    uBigInt power = toMontgomery(ctx, normalizeMod(b, m));
+    uBigInt x = slidingWindowPow(power, n, ctx.r1, [&](uBigInt x, uBigInt y)
+                                 { return montgomeryMultiply(ctx, x, y); });
+    return fromMontgomery(ctx, x);
+}
+
+/*
+Precomputes the fixed-base table for base^n mod m (0 < m < 2^63), using the widest window
+whose table fits in memoryBudget bytes. Wider windows mean fewer rows and therefore fewer
+multiplications per query: 63 bits in 8-bit digits need 8 multiplications for a 16 KiB table.
+*/
+FixedBaseContext makeFixedBaseContext(bigInt base, bigInt m, size_t memoryBudget)
+{
+    FixedBaseContext ctx;
+    ctx.base = base;
+    ctx.m = m;
+    ctx.montgomery = makeMontgomeryContext(m);
+    ctx.barrett = makeBarrettContext(m);
+
+    for (int w = 16; w >= 1; w--)
+    {
+        int rows = (63 + w - 1) / w;
+        if ((size_t)rows * ((size_t)1 << w) * sizeof(uBigInt) <= memoryBudget)
+        {
+            ctx.window = w;
+            ctx.rows = rows;
+            break;
+        }
+    }
+    if (ctx.window == 0)
+        return ctx;
+
+    bool odd = ctx.montgomery.isOdd;
+    size_t width = (size_t)1 << ctx.window;
+    uBigInt one = odd ? ctx.montgomery.r1 : 1 % (uBigInt)m;
+    uBigInt power = normalizeMod(base, m); // base^(2^(i*window)) for the current row
+    if (odd)
+        power = toMontgomery(ctx.montgomery, power);
+
+    ctx.table.resize(ctx.rows * width);
+    for (int i = 0; i < ctx.rows; i++)
+    {
+        uBigInt *row = &ctx.table[i * width];
+        row[0] = one;
+        for (size_t d = 1; d < width; d++)
+            row[d] = odd ? montgomeryMultiply(ctx.montgomery, row[d - 1], power)
+                         : barrettMulMod(ctx.barrett, row[d - 1], power);
+        // base^(2^((i+1)*window)) = row[width-1] * base^(2^(i*window))
+        power = odd ? montgomeryMultiply(ctx.montgomery, row[width - 1], power)
+                    : barrettMulMod(ctx.barrett, row[width - 1], power);
+    }
+    return ctx;
+}
+
+// Computes (ctx.base^n) mod ctx.m using only table lookups and multiplications.
+bigInt fixedBaseModPow(const FixedBaseContext &ctx, bigInt n)
+{
+    if (ctx.window == 0)
+        return ctx.montgomery.isOdd ? montgomeryModPow(ctx.montgomery, ctx.base, n) : modularExponentiation(ctx.base, n, ctx.m);
+    if (n <= 0)
+        return 1 % ctx.m;
+
+    size_t width = (size_t)1 << ctx.window;
+    uBigInt mask = width - 1;
+    uBigInt x = 0;
+    bool started = false;
+    for (int i = 0; n > 0; i++, n >>= ctx.window)
+    {
+        uBigInt digit = n & mask;
+        if (!digit)
+            continue;
+        uBigInt entry = ctx.table[i * width + digit];
+        if (!started)
+            x = entry;
+        else if (ctx.montgomery.isOdd)
+            x = montgomeryMultiply(ctx.montgomery, x, entry);
+        else
+            x = barrettMulMod(ctx.barrett, x, entry);
+        started = true;
+    }
+    return ctx.montgomery.isOdd ? fromMontgomery(ctx.montgomery, x) : x;
+}
+
+// ************ Arbitrary-Precision Arithmetic ******************
+
+const size_t KARATSUBA_THRESHOLD = 32; // limbs; below this schoolbook multiplication is faster
+
+BigNumber::BigNumber(long long value)
+{
+    negative = value < 0;
+    uBigInt magnitude = negative ? 0 - (uBigInt)value : (uBigInt)value;
+    while (magnitude)
+    {
+        limbs.push_back((uint32_t)magnitude);
+        magnitude >>= 32;
+    }
+}
+
+size_t BigNumber::bitLength() const
+{
+    if (limbs.empty())
+        return 0;
+    uint32_t top = limbs.back();
+    size_t bits = 0;
+    while (top)
+    {
+        bits++;
+        top >>= 1;
+    }
+    return (limbs.size() - 1) * 32 + bits;
+}
+
+bool BigNumber::testBit(size_t i) const
+{
+    return i / 32 < limbs.size() && (limbs[i / 32] >> (i % 32)) & 1;
+}
+
+void trimLimbs(Limbs &a)
+{
+    while (!a.empty() && a.back() == 0)
+        a.pop_back();
+}
+
+// Compares two magnitudes, returns -1, 0 or 1.
+int compareLimbs(const Limbs &a, const Limbs &b)
+{
+    if (a.size() != b.size())
+        return a.size() < b.size() ? -1 : 1;
+    for (size_t i = a.size(); i-- > 0;)
+    {
+        if (a[i] != b[i])
+            return a[i] < b[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+Limbs addLimbs(const Limbs &a, const Limbs &b)
+{
+    const Limbs &longer = a.size() >= b.size() ? a : b;
+    const Limbs &shorter = a.size() >= b.size() ? b : a;
+    Limbs sum(longer.size() + 1);
+    uint64_t carry = 0;
+    for (size_t i = 0; i < longer.size(); i++)
+    {
+        carry += (uint64_t)longer[i] + (i < shorter.size() ? shorter[i] : 0);
+        sum[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    sum[longer.size()] = (uint32_t)carry;
+    trimLimbs(sum);
+    return sum;
+}
+
+// Returns a - b for magnitudes with a >= b.
+Limbs subLimbs(const Limbs &a, const Limbs &b)
+{
+    Limbs diff(a.size());
+    int64_t borrow = 0;
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        int64_t t = (int64_t)a[i] - (i < b.size() ? b[i] : 0) - borrow;
+        borrow = t < 0;
+        diff[i] = (uint32_t)(t + (borrow << 32));
+    }
+    trimLimbs(diff);
+    return diff;
+}
+
+// acc += x * 2^(32*offset); acc must be large enough to hold the result.
+void addLimbsAt(Limbs &acc, const Limbs &x, size_t offset)
+{
+    uint64_t carry = 0;
+    size_t i = 0;
+    for (; i < x.size(); i++)
+    {
+        carry += (uint64_t)acc[offset + i] + x[i];
+        acc[offset + i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    for (; carry && offset + i < acc.size(); i++)
+    {
+        carry += acc[offset + i];
+        acc[offset + i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+}
+
+// out[0 .. na+nb) = a * b; out must be zeroed.
+void mulLimbsSchoolbook(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *out)
+{
+    for (size_t i = 0; i < na; i++)
+    {
+        uint64_t carry = 0;
+        uint64_t ai = a[i];
+        for (size_t j = 0; j < nb; j++)
+        {
+            carry += ai * b[j] + out[i + j];
+            out[i + j] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        out[i + nb] = (uint32_t)carry;
+    }
+}
+
+/*
+Karatsuba multiplication of two n-limb numbers, returning 2n limbs:
+  a*b = z2*B^2 + ((a0+a1)(b0+b1) - z0 - z2)*B + z0
+so three half-size products replace four.
+*/
+Limbs mulLimbsKaratsuba(const uint32_t *a, const uint32_t *b, size_t n)
+{
+    Limbs product(2 * n, 0);
+    if (n < KARATSUBA_THRESHOLD)
+    {
+        mulLimbsSchoolbook(a, n, b, n, product.data());
+        return product;
+    }
+
+    size_t half = n / 2, high = n - half;
+    Limbs z0 = mulLimbsKaratsuba(a, b, half);
+    Limbs z2 = mulLimbsKaratsuba(a + half, b + half, high);
+
+    Limbs sumA(high + 1, 0), sumB(high + 1, 0);
+    uint64_t carryA = 0, carryB = 0;
+    for (size_t i = 0; i < high; i++)
+    {
+        carryA += (uint64_t)a[half + i] + (i < half ? a[i] : 0);
+        carryB += (uint64_t)b[half + i] + (i < half ? b[i] : 0);
+        sumA[i] = (uint32_t)carryA;
+        sumB[i] = (uint32_t)carryB;
+        carryA >>= 32;
+        carryB >>= 32;
+    }
+    sumA[high] = (uint32_t)carryA;
+    sumB[high] = (uint32_t)carryB;
+
+    Limbs z1 = mulLimbsKaratsuba(sumA.data(), sumB.data(), high + 1);
+    trimLimbs(z0);
+    trimLimbs(z1);
+    trimLimbs(z2);
+    z1 = subLimbs(subLimbs(z1, z0), z2);
+
+    addLimbsAt(product, z0, 0);
+    addLimbsAt(product, z1, half);
+    addLimbsAt(product, z2, 2 * half);
+    return product;
+}
+
+Limbs mulLimbs(const Limbs &a, const Limbs &b)
+{
+    if (a.empty() || b.empty())
+        return Limbs();
+
+    Limbs product;
+    size_t n = max(a.size(), b.size());
+    if (min(a.size(), b.size()) < KARATSUBA_THRESHOLD || min(a.size(), b.size()) * 2 < n)
+    {
+        product.assign(a.size() + b.size(), 0);
+        mulLimbsSchoolbook(a.data(), a.size(), b.data(), b.size(), product.data());
+    }
+    else
+    {
+        Limbs paddedA(a), paddedB(b);
+        paddedA.resize(n, 0);
+        paddedB.resize(n, 0);
+        product = mulLimbsKaratsuba(paddedA.data(), paddedB.data(), n);
+    }
+    trimLimbs(product);
+    return product;
+}
+
+// Divides a in place by a single limb and returns the remainder.
+uint32_t divModLimbsSmall(Limbs &a, uint32_t d)
+{
+    uint64_t rem = 0;
+    for (size_t i = a.size(); i-- > 0;)
+    {
+        uint64_t cur = (rem << 32) | a[i];
+        a[i] = (uint32_t)(cur / d);
+        rem = cur % d;
+    }
+    trimLimbs(a);
+    return (uint32_t)rem;
+}
+
+/*
+Long division of magnitudes: q = a / b, r = a % b (b != 0).
+This is Knuth's Algorithm D (The Art of Computer Programming, Vol. 2, 4.3.1): the divisor is
+normalized so its top bit is set, which keeps every estimated quotient digit at most two
+too large.
+*/
+void divModLimbs(const Limbs &a, const Limbs &b, Limbs &q, Limbs &r)
+{
+    if (compareLimbs(a, b) < 0)
+    {
+        q.clear();
+        r = a;
+        return;
+    }
+    if (b.size() == 1)
+    {
+        q = a;
+        uint32_t rem = divModLimbsSmall(q, b[0]);
+        r.clear();
+        if (rem)
+            r.push_back(rem);
+        return;
+    }
+
+    size_t n = b.size(), m = a.size();
+    int shift = __builtin_clz(b.back());
+    Limbs vn(n), un(m + 1);
+    for (size_t i = n - 1; i > 0; i--)
+        vn[i] = (b[i] << shift) | (shift ? (uint32_t)((uint64_t)b[i - 1] >> (32 - shift)) : 0);
+    vn[0] = b[0] << shift;
+    un[m] = shift ? (uint32_t)((uint64_t)a[m - 1] >> (32 - shift)) : 0;
+    for (size_t i = m - 1; i > 0; i--)
+        un[i] = (a[i] << shift) | (shift ? (uint32_t)((uint64_t)a[i - 1] >> (32 - shift)) : 0);
+    un[0] = a[0] << shift;
+
+    const uint64_t base = 1ULL << 32;
+    q.assign(m - n + 1, 0);
+    for (size_t j = m - n + 1; j-- > 0;)
+    {
+        uint64_t top = ((uint64_t)un[j + n] << 32) | un[j + n - 1];
+        uint64_t qhat = top / vn[n - 1];
+        uint64_t rhat = top % vn[n - 1];
+        while (qhat >= base || qhat * vn[n - 2] > ((rhat << 32) | un[j + n - 2]))
+        {
+            qhat--;
+            rhat += vn[n - 1];
+            if (rhat >= base)
+                break;
+        }
+
+        // Multiply and subtract qhat * vn from the current window of un.
+        int64_t borrow = 0, t;
+        for (size_t i = 0; i < n; i++)
+        {
+            uint64_t p = qhat * vn[i];
+            t = (int64_t)un[i + j] - borrow - (int64_t)(p & 0xFFFFFFFF);
+            un[i + j] = (uint32_t)t;
+            borrow = (int64_t)(p >> 32) - (t >> 32);
+        }
+        t = (int64_t)un[j + n] - borrow;
+        un[j + n] = (uint32_t)t;
+
+        q[j] = (uint32_t)qhat;
+        if (t < 0)
+        {
+            // qhat was one too large: add the divisor back.
+            q[j]--;
+            uint64_t carry = 0;
+            for (size_t i = 0; i < n; i++)
+            {
+                carry += (uint64_t)un[i + j] + vn[i];
+                un[i + j] = (uint32_t)carry;
+                carry >>= 32;
+            }
+            un[j + n] += (uint32_t)carry;
+        }
+    }
+
+    r.assign(n, 0);
+    for (size_t i = 0; i < n; i++)
+        r[i] = (un[i] >> shift) | (shift ? (uint32_t)((uint64_t)un[i + 1] << (32 - shift)) : 0);
+    trimLimbs(q);
+    trimLimbs(r);
+}
+
+// Parses an optionally signed decimal string; returns false on any other character.
+bool parseBigNumber(const string &str, BigNumber &value)
+{
+    size_t i = 0;
+    bool isNegative = false;
+    if (i < str.length() && (str[i] == '-' || str[i] == '+'))
+        isNegative = str[i++] == '-';
+    if (i == str.length())
+        return false;
+
+    value = BigNumber();
+    while (i < str.length())
+    {
+        // Consume up to 9 digits at a time: value = value * 10^k + chunk.
+        uint32_t chunk = 0, scale = 1;
+        for (int d = 0; d < 9 && i < str.length(); d++, i++)
+        {
+            if (str[i] < '0' || str[i] > '9')
+                return false;
+            chunk = chunk * 10 + (str[i] - '0');
+            scale *= 10;
+        }
+        uint64_t carry = chunk;
+        for (size_t k = 0; k < value.limbs.size(); k++)
+        {
+            carry += (uint64_t)value.limbs[k] * scale;
+            value.limbs[k] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        if (carry)
+            value.limbs.push_back((uint32_t)carry);
+    }
+    trimLimbs(value.limbs);
+    value.negative = isNegative && !value.isZero();
+    return true;
+}
+
+string numberToString(bigInt value)
+{
+    return to_string(value);
+}
+
+string numberToString(const BigNumber &value)
+{
+    if (value.isZero())
+        return "0";
+
+    Limbs magnitude = value.limbs;
+    vector<uint32_t> chunks; // base 10^9 digits, least significant first
+    while (!magnitude.empty())
+        chunks.push_back(divModLimbsSmall(magnitude, 1000000000));
+
+    string str = value.negative ? "-" : "";
+    str += to_string(chunks.back());
+    for (size_t i = chunks.size() - 1; i-- > 0;)
+    {
+        string part = to_string(chunks[i]);
+        str += string(9 - part.length(), '0') + part;
+    }
+    return str;
+}
+
+// Returns whether a string accepted by isValidNumber() also fits in bigInt.
+bool fitsInBigInt(const string &str)
+{
+    BigNumber value;
+    return parseBigNumber(str, value) && fitsInBigInt(value);
+}
+
+bool fitsInBigInt(const BigNumber &value)
+{
+    return value >= BigNumber(LLONG_MIN) && value <= BigNumber(LLONG_MAX);
+}
+
+// Converts a BigNumber for which fitsInBigInt() holds.
+bigInt toBigInt(const BigNumber &value)
+{
+    uBigInt magnitude = 0;
+    for (size_t i = value.limbs.size(); i-- > 0;)
+        magnitude = (magnitude << 32) | value.limbs[i];
+    return value.negative ? (bigInt)(0 - magnitude) : (bigInt)magnitude;
+}
+
+// True for 0 <= value < 2^64.
+bool fitsInUBigInt(const BigNumber &value)
+{
+    return !value.negative && value.limbs.size() <= 2;
+}
+
+uBigInt toUBigInt(const BigNumber &value)
+{
+    uBigInt magnitude = 0;
+    for (size_t i = value.limbs.size(); i-- > 0;)
+        magnitude = (magnitude << 32) | value.limbs[i];
+    return magnitude;
+}
+
+BigNumber operator-(const BigNumber &a)
+{
+    BigNumber r = a;
+    r.negative = !a.negative && !a.isZero();
+    return r;
+}
+
+BigNumber operator+(const BigNumber &a, const BigNumber &b)
+{
+    BigNumber r;
+    if (a.negative == b.negative)
+    {
+        r.limbs = addLimbs(a.limbs, b.limbs);
+        r.negative = a.negative;
+    }
+    else if (compareLimbs(a.limbs, b.limbs) >= 0)
+    {
+        r.limbs = subLimbs(a.limbs, b.limbs);
+        r.negative = a.negative;
+    }
+    else
+    {
+        r.limbs = subLimbs(b.limbs, a.limbs);
+        r.negative = b.negative;
+    }
+    if (r.isZero())
+        r.negative = false;
+    return r;
+}
+
+BigNumber operator-(const BigNumber &a, const BigNumber &b)
+{
+    return a + (-b);
+}
+
+BigNumber operator*(const BigNumber &a, const BigNumber &b)
+{
+    BigNumber r;
+    r.limbs = mulLimbs(a.limbs, b.limbs);
+    r.negative = !r.isZero() && a.negative != b.negative;
+    return r;
+}
+
+BigNumber operator/(const BigNumber &a, const BigNumber &b)
+{
+    BigNumber q, r;
+    divModLimbs(a.limbs, b.limbs, q.limbs, r.limbs);
+    q.negative = !q.isZero() && a.negative != b.negative;
+    return q;
+}
+
+// The remainder takes the sign of the dividend, as with '%' on built-in integers.
+BigNumber operator%(const BigNumber &a, const BigNumber &b)
+{
+    BigNumber q, r;
+    divModLimbs(a.limbs, b.limbs, q.limbs, r.limbs);
+    r.negative = !r.isZero() && a.negative;
+    return r;
+}
+
+int compareBigNumbers(const BigNumber &a, const BigNumber &b)
+{
+    if (a.negative != b.negative)
+        return a.negative ? -1 : 1;
+    int c = compareLimbs(a.limbs, b.limbs);
+    return a.negative ? -c : c;
+}
+
+bool operator==(const BigNumber &a, const BigNumber &b) { return compareBigNumbers(a, b) == 0; }
+bool operator!=(const BigNumber &a, const BigNumber &b) { return compareBigNumbers(a, b) != 0; }
+bool operator<(const BigNumber &a, const BigNumber &b) { return compareBigNumbers(a, b) < 0; }
+bool operator>(const BigNumber &a, const BigNumber &b) { return compareBigNumbers(a, b) > 0; }
+bool operator<=(const BigNumber &a, const BigNumber &b) { return compareBigNumbers(a, b) <= 0; }
+bool operator>=(const BigNumber &a, const BigNumber &b) { return compareBigNumbers(a, b) >= 0; }
+
+// Builds the Montgomery constants for an odd modulus m > 1.
+BigMontgomeryContext makeBigMontgomeryContext(const BigNumber &m)
+{
+    BigMontgomeryContext ctx;
+    ctx.m = m.limbs;
+    ctx.n = m.limbs.size();
+
+    uint32_t inv = ctx.m[0]; // Newton's iteration, as in makeMontgomeryContext()
+    for (int i = 0; i < 4; i++)
+        inv *= 2 - ctx.m[0] * inv;
+    ctx.negInv = 0 - inv;
+
+    Limbs power(ctx.n + 1, 0), quotient;
+    power[ctx.n] = 1; // R
+    divModLimbs(power, ctx.m, quotient, ctx.r1);
+    power.assign(2 * ctx.n + 1, 0);
+    power[2 * ctx.n] = 1; // R^2
+    divModLimbs(power, ctx.m, quotient, ctx.r2);
+    ctx.r1.resize(ctx.n, 0);
+    ctx.r2.resize(ctx.n, 0);
+    return ctx;
+}
+
+/*
+out = a*b*R^-1 mod m for n-limb operands (CIOS: the product and the reduction are
+interleaved one limb of b at a time, so the working value never exceeds n+2 limbs).
+out may alias a or b.
+*/
+void bigMontgomeryMultiply(const BigMontgomeryContext &ctx, const uint32_t *a, const uint32_t *b, uint32_t *out)
+{
+    size_t n = ctx.n;
+    const uint32_t *m = ctx.m.data();
+    uint32_t stackBuffer[2 * 130];
+    vector<uint32_t> heapBuffer;
+    uint32_t *t = stackBuffer;
+    if (n + 2 > 2 * 130)
+    {
+        heapBuffer.assign(n + 2, 0);
+        t = heapBuffer.data();
+    }
+    fill(t, t + n + 2, 0);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        uint64_t carry = 0;
+        uint64_t bi = b[i];
+        for (size_t j = 0; j < n; j++)
+        {
+            carry += (uint64_t)a[j] * bi + t[j];
+            t[j] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        carry += t[n];
+        t[n] = (uint32_t)carry;
+        t[n + 1] = (uint32_t)(carry >> 32);
+
+        uint64_t q = (uint32_t)(t[0] * ctx.negInv);
+        carry = (q * m[0] + t[0]) >> 32;
+        for (size_t j = 1; j < n; j++)
+        {
+            carry += q * m[j] + t[j];
+            t[j - 1] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        carry += t[n];
+        t[n - 1] = (uint32_t)carry;
+        t[n] = t[n + 1] + (uint32_t)(carry >> 32);
+    }
+
+    // The result is below 2m; one conditional subtraction brings it below m.
+    bool subtract = t[n] != 0;
+    if (!subtract)
+    {
+        subtract = true;
+        for (size_t i = n; i-- > 0;)
+        {
+            if (t[i] != m[i])
+            {
+                subtract = t[i] > m[i];
+                break;
+            }
+        }
+    }
+    if (subtract)
+    {
+        int64_t borrow = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            int64_t d = (int64_t)t[i] - m[i] - borrow;
+            borrow = d < 0;
+            t[i] = (uint32_t)(d + (borrow << 32));
+        }
+    }
+    copy(t, t + n, out);
+}
+
+// ************ Primality Functions ******************
+
+DivisibilityTest makeDivisibilityTest(uBigInt d)
+{
+    DivisibilityTest test;
+    test.inverse = d; // Newton's iteration, as in makeMontgomeryContext()
+    for (int i = 0; i < 5; i++)
+        test.inverse *= 2 - d * test.inverse;
+    test.limit = ~0ULL / d;
+    return test;
+}
+
+// The odd primes below 2^16, built once; used for trial division and as sieving primes.
+const vector<uint32_t> &smallOddPrimes()
+{
+    static const vector<uint32_t> primes = []() {
+        vector<uint32_t> all = sievePrimes(1 << 16);
+        return vector<uint32_t>(all.begin() + 1, all.end());
+    }();
+    return primes;
+}
+
+// Divisibility tests for the odd primes below 128 (the trial division before Miller-Rabin).
+const vector<DivisibilityTest> &smallPrimeTests()
+{
+    static const vector<DivisibilityTest> tests = []() {
+        vector<DivisibilityTest> result;
+        for (uint32_t p : smallOddPrimes())
+        {
+            if (p >= 128)
+                break;
+            result.push_back(makeDivisibilityTest(p));
+        }
+        return result;
+    }();
+    return tests;
+}
+
+/*
+Strong probable prime test of n = ctx.m (odd, > 2) to one base: with n - 1 = d * 2^s, n passes
+when base^d = 1 or base^(d * 2^r) = -1 (mod n) for some r < s. Every odd prime passes; an odd
+composite passes for at most a quarter of the bases.
+*/
+bool isStrongProbablePrime(const MontgomeryContext &ctx, uBigInt base)
+{
+    uBigInt n = ctx.m;
+    base %= n;
+    if (base == 0)
+        return true;
+
+    uBigInt d = n - 1;
+    int s = countTrailingZeros(d);
+    d >>= s;
+
+    auto multiply = [&](uBigInt x, uBigInt y) {
+        return ctx.isOdd ? montgomeryMultiply(ctx, x, y) : mulMod(x, y, n);
+    };
+    uBigInt one = ctx.isOdd ? ctx.r1 : 1;
+    uBigInt minusOne = n - one;
+    uBigInt power = ctx.isOdd ? toMontgomery(ctx, base) : base;
+    uBigInt x = one;
+    while (d)
+    {
+        if (d & 1)
+            x = multiply(x, power);
+        power = multiply(power, power);
+        d >>= 1;
+    }
+
+    if (x == one || x == minusOne)
+        return true;
+    for (int r = 1; r < s; r++)
+    {
+        x = multiply(x, x);
+        if (x == minusOne)
+            return true;
+        if (x == one)
+            return false; // a square root of 1 other than +-1
+    }
+    return false;
+}
+
+/*
+Deterministic primality test for every n < 2^64.
+Trial division by the primes below 128 rejects most composites with a few multiplications
+each; the rest get Miller-Rabin with a fixed set of bases that no composite below the bound
+passes (Jaeschke's {2, 7, 61} below 4759123141, Sinclair's seven bases up to 2^64).
+*/
+bool isPrime(uBigInt n)
+{
+    if (n < 4)
+        return n >= 2;
+    if (!(n & 1))
+        return false;
+
+    for (const DivisibilityTest &test : smallPrimeTests())
+    {
+        if (n * test.inverse <= test.limit)
+            return n * test.inverse == 1; // n is the prime itself
+    }
+    if (n < 127 * 127)
+        return true;
+
+    static const uBigInt smallBases[] = {2, 7, 61};
+    static const uBigInt bases[] = {2, 325, 9375, 28178, 450775, 9780504, 1795265022};
+    MontgomeryContext ctx = makeMontgomeryContext(n);
+    if (n < 4759123141ULL)
+    {
+        for (uBigInt base : smallBases)
+            if (!isStrongProbablePrime(ctx, base))
+                return false;
+        return true;
+    }
+    for (uBigInt base : bases)
+        if (!isStrongProbablePrime(ctx, base))
+            return false;
+    return true;
+}
+
+/*
+Baillie-PSW test for numbers of any size (those below 2^64 use the exact 64-bit test).
+A strong probable prime test to base 2 followed by a strong Lucas test with Selfridge's
+parameters; no composite is known to pass both.
+*/
+bool isPrime(const BigNumber &n)
+{
+    if (n.negative || n.isZero())
+        return false;
+    if (fitsInUBigInt(n))
+        return isPrime(toUBigInt(n));
+    if (!n.isOdd())
+        return false;
+
+    // Trial division, with as many primes multiplied together as fit in 32 bits per pass.
+    const vector<uint32_t> &primes = smallOddPrimes();
+    for (size_t i = 0; i < primes.size() && primes[i] < 1000;)
+    {
+        size_t first = i;
+        uBigInt product = 1;
+        while (i < primes.size() && primes[i] < 1000 && product * primes[i] <= UINT32_MAX)
+            product *= primes[i++];
+        uint32_t r = remainderLimbs(n.limbs, (uint32_t)product);
+        for (size_t j = first; j < i; j++)
+            if (r % primes[j] == 0)
+                return false;
+    }
+
+    BigNumber one(1), nMinusOne = n - one;
+    size_t s = 0;
+    while (!nMinusOne.testBit(s))
+        s++;
+    BigNumber d = nMinusOne;
+    for (size_t i = 0; i < s; i++)
+        divModLimbsSmall(d.limbs, 2);
+    trimLimbs(d.limbs);
+
+    BigNumber x = modularExponentiation(BigNumber(2), d, n);
+    bool probablePrime = x == one || x == nMinusOne;
+    for (size_t r = 1; r < s && !probablePrime; r++)
+    {
+        x = x * x % n;
+        if (x == one)
+            return false;
+        probablePrime = x == nMinusOne;
+    }
+    if (!probablePrime)
+        return false;
+
+    // Selfridge's method A: the first D in 5, -7, 9, -11, ... with (D/n) = -1. No such D exists
+    // when n is a square, so check for that once the search takes unusually long.
+    bigInt D = 5;
+    for (int tries = 0;; tries++)
+    {
+        int symbol = jacobiSymbol(D, n);
+        if (symbol == -1)
+            break;
+        if (symbol == 0)
+            return false; // |D| < n shares a factor with n
+        if (tries == 8 && isPerfectSquare(n))
+            return false;
+        D = D > 0 ? -(D + 2) : -D + 2;
+    }
+    return isStrongLucasProbablePrime(n, D);
+}
+
+// The smallest prime above n, or 0 when there is none below 2^64.
+uBigInt nextPrime(uBigInt n)
+{
+    if (n < 2)
+        return 2;
+    for (uBigInt candidate = (n + 1) | 1; candidate > n; candidate += 2)
+    {
+        if (isPrime(candidate))
+            return candidate;
+    }
+    return 0;
+}
+
+BigNumber nextPrime(const BigNumber &n)
+{
+    if (n < BigNumber(2))
+        return BigNumber(2);
+    BigNumber two(2), candidate = n + BigNumber(1);
+    if (!candidate.isOdd())
+        candidate = candidate + BigNumber(1);
+    while (!isPrime(candidate))
+        candidate = candidate + two;
+    return candidate;
+}
+
+/*
+Jacobi symbol (a/n) for odd n > 0, by the binary algorithm: factors of two are pulled out of
+'a' with (2/n) = -1 exactly when n = 3, 5 (mod 8), and quadratic reciprocity swaps the
+arguments. Equals the Legendre symbol when n is prime.
+*/
+int jacobiSymbol(uBigInt a, uBigInt n)
+{
+    a %= n;
+    int result = 1;
+    while (a)
+    {
+        int twos = countTrailingZeros(a);
+        a >>= twos;
+        if ((twos & 1) && ((n & 7) == 3 || (n & 7) == 5))
+            result = -result;
+        if ((a & 3) == 3 && (n & 3) == 3)
+            result = -result;
+        swap(a, n);
+        a %= n;
+    }
+    return n == 1 ? result : 0;
+}
+
+// (D/n) for a small odd D and an odd n > |D|: reciprocity turns it into (n mod |D| / |D|).
+int jacobiSymbol(bigInt D, const BigNumber &n)
+{
+    uint32_t k = (uint32_t)(D < 0 ? -D : D);
+    uint32_t nLow = n.limbs[0];
+    int result = jacobiSymbol(remainderLimbs(n.limbs, k), k);
+    if ((k & 3) == 3 && (nLow & 3) == 3)
+        result = -result;
+    if (D < 0 && (nLow & 3) == 3)
+        result = -result; // (-1/n)
+    return result;
+}
+
+bool isPerfectSquare(const BigNumber &n)
+{
+    // Newton's iteration from a power of two above sqrt(n) decreases monotonically to isqrt(n).
+    BigNumber x;
+    size_t bit = (n.bitLength() + 1) / 2;
+    x.limbs.assign(bit / 32 + 1, 0);
+    x.limbs[bit / 32] = 1u << (bit % 32);
+    BigNumber two(2);
+    while (true)
+    {
+        BigNumber y = (x + n / x) / two;
+        if (y >= x)
+            break;
+        x = y;
+    }
+    return x * x == n;
+}
+
+// n mod d for a small d > 0, leaving the limbs untouched.
+uint32_t remainderLimbs(const Limbs &limbs, uint32_t d)
+{
+    uint64_t r = 0;
+    for (size_t i = limbs.size(); i-- > 0;)
+        r = ((r << 32) | limbs[i]) % d;
+    return (uint32_t)r;
+}
+
+// out = a - b mod m for n-limb residues in [0, m).
+void bigModSub(const BigMontgomeryContext &ctx, const uint32_t *a, const uint32_t *b, uint32_t *out)
+{
+    int64_t borrow = 0;
+    for (size_t i = 0; i < ctx.n; i++)
+    {
+        int64_t d = (int64_t)a[i] - b[i] - borrow;
+        borrow = d < 0;
+        out[i] = (uint32_t)(d + (borrow << 32));
+    }
+    if (borrow)
+    {
+        uint64_t carry = 0;
+        for (size_t i = 0; i < ctx.n; i++)
+        {
+            carry += (uint64_t)out[i] + ctx.m[i];
+            out[i] = (uint32_t)carry;
+            carry >>= 32;
+        }
+    }
+}
+
+/*
+Strong Lucas probable prime test with P = 1, Q = (1 - D) / 4 (Baillie and Wagstaff).
+With n + 1 = d * 2^s, n passes when U_d = 0 or V_(d * 2^r) = 0 (mod n) for some r < s.
+Only the V sequence is walked, as the ladder V_2k = V_k^2 - 2Q^k, V_2k+1 = V_k V_k+1 - Q^k
+in Montgomery form; U_d = 0 is then checked through D U_d = 2 V_d+1 - V_d, since D is
+invertible mod n.
+*/
+bool isStrongLucasProbablePrime(const BigNumber &n, bigInt D)
+{
+    BigMontgomeryContext ctx = makeBigMontgomeryContext(n);
+    size_t len = ctx.n;
+    auto multiply = [&](const Limbs &a, const Limbs &b, Limbs &out) {
+        bigMontgomeryMultiply(ctx, a.data(), b.data(), out.data());
+    };
+    auto subtract = [&](const Limbs &a, const Limbs &b, Limbs &out) {
+        bigModSub(ctx, a.data(), b.data(), out.data());
+    };
+
+    Limbs zero(len, 0), minusOne(len), q(len, 0);
+    subtract(zero, ctx.r1, minusOne);
+    bigInt Q = (1 - D) / 4;
+    q[0] = (uint32_t)(Q < 0 ? -Q : Q);
+    multiply(q, ctx.r2, q);
+    if (Q < 0)
+        subtract(zero, q, q);
+
+    // (V_k, V_k+1, Q^k) starting from k = 0, one bit of d at a time.
+    Limbs v(len), vNext = ctx.r1, qPower = ctx.r1, qNext(len), product(len);
+    subtract(ctx.r1, minusOne, v); // V_0 = 2
+    BigNumber nPlusOne = n + BigNumber(1);
+    size_t s = 0;
+    while (!nPlusOne.testBit(s))
+        s++;
+    for (size_t bit = nPlusOne.bitLength(); bit-- > s;)
+    {
+        multiply(v, vNext, product);
+        subtract(product, qPower, product); // V_2k+1
+        if (nPlusOne.testBit(bit))
+        {
+            multiply(qPower, q, qNext); // Q^(k+1)
+            multiply(vNext, vNext, vNext);
+            subtract(vNext, qNext, vNext);
+            subtract(vNext, qNext, vNext); // V_2k+2
+            v.swap(product);
+            multiply(qPower, qNext, qPower);
+        }
+        else
+        {
+            multiply(v, v, v);
+            subtract(v, qPower, v);
+            subtract(v, qPower, v); // V_2k
+            vNext.swap(product);
+            multiply(qPower, qPower, qPower);
+        }
+    }
+
+    Limbs difference(len), negated(len);
+    subtract(vNext, v, difference);
+    subtract(zero, vNext, negated);
+    if (difference == negated || v == zero) // U_d = 0 or V_d = 0
+        return true;
+    for (size_t r = 1; r < s; r++)
+    {
+        multiply(v, v, v);
+        subtract(v, qPower, v);
+        subtract(v, qPower, v);
+        if (v == zero)
+            return true;
+        multiply(qPower, qPower, qPower);
+    }
+    return false;
+}
+
+// floor(sqrt(n)) from the floating-point estimate, corrected to the exact value.
+uBigInt integerSqrt(uBigInt n)
+{
+    uBigInt r = min<uBigInt>((uBigInt)sqrt((double)n), UINT32_MAX);
+    while (r * r > n)
+        r--;
+    while (r < UINT32_MAX && (r + 1) * (r + 1) <= n)
+        r++;
+    return r;
+}
+
+// The primes below 'limit' by the sieve of Eratosthenes over odd numbers.
+vector<uint32_t> sievePrimes(uint32_t limit)
+{
+    vector<uint32_t> primes;
+    if (limit > 2)
+        primes.push_back(2);
+    vector<bool> composite(limit / 2 + 1, false); // index i stands for 2i + 1
+    for (uint32_t i = 1; 2 * i + 1 < limit; i++)
+    {
+        if (composite[i])
+            continue;
+        uint32_t p = 2 * i + 1;
+        primes.push_back(p);
+        for (uBigInt j = (uBigInt)p * p / 2; 2 * j + 1 < limit; j += p)
+            composite[j] = true;
+    }
+    return primes;
+}
+
+/*
+Marks the odd composites of [first, first + 2 * count) that have a factor among 'primes',
+where 'first' is odd and composite[i] stands for first + 2i. Each prime starts at the first odd
+multiple in the segment that is at least its square, so the primes themselves stay unmarked.
+*/
+void sieveSegment(uBigInt first, size_t count, const vector<uint32_t> &primes, vector<uint8_t> &composite)
+{
+    composite.assign(count, 0);
+    uBigInt last = first + 2 * (count - 1);
+    for (uint32_t p : primes)
+    {
+        uBigInt square = (uBigInt)p * p;
+        if (square > last)
+            break;
+        uBigInt start = square;
+        if (start < first)
+        {
+            uBigInt offset = (p - first % p) % p;
+            start = first + offset;
+            if (!(start & 1))
+                start += p; // the next multiple is odd
+            if (start < first || start > last)
+                continue; // past the end, or wrapped around 2^64
+        }
+        for (uBigInt i = (start - first) / 2; i < count; i += p)
+            composite[i] = 1;
+    }
+}
+
+/*
+Writes the primes in [lo, hi] to 'out', one per line, a segment of 2^18 odd numbers at a time.
+The segments are sieved with the odd primes up to min(sqrt(hi), 2^22); when that covers sqrt(hi)
+the survivors are prime, otherwise the sieve is only a pre-filter for small factors and the
+survivors still go through isPrime().
+*/
+int runPrimeSieve(uBigInt lo, uBigInt hi, FILE *out)
+{
+    uBigInt root = integerSqrt(hi);
+    vector<uint32_t> primes = sievePrimes((uint32_t)min<uBigInt>(root + 1, 1 << 22));
+    if (!primes.empty())
+        primes.erase(primes.begin()); // the segments hold odd numbers only
+    bool complete = root < (1 << 22);
+
+    string output;
+    if (lo <= 2 && hi >= 2)
+        output += "2\n";
+    uBigInt first = max<uBigInt>(lo, 3) | 1;
+    const size_t segment = 1 << 18;
+    vector<uint8_t> composite;
+    while (first <= hi && first >= 3)
+    {
+        size_t count = (size_t)min<uBigInt>(segment, (hi - first) / 2 + 1);
+        sieveSegment(first, count, primes, composite);
+        for (size_t i = 0; i < count; i++)
+        {
+            uBigInt value = first + 2 * i;
+            if (!composite[i] && (complete || isPrime(value)))
+            {
+                appendNumber(output, value);
+                output += '\n';
+            }
+        }
+        fwrite(output.data(), 1, output.size(), out);
+        output.clear();
+        first += 2 * count; // wraps to below 3 after the last odd number
+    }
+    fwrite(output.data(), 1, output.size(), out);
+    fflush(out);
+    return 0;
+}
+
+// ************ Factorization Functions ******************
+
+/*
+Pollard's rho with Brent's cycle detection for an odd composite n that is not a prime power
+of a tiny prime: iterates x -> x^2 + c in Montgomery form and, instead of one gcd per step,
+multiplies 128 differences |x - y| together and takes a single gcd of the product. If a batch
+overshoots (the gcd is n), it is replayed one step at a time. Returns a factor of n, or n
+itself when this c fails and another one has to be tried.
+*/
+uBigInt pollardBrent(uBigInt n, uBigInt c)
+{
+    const uBigInt batch = 128;
+    MontgomeryContext ctx = makeMontgomeryContext(n);
+    uBigInt increment = toMontgomery(ctx, c);
+    auto step = [&](uBigInt x) { return addMod(montgomeryMultiply(ctx, x, x), increment, n); };
+    auto distance = [](uBigInt x, uBigInt y) { return x > y ? x - y : y - x; };
+
+    uBigInt x = 0, y = toMontgomery(ctx, 2), saved = y, product = ctx.r1, g = 1;
+    for (uBigInt r = 1; g == 1; r <<= 1)
+    {
+        x = y;
+        for (uBigInt i = 0; i < r; i++)
+            y = step(y);
+        for (uBigInt k = 0; k < r && g == 1; k += batch)
+        {
+            saved = y;
+            for (uBigInt i = 0; i < batch && i < r - k; i++)
+            {
+                y = step(y);
+                product = montgomeryMultiply(ctx, product, distance(x, y));
+            }
+            // product is in Montgomery form; R is a power of two and n is odd, so the gcd is the same.
+            g = binaryGcd(product, n);
+        }
+    }
+
+    if (g == n)
+    {
+        do
+        {
+            saved = step(saved);
+            g = binaryGcd(distance(x, saved), n);
+        } while (g == 1);
+    }
+    return g;
+}
+
+/*
+Prime factorization of n, smallest prime first (empty for n < 2).
+Factors of two are shifted out, the odd primes below 128 are divided out with the multiply-only
+divisibility tests (the multiplication by the inverse is also the exact quotient), and what is
+left is split with pollardBrent() until isPrime() certifies every part.
+*/
+vector<PrimeFactor> factorize(uBigInt n)
+{
+    vector<PrimeFactor> factors;
+    if (n < 2)
+        return factors;
+
+    int twos = countTrailingZeros(n);
+    if (twos)
+    {
+        factors.push_back({2, twos});
+        n >>= twos;
+    }
+    const vector<uint32_t> &primes = smallOddPrimes();
+    const vector<DivisibilityTest> &tests = smallPrimeTests();
+    for (size_t i = 0; i < tests.size() && n > 1; i++)
+    {
+        if (n * tests[i].inverse > tests[i].limit)
+            continue;
+        PrimeFactor factor = {primes[i], 0};
+        while (n * tests[i].inverse <= tests[i].limit)
+        {
+            n *= tests[i].inverse;
+            factor.exponent++;
+        }
+        factors.push_back(factor);
+    }
+
+    vector<uBigInt> pending;
+    if (n > 1)
+        pending.push_back(n);
+    size_t firstLarge = factors.size();
+    while (!pending.empty())
+    {
+        uBigInt part = pending.back();
+        pending.pop_back();
+        if (isPrime(part))
+        {
+            factors.push_back({part, 1});
+            continue;
+        }
+        uBigInt root = integerSqrt(part);
+        uBigInt divisor = root * root == part ? root : part;
+        for (uBigInt c = 1; divisor == part; c++)
+            divisor = pollardBrent(part, c);
+        pending.push_back(divisor);
+        pending.push_back(part / divisor);
+    }
+
+    // The rho splits come out in no particular order and may repeat a prime.
+    sort(factors.begin() + firstLarge, factors.end(),
+         [](const PrimeFactor &a, const PrimeFactor &b) { return a.prime < b.prime; });
+    size_t kept = firstLarge;
+    for (size_t i = firstLarge; i < factors.size(); i++)
+    {
+        if (kept > firstLarge && factors[kept - 1].prime == factors[i].prime)
+            factors[kept - 1].exponent += factors[i].exponent;
+        else
+            factors[kept++] = factors[i];
+    }
+    factors.resize(kept);
+    return factors;
+}
+
+// phi(n) = product of p^(e-1) * (p - 1): how many of 1..n are coprime to n.
+uBigInt eulerTotient(uBigInt n)
+{
+    if (n == 0)
+        return 0;
+    uBigInt phi = n;
+    for (const PrimeFactor &factor : factorize(n))
+        phi = phi / factor.prime * (factor.prime - 1);
+    return phi;
+}
+
+/*
+lambda(n), the exponent of the unit group mod n: the smallest t with a^t = 1 (mod n) for every
+a coprime to n. It is the lcm of lambda(p^e) = p^(e-1) * (p - 1), except that the powers of two
+from 8 on only reach 2^(e-2).
+*/
+uBigInt carmichaelLambda(uBigInt n)
+{
+    if (n == 0)
+        return 0;
+    uBigInt lambda = 1;
+    for (const PrimeFactor &factor : factorize(n))
+    {
+        uBigInt part = factor.prime - 1;
+        for (int i = 1; i < factor.exponent; i++)
+            part *= factor.prime;
+        if (factor.prime == 2 && factor.exponent >= 3)
+            part /= 2;
+        lambda = lambda / binaryGcd(lambda, part) * part;
+    }
+    return lambda;
+}
+
+/*
+The multiplicative order of a mod n: the smallest t > 0 with a^t = 1 (mod n), or 0 when a is
+not coprime to n. The order divides lambda(n), so starting from lambda(n) every prime factor q
+is divided out for as long as a^(t/q) stays 1.
+*/
+uBigInt multiplicativeOrder(uBigInt a, uBigInt n)
+{
+    if (n == 1)
+        return 1;
+    a %= n;
+    if (binaryGcd(a, n) != 1)
+        return 0;
+
+    MontgomeryContext ctx = makeMontgomeryContext(n);
+    uBigInt order = carmichaelLambda(n);
+    for (const PrimeFactor &factor : factorize(order))
+    {
+        for (int i = 0; i < factor.exponent && modPow64(ctx, a, order / factor.prime) == 1; i++)
+            order /= factor.prime;
+    }
+    return order;
+}
+
+// Writes a factorization as "2^3 3 5^2".
+void appendFactorization(string &output, const vector<PrimeFactor> &factors)
+{
+    for (size_t i = 0; i < factors.size(); i++)
+    {
+        if (i)
+            output += ' ';
+        appendNumber(output, factors[i].prime);
+        if (factors[i].exponent > 1)
+        {
+            output += '^';
+            appendNumber(output, (bigInt)factors[i].exponent);
+        }
+    }
+}
+
+// ************ Discrete Logarithm Functions ******************
+
+/*
+Solves g^x = h (mod ctx.m) for 0 <= x < order, where 'order' is the order of g: returns the
+smallest such x, or LLONG_MIN if h is not a power of g.
+The baby steps g^j (j < s) go into an open-addressing table of at most memoryBytes, and the
+giant steps h * g^(-s*i) are looked up in it; s is sqrt(order) when the memory allows, smaller
+otherwise (more giant steps instead). The table is kept in 'table' and reused when the next
+call has the same g, modulus and s, which saves the baby steps for repeated bases.
+*/
+bigInt babyStepGiantStep(BabyStepTable &table, const MontgomeryContext &ctx, uBigInt g, uBigInt h,
+                         uBigInt order, size_t memoryBytes)
+{
+    // Keys are handled 16 at a time: the multiplications form a dependent chain anyway, and
+    // prefetching the 16 slots first overlaps their cache misses instead of paying them in turn.
+    const int lookahead = 16;
+    uBigInt m = ctx.m;
+    auto multiply = [&](uBigInt x, uBigInt y) {
+        return ctx.isOdd ? montgomeryMultiply(ctx, x, y) : mulMod(x, y, m);
+    };
+    auto toForm = [&](uBigInt x) { return ctx.isOdd ? toMontgomery(ctx, x) : x % m; };
+    auto tagOf = [](uBigInt hash) { return (uint32_t)(hash >> 8) | 1; };
+
+    size_t capacity = 2;
+    while (capacity * 2 * sizeof(BabyStepEntry) <= memoryBytes && capacity < ((size_t)1 << 32))
+        capacity *= 2;
+    uBigInt root = integerSqrt(order);
+    uBigInt steps = min<uBigInt>(root * root < order ? root + 1 : root, capacity / 2);
+    steps = max<uBigInt>(steps, 1);
+    while (capacity / 4 >= steps && capacity > 2)
+        capacity /= 2; // no bigger than a load of 1/2 needs
+    size_t mask = capacity - 1;
+
+    uBigInt hashes[lookahead];
+    if (table.base != g || table.m != m || table.steps != steps)
+    {
+        table.base = g;
+        table.m = m;
+        table.steps = steps;
+        table.shift = 64;
+        for (size_t c = capacity; c > 1; c /= 2)
+            table.shift--;
+        table.slots.assign(capacity, {0, 0});
+
+        uBigInt power = toForm(1), step = toForm(g);
+        for (uBigInt first = 0; first < steps; first += lookahead)
+        {
+            int count = (int)min<uBigInt>(lookahead, steps - first);
+            for (int k = 0; k < count; k++)
+            {
+                hashes[k] = power * 0x9E3779B97F4A7C15ULL;
+                __builtin_prefetch(&table.slots[hashes[k] >> table.shift], 1);
+                power = multiply(power, step);
+            }
+            for (int k = 0; k < count; k++)
+            {
+                size_t slot = hashes[k] >> table.shift;
+                while (table.slots[slot].tag)
+                    slot = (slot + 1) & mask;
+                table.slots[slot] = {tagOf(hashes[k]), (uint32_t)(first + k)};
+            }
+        }
+    }
+
+    uBigInt giant = toForm(modPow64(ctx, g, (order - steps % order) % order)); // g^-s
+    uBigInt current = toForm(h);
+    uBigInt values[lookahead];
+    for (uBigInt i = 0; i * steps < order; i += lookahead)
+    {
+        int count = (int)min<uBigInt>(lookahead, (order - i * steps + steps - 1) / steps);
+        for (int k = 0; k < count; k++)
+        {
+            values[k] = current;
+            hashes[k] = current * 0x9E3779B97F4A7C15ULL;
+            __builtin_prefetch(&table.slots[hashes[k] >> table.shift]);
+            current = multiply(current, giant);
+        }
+        for (int k = 0; k < count; k++)
+        {
+            uint32_t tag = tagOf(hashes[k]);
+            for (size_t slot = hashes[k] >> table.shift; table.slots[slot].tag; slot = (slot + 1) & mask)
+            {
+                if (table.slots[slot].tag != tag)
+                    continue;
+                uBigInt j = table.slots[slot].exponent;
+                if (toForm(modPow64(ctx, g, j)) != values[k])
+                    continue; // a different key with the same tag
+                uBigInt x = (i + k) * steps + j;
+                return x < order ? (bigInt)x : LLONG_MIN;
+            }
+        }
+    }
+    return LLONG_MIN;
+}
+
+/*
+Pohlig-Hellman: solves b^x = y (mod m) for b coprime to m, by splitting the order of b into
+prime powers q^e. Each x mod q^e is found one base-q digit at a time with a baby-step
+giant-step search in the subgroup of order q, and the digits are joined with the Chinese
+Remainder Theorem. The cost is driven by the largest q only, so smooth orders are fast.
+*/
+bigInt pohligHellman(BabyStepTable &table, uBigInt b, uBigInt y, uBigInt m, size_t memoryBytes)
+{
+    MontgomeryContext ctx = makeMontgomeryContext(m);
+    uBigInt order = multiplicativeOrder(b, m);
+    vector<PrimeFactor> factors = factorize(order);
+
+    vector<bigInt> rows(2 * factors.size());
+    vector<bigInt *> equations(factors.size());
+    for (size_t i = 0; i < factors.size(); i++)
+    {
+        uBigInt q = factors[i].prime, qPower = 1;
+        for (int k = 0; k < factors[i].exponent; k++)
+            qPower *= q;
+
+        uBigInt generator = modPow64(ctx, b, order / q); // order q
+        uBigInt digitPower = 1, residue = 0;
+        for (int k = 0; k < factors[i].exponent; k++)
+        {
+            // (y * b^-residue)^(order / q^(k+1)) = generator^digit
+            uBigInt shifted = mulMod(y, modPow64(ctx, b, order - residue), m);
+            uBigInt target = modPow64(ctx, shifted, order / (digitPower * q));
+            bigInt digit = babyStepGiantStep(table, ctx, generator, target, q, memoryBytes);
+            if (digit == LLONG_MIN)
+                return LLONG_MIN; // y is not a power of b
+            residue += (uBigInt)digit * digitPower;
+            digitPower *= q;
+        }
+        rows[2 * i] = (bigInt)residue;
+        rows[2 * i + 1] = (bigInt)qPower;
+        equations[i] = &rows[2 * i];
+    }
+
+    bigInt x = 0, M;
+    if (!factors.empty())
+        x = chineseRemainderTheorem(equations.data(), M, (int)factors.size());
+    return modPow64(ctx, b, (uBigInt)x) == y % m ? x : LLONG_MIN;
+}
+
+/*
+The smallest x >= 0 with b^x = y (mod m), or LLONG_MIN if there is none (0 < m < 2^63).
+While b shares a factor g with m, both sides must be divisible by g: it is divided out of y and
+m and b/g is collected into k, which leaves k * b^x' = y' with b coprime to the new m and
+x = x' + (the number of divisions). Every x smaller than that count is checked on the way.
+*/
+bigInt discreteLog(bigInt b, bigInt y, bigInt m, BabyStepTable &table, size_t memoryBytes)
+{
+    uBigInt modulus = m;
+    uBigInt base = normalizeMod(b, m), target = normalizeMod(y, m);
+    uBigInt k = 1 % modulus;
+    bigInt offset = 0;
+    for (uBigInt g = binaryGcd(base, modulus); g != 1; g = binaryGcd(base, modulus))
+    {
+        if (target == k)
+            return offset;
+        if (target % g)
+            return LLONG_MIN;
+        target /= g;
+        modulus /= g;
+        k = mulMod(k, base / g, modulus);
+        base %= modulus;
+        offset++;
+    }
+    if (modulus == 1)
+        return offset;
+
+    bigInt kInverse = modInverse((bigInt)k, (bigInt)modulus);
+    target = mulMod(target, kInverse, modulus);
+    bigInt x = pohligHellman(table, base, target, modulus, memoryBytes);
+    return x == LLONG_MIN ? LLONG_MIN : x + offset;
+}
+
+// ************ Modular Square Root Functions ******************
+
+/*
+Tonelli-Shanks square root of a non-zero quadratic residue 'a' modulo the odd prime ctx.m.
+With p - 1 = q * 2^s, r = a^((q+1)/2) is a root up to a factor of 2-power order, t = a^q, and
+every round fixes the highest wrong bit of that factor with a power of c = z^q for a
+non-residue z. Takes up to s^2 squarings, so it suits primes where s is small.
+*/
+uBigInt tonelliShanks(const MontgomeryContext &ctx, uBigInt a)
+{
+    uBigInt p = ctx.m, q = p - 1;
+    int s = countTrailingZeros(q);
+    q >>= s;
+    uBigInt z = 2;
+    while (jacobiSymbol(z, p) != -1)
+        z++;
+
+    auto multiply = [&](uBigInt x, uBigInt y) { return montgomeryMultiply(ctx, x, y); };
+    uBigInt one = ctx.r1;
+    uBigInt c = toMontgomery(ctx, modPow64(ctx, z, q));
+    uBigInt t = toMontgomery(ctx, modPow64(ctx, a, q));
+    uBigInt r = toMontgomery(ctx, modPow64(ctx, a, (q + 1) / 2));
+    int order = s;
+    while (t != one)
+    {
+        int i = 0;
+        for (uBigInt square = t; square != one; i++)
+            square = multiply(square, square);
+        uBigInt b = c;
+        for (int k = 0; k < order - i - 1; k++)
+            b = multiply(b, b);
+        order = i;
+        c = multiply(b, b);
+        t = multiply(t, c);
+        r = multiply(r, b);
+    }
+    return fromMontgomery(ctx, r);
+}
+
+/*
+Cipolla's square root of a non-zero quadratic residue 'a' modulo the odd prime ctx.m: for a w
+with w^2 - a a non-residue, (w + sqrt(w^2 - a))^((p+1)/2) computed in F_p[sqrt(w^2 - a)] is a
+root of a. One exponentiation of O(log p) steps whatever p - 1 looks like.
+*/
+uBigInt cipolla(const MontgomeryContext &ctx, uBigInt a)
+{
+    uBigInt p = ctx.m, w = 1;
+    while (jacobiSymbol(subMod(mulMod(w, w, p), a, p), p) != -1)
+        w++;
+
+    auto multiply = [&](uBigInt x, uBigInt y) { return montgomeryMultiply(ctx, x, y); };
+    uBigInt d = toMontgomery(ctx, subMod(mulMod(w, w, p), a, p)); // the square of the new unit
+    uBigInt x = ctx.r1, y = 0;                  // x + y*sqrt(d), starting at 1
+    uBigInt baseX = toMontgomery(ctx, w), baseY = ctx.r1;
+    for (uBigInt n = (p + 1) / 2; n; n >>= 1)
+    {
+        if (n & 1)
+        {
+            uBigInt newX = addMod(multiply(x, baseX), multiply(multiply(y, baseY), d), p);
+            y = addMod(multiply(x, baseY), multiply(y, baseX), p);
+            x = newX;
+        }
+        uBigInt newX = addMod(multiply(baseX, baseX), multiply(multiply(baseY, baseY), d), p);
+        baseY = multiply(addMod(baseX, baseX, p), baseY);
+        baseX = newX;
+    }
+    return fromMontgomery(ctx, x);
+}
+
+/*
+A square root of a modulo the prime ctx.m (a < p); the other one is p - root. Returns false
+when a is a non-residue. p = 3 (mod 4) and p = 5 (mod 8) have closed forms; otherwise
+Tonelli-Shanks is used while its s^2 steps beat Cipolla's fixed cost, Cipolla after that.
+*/
+bool sqrtModPrime(const MontgomeryContext &ctx, uBigInt a, uBigInt &root)
+{
+    uBigInt p = ctx.m;
+    if (a == 0 || p == 2)
+    {
+        root = a;
+        return true;
+    }
+
+    if ((p & 3) == 3)
+    {
+        root = modPow64(ctx, a, (p + 1) / 4);
+        return mulMod(root, root, p) == a; // Euler's criterion comes for free
+    }
+    if (jacobiSymbol(a, p) != 1)
+        return false;
+    if ((p & 7) == 5)
+    {
+        // Atkin: v = (2a)^((p-5)/8), i = 2a*v^2 is a square root of -1, and a*v*(i - 1) works.
+        uBigInt twoA = addMod(a, a, p);
+        uBigInt v = modPow64(ctx, twoA, (p - 5) / 8);
+        uBigInt i = mulMod(twoA, mulMod(v, v, p), p);
+        root = mulMod(mulMod(a, v, p), subMod(i, 1, p), p);
+        return true;
+    }
+
+    int s = countTrailingZeros(p - 1);
+    root = s * (s - 1) <= 12 * (int)numberBitLength((bigInt)(p >> 1)) ? tonelliShanks(ctx, a) : cipolla(ctx, a);
+    return true;
+}
+
+/*
+The square roots of a unit u modulo p^k, all of them, sorted. For odd p the root modulo p is
+lifted with Newton's step r -> r - (r^2 - u) / (2r), which doubles the known digits each time;
+units modulo 2^k (k >= 3) are squares when u = 1 (mod 8) and have four roots, +-r and
++-r + 2^(k-1), where r is lifted one bit at a time.
+*/
+bool unitSqrtModPrimePower(uBigInt u, uBigInt p, int k, vector<uBigInt> &roots)
+{
+    uBigInt pk = 1;
+    for (int i = 0; i < k; i++)
+        pk *= p;
+    roots.clear();
+
+    if (p == 2)
+    {
+        if (k == 1)
+            roots = {1};
+        else if (k == 2)
+        {
+            if ((u & 3) != 1)
+                return false;
+            roots = {1, 3};
+        }
+        else
+        {
+            if ((u & 7) != 1)
+                return false;
+            uBigInt r = 1;
+            for (int j = 3; j < k; j++)
+            {
+                if (((r * r - u) >> j) & 1) // r^2 = u (mod 2^j) but not mod 2^(j+1)
+                    r += (uBigInt)1 << (j - 1);
+            }
+            uBigInt half = pk >> 1;
+            roots = {r, pk - r, (r + half) & (pk - 1), (pk - r + half) & (pk - 1)};
+        }
+    }
+    else
+    {
+        uBigInt r;
+        if (!sqrtModPrime(makeMontgomeryContext(p), u % p, r))
+            return false;
+        for (uBigInt known = p; known < pk;)
+        {
+            known = known > pk / known ? pk : known * known;
+            uBigInt error = subMod(mulMod(r, r, known), u % known, known);
+            bigInt inverse = modInverse((bigInt)(2 * r % known), (bigInt)known);
+            r = subMod(r, mulMod(error, inverse, known), known);
+        }
+        roots = {r, r ? pk - r : 0};
+    }
+    sort(roots.begin(), roots.end());
+    roots.erase(unique(roots.begin(), roots.end()), roots.end());
+    return true;
+}
+
+/*
+The square roots of a modulo p^e, as residues modulo p^d (d <= e) whose every lift to p^e is a
+root. Writing a = p^v * u with u a unit, a root must be p^(v/2) times a root of u modulo
+p^(e-v), so v has to be even and the roots are fixed only modulo p^(e - v/2); a = 0 leaves
+every multiple of p^ceil(e/2).
+*/
+bool sqrtModPrimePower(uBigInt a, uBigInt p, int e, uBigInt &classModulus, vector<uBigInt> &roots)
+{
+    if (a == 0)
+    {
+        classModulus = 1;
+        for (int i = 0; i < (e + 1) / 2; i++)
+            classModulus *= p;
+        roots = {0};
+        return true;
+    }
+
+    int v = 0;
+    while (a % p == 0)
+    {
+        a /= p;
+        v++;
+    }
+    if (v & 1)
+        return false;
+
+    vector<uBigInt> unitRoots;
+    if (!unitSqrtModPrimePower(a, p, e - v, unitRoots))
+        return false;
+    uBigInt scale = 1, unitModulus = 1;
+    for (int i = 0; i < v / 2; i++)
+        scale *= p;
+    for (int i = 0; i < e - v; i++)
+        unitModulus *= p;
+    classModulus = scale * unitModulus;
+    roots.clear();
+    for (uBigInt y : unitRoots)
+        roots.push_back(scale * y);
+    return true;
+}
+
+/*
+All x in [0, m) with x^2 = a (mod m), for 0 < m < 2^63. m is factored, the roots modulo each
+prime power come from sqrtModPrimePower(), and the combinations are joined with the
+Chinese Remainder Theorem one prime at a time (x = X + M * ((r - X) * M^-1 mod d)). The result
+describes the roots as roots.residues + j * roots.modulus, so moduli like 2^62 with a = 0
+(2^31 roots) never get listed in full. 'factors' may be passed in when m is already factored.
+*/
+bool sqrtMod(bigInt a, bigInt m, SquareRootSet &roots, const vector<PrimeFactor> *factors)
+{
+    vector<PrimeFactor> ownFactors;
+    if (!factors)
+    {
+        ownFactors = factorize(m);
+        factors = &ownFactors;
+    }
+
+    uBigInt value = normalizeMod(a, m);
+    roots.m = m;
+    roots.modulus = 1;
+    roots.residues.assign(1, 0);
+    vector<uBigInt> primeRoots, combined;
+    for (const PrimeFactor &factor : *factors)
+    {
+        uBigInt pe = 1;
+        for (int i = 0; i < factor.exponent; i++)
+            pe *= factor.prime;
+        uBigInt d;
+        if (!sqrtModPrimePower(value % pe, factor.prime, factor.exponent, d, primeRoots))
+            return false;
+
+        uBigInt inverse = (uBigInt)modInverse((bigInt)(roots.modulus % d), (bigInt)d);
+        combined.clear();
+        for (uBigInt x : roots.residues)
+        {
+            for (uBigInt r : primeRoots)
+            {
+                uBigInt t = mulMod(subMod(r, x % d, d), inverse, d);
+                combined.push_back(x + roots.modulus * t);
+            }
+        }
+        roots.residues.swap(combined);
+        roots.modulus *= d;
+    }
+    sort(roots.residues.begin(), roots.residues.end());
+    roots.count = roots.residues.size() * (m / roots.modulus);
+    return true;
+}
+
+// The i-th smallest root of a SquareRootSet (i < roots.count).
+uBigInt squareRootAt(const SquareRootSet &roots, uBigInt i)
+{
+    uBigInt perBlock = roots.residues.size();
+    return roots.residues[i % perBlock] + (i / perBlock) * roots.modulus;
+}
+
+// ************ Polynomial Functions ******************
+
+/*
+floor(w * 2^32 / p) for Shoup's multiplication: with it, x*w mod p for any 32-bit x costs two
+multiplications and no division, because q = (x * wShoup) >> 32 is at most one below x*w/p.
+*/
+uint32_t shoupPrecompute(uint32_t w, uint32_t p)
+{
+    return (uint32_t)(((uint64_t)w << 32) / p);
+}
+
+// x*w mod p, left in [0, 2p) (p < 2^31).
+uint32_t shoupMultiply(uint32_t x, uint32_t w, uint32_t wShoup, uint32_t p)
+{
+    uint32_t q = (uint32_t)(((uint64_t)x * wShoup) >> 32);
+    return x * w - q * p;
+}
+
+/*
+Prepares an NTT prime p < 2^30: finds a generator g of (Z/pZ)* (g^((p-1)/q) != 1 for every
+prime q dividing p - 1) and takes root = g^((p-1)/2^maxLog), a primitive 2^maxLog-th root of unity.
+*/
+NttPrime makeNttPrime(uint32_t p)
+{
+    NttPrime prime;
+    prime.p = p;
+    prime.maxLog = countTrailingZeros(p - 1);
+    vector<PrimeFactor> factors = factorize(p - 1);
+    bigInt g = 2;
+    for (;; g++)
+    {
+        bool generator = true;
+        for (const PrimeFactor &factor : factors)
+            generator = generator && modularExponentiation<bigInt>(g, (p - 1) / factor.prime, p) != 1;
+        if (generator)
+            break;
+    }
+    prime.root = modularExponentiation<bigInt>(g, (p - 1) >> prime.maxLog, p);
+    prime.minusOne = p - 1;
+    prime.minusOneShoup = shoupPrecompute(p - 1, p);
+    prime.roots = {1};
+    prime.rootsShoup = {shoupPrecompute(1, p)};
+    return prime;
+}
+
+/*
+Grows the twiddle table to the 2^(log-1) entries a transform of size 2^log reads. Entry s is
+w^bitrev(s) for w a primitive 2^maxLog-th root of unity (bits reversed over maxLog - 1 bits),
+and the same table serves every level of every smaller transform, as level B (B blocks) needs
+w_2B^bitrev(s) = entry s for s < B. Doubling the table multiplies the old half by w_4B.
+*/
+void prepareNttPrime(NttPrime &prime, int log)
+{
+    size_t need = log ? (size_t)1 << (log - 1) : 1;
+    while (prime.roots.size() < need)
+    {
+        size_t half = prime.roots.size();
+        uint32_t step = modularExponentiation<bigInt>(prime.root, ((bigInt)1 << prime.maxLog) / (4 * half), prime.p);
+        for (size_t s = 0; s < half; s++)
+        {
+            uint32_t w = (uint64_t)prime.roots[s] * step % prime.p;
+            prime.roots.push_back(w);
+            prime.rootsShoup.push_back(shoupPrecompute(w, prime.p));
+        }
+    }
+}
+
+/*
+Butterflies of the forward level with blocks of 2*len values, for blocks [first, last): lo[j], hi[j]
+-> lo[j] + w*hi[j], lo[j] - w*hi[j] (Cooley-Tukey) with w the block's twiddle. Harvey's lazy
+reduction: inputs and outputs stay below 4p and are never fully reduced.
+*/
+void forwardLevel(uint32_t *a, size_t len, size_t first, size_t last, const NttPrime &prime)
+{
+    uint32_t p = prime.p, twoP = 2 * p;
+    for (size_t s = first; s < last; s++)
+    {
+        uint32_t w = prime.roots[s], wShoup = prime.rootsShoup[s];
+        uint32_t *lo = a + 2 * s * len, *hi = lo + len;
+        for (size_t j = 0; j < len; j++)
+        {
+            uint32_t u = lo[j] >= twoP ? lo[j] - twoP : lo[j];
+            uint32_t t = shoupMultiply(hi[j], w, wShoup, p);
+            lo[j] = u + t;
+            hi[j] = u + twoP - t;
+        }
+    }
+}
+
+/*
+The twiddle of block s in the inverse transform is w_2B^-bitrev(s) = -(entry s') with s' equal
+to s with the bits below its top bit flipped, so the forward table serves both directions;
+the sign is absorbed by the butterfly, which computes (v - u) * entry instead of (u - v) / w.
+Block 0 (twiddle 1) uses -1.
+*/
+void inverseTwiddle(const NttPrime &prime, size_t s, uint32_t &w, uint32_t &wShoup)
+{
+    if (s == 0)
+    {
+        w = prime.minusOne;
+        wShoup = prime.minusOneShoup;
+        return;
+    }
+    size_t t = s ^ (((size_t)1 << (63 - __builtin_clzll(s))) - 1);
+    w = prime.roots[t];
+    wShoup = prime.rootsShoup[t];
+}
+
+// Butterflies of one inverse level, lo[j], hi[j] -> lo[j] + hi[j], (hi[j] - lo[j]) * w
+// (Gentleman-Sande); inputs and outputs below 2p.
+void inverseLevel(uint32_t *a, size_t len, size_t first, size_t last, const NttPrime &prime)
+{
+    uint32_t p = prime.p, twoP = 2 * p;
+    for (size_t s = first; s < last; s++)
+    {
+        uint32_t w, wShoup;
+        inverseTwiddle(prime, s, w, wShoup);
+        uint32_t *lo = a + 2 * s * len, *hi = lo + len;
+        for (size_t j = 0; j < len; j++)
+        {
+            uint32_t u = lo[j], v = hi[j];
+            uint32_t sum = u + v;
+            lo[j] = sum >= twoP ? sum - twoP : sum;
+            hi[j] = shoupMultiply(v + twoP - u, w, wShoup, p);
+        }
+    }
+}
+
+/*
+In-place transform of size 2^log modulo prime.p, iterative with no bit-reversal pass: the forward
+direction takes coefficients in natural order and leaves the values in bit-reversed order,
+the inverse direction takes them back (without the 1/n factor). Each block of a level has a
+single twiddle, so the inner loop is a contiguous sweep. Levels whose blocks are longer than
+NTT_CHUNK values sweep the whole array one level at a time; below that, every chunk of
+NTT_CHUNK values runs through all its remaining levels while it sits in L1. The kernels are
+never called for blocks shorter than 2*Fused: their call for len = Fused runs all the levels
+from there down (n >= 2*Fused).
+*/
+template <LevelKernel Forward, LevelKernel Inverse, size_t Fused>
+void runNtt(uint32_t *a, int log, const NttPrime &prime, bool inverse)
+{
+    size_t n = (size_t)1 << log, chunk = min(n, NTT_CHUNK);
+    if (!inverse)
+    {
+        for (size_t len = n >> 1; 2 * len > chunk; len >>= 1)
+            Forward(a, len, 0, n / (2 * len), prime);
+        for (size_t start = 0; start < n; start += chunk)
+            for (size_t len = chunk >> 1; len >= Fused; len >>= 1)
+                Forward(a, len, start / (2 * len), (start + chunk) / (2 * len), prime);
+    }
+    else
+    {
+        for (size_t start = 0; start < n; start += chunk)
+            for (size_t len = Fused; 2 * len <= chunk; len <<= 1)
+                Inverse(a, len, start / (2 * len), (start + chunk) / (2 * len), prime);
+        for (size_t len = chunk; len < n; len <<= 1)
+            Inverse(a, len, 0, n / (2 * len), prime);
+    }
+}
+
+void nttScalar(uint32_t *a, int log, const NttPrime &prime, bool inverse)
+{
+    runNtt<forwardLevel, inverseLevel, 1>(a, log, prime, inverse);
+}
+
+#if HAS_X86_SIMD
+// Shoup's multiplication on 8 lanes: the high halves of x*wShoup come from two 32x32->64 bit
+// multiplies (even and odd lanes) blended back together.
+__attribute__((target("avx2"))) __m256i shoupMultiplyAVX2(__m256i x, __m256i w, __m256i wShoup, __m256i p)
+{
+    __m256i qEven = _mm256_srli_epi64(_mm256_mul_epu32(x, wShoup), 32);
+    __m256i qOdd = _mm256_mul_epu32(_mm256_srli_epi64(x, 32), wShoup);
+    __m256i q = _mm256_blend_epi32(qEven, qOdd, 0xAA);
+    return _mm256_sub_epi32(_mm256_mullo_epi32(x, w), _mm256_mullo_epi32(q, p));
+}
+
+// Butterflies on 8 lanes: plus = u + w*v, minus = u - w*v from lazily reduced u, v (below 4p).
+// min(x, x - 2p) is the branch-free conditional subtraction.
+__attribute__((target("avx2"))) void forwardButterfliesAVX2(__m256i u, __m256i v, __m256i w, __m256i wShoup, __m256i p,
+                                                            __m256i twoP, __m256i &plus, __m256i &minus)
+{
+    u = _mm256_min_epu32(u, _mm256_sub_epi32(u, twoP));
+    __m256i t = shoupMultiplyAVX2(v, w, wShoup, p);
+    plus = _mm256_add_epi32(u, t);
+    minus = _mm256_sub_epi32(_mm256_add_epi32(u, twoP), t);
+}
+
+// sum = u + v and difference = (v - u) * w from u, v below 2p.
+__attribute__((target("avx2"))) void inverseButterfliesAVX2(__m256i u, __m256i v, __m256i w, __m256i wShoup, __m256i p,
+                                                            __m256i twoP, __m256i &sum, __m256i &difference)
+{
+    sum = _mm256_add_epi32(u, v);
+    sum = _mm256_min_epu32(sum, _mm256_sub_epi32(sum, twoP));
+    difference = shoupMultiplyAVX2(_mm256_sub_epi32(_mm256_add_epi32(v, twoP), u), w, wShoup, p);
+}
+
+/*
+forwardLevel() on 8 lanes at a time. Called with len = 4 it runs the last three levels of the
+blocks [first, last) at once, one vector per block: each level copies its lo and hi halves
+across the vector with a shuffle, does 8 butterflies (half of them redundant) and blends the
+sums and differences back; the twiddles of the 2 and 4 sub-blocks are adjacent in the table.
+*/
+__attribute__((target("avx2"))) void forwardLevelAVX2(uint32_t *a, size_t len, size_t first, size_t last,
+                                                      const NttPrime &prime)
+{
+    const __m256i p = _mm256_set1_epi32(prime.p), twoP = _mm256_set1_epi32(2 * prime.p);
+    const uint32_t *roots = prime.roots.data(), *rootsShoup = prime.rootsShoup.data();
+    __m256i plus, minus;
+    if (len == 4)
+    {
+        const __m256i pairs = _mm256_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1), quads = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+        for (size_t s = first; s < last; s++)
+        {
+            __m256i x = _mm256_loadu_si256((const __m256i *)(a + 8 * s));
+            forwardButterfliesAVX2(_mm256_permute2x128_si256(x, x, 0x00), _mm256_permute2x128_si256(x, x, 0x11),
+                                   _mm256_set1_epi32(roots[s]), _mm256_set1_epi32(rootsShoup[s]), p, twoP, plus, minus);
+            x = _mm256_blend_epi32(plus, minus, 0xF0);
+
+            __m256i w = _mm256_permutevar8x32_epi32(_mm256_castsi128_si256(_mm_loadl_epi64((const __m128i *)(roots + 2 * s))), pairs);
+            __m256i wShoup = _mm256_permutevar8x32_epi32(_mm256_castsi128_si256(_mm_loadl_epi64((const __m128i *)(rootsShoup + 2 * s))), pairs);
+            forwardButterfliesAVX2(_mm256_shuffle_epi32(x, 0x44), _mm256_shuffle_epi32(x, 0xEE), w, wShoup, p, twoP, plus, minus);
+            x = _mm256_blend_epi32(plus, minus, 0xCC);
+
+            w = _mm256_permutevar8x32_epi32(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(roots + 4 * s))), quads);
+            wShoup = _mm256_permutevar8x32_epi32(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(rootsShoup + 4 * s))), quads);
+            forwardButterfliesAVX2(_mm256_shuffle_epi32(x, 0xA0), _mm256_shuffle_epi32(x, 0xF5), w, wShoup, p, twoP, plus, minus);
+            _mm256_storeu_si256((__m256i *)(a + 8 * s), _mm256_blend_epi32(plus, minus, 0xAA));
+        }
+        return;
+    }
+
+    for (size_t s = first; s < last; s++)
+    {
+        const __m256i w = _mm256_set1_epi32(roots[s]), wShoup = _mm256_set1_epi32(rootsShoup[s]);
+        uint32_t *lo = a + 2 * s * len, *hi = lo + len;
+        for (size_t j = 0; j < len; j += 8)
+        {
+            forwardButterfliesAVX2(_mm256_loadu_si256((const __m256i *)(lo + j)), _mm256_loadu_si256((const __m256i *)(hi + j)),
+                                   w, wShoup, p, twoP, plus, minus);
+            _mm256_storeu_si256((__m256i *)(lo + j), plus);
+            _mm256_storeu_si256((__m256i *)(hi + j), minus);
+        }
+    }
+}
+
+/*
+inverseLevel() on 8 lanes at a time; with len = 4 it first runs the two shorter levels, as in
+forwardLevelAVX2(). Within one 8-value block s > 0 the inverse twiddle indices of the sub-blocks
+count down (inverseTwiddle() flips the low bits), so they are loaded and reversed; block 0,
+which starts with the twiddle -1, goes through inverseLevel().
+*/
+__attribute__((target("avx2"))) void inverseLevelAVX2(uint32_t *a, size_t len, size_t first, size_t last,
+                                                      const NttPrime &prime)
+{
+    const __m256i p = _mm256_set1_epi32(prime.p), twoP = _mm256_set1_epi32(2 * prime.p);
+    const uint32_t *roots = prime.roots.data(), *rootsShoup = prime.rootsShoup.data();
+    __m256i sum, difference;
+    uint32_t scalarW, scalarWShoup;
+    if (len == 4)
+    {
+        const __m256i pairs = _mm256_setr_epi32(1, 1, 1, 1, 0, 0, 0, 0), quads = _mm256_setr_epi32(3, 3, 2, 2, 1, 1, 0, 0);
+        for (size_t s = first; s < last; s++)
+        {
+            if (s == 0)
+            {
+                for (size_t shortLen = 1; shortLen <= 4; shortLen <<= 1)
+                    inverseLevel(a, shortLen, 0, 4 / shortLen, prime);
+                continue;
+            }
+            __m256i x = _mm256_loadu_si256((const __m256i *)(a + 8 * s));
+            size_t quad = 4 * s ^ (((size_t)1 << (63 - __builtin_clzll(4 * s))) - 1), pair = quad >> 1;
+            __m256i w = _mm256_permutevar8x32_epi32(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(roots + quad - 3))), quads);
+            __m256i wShoup = _mm256_permutevar8x32_epi32(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(rootsShoup + quad - 3))), quads);
+            inverseButterfliesAVX2(_mm256_shuffle_epi32(x, 0xA0), _mm256_shuffle_epi32(x, 0xF5), w, wShoup, p, twoP, sum, difference);
+            x = _mm256_blend_epi32(sum, difference, 0xAA);
+
+            w = _mm256_permutevar8x32_epi32(_mm256_castsi128_si256(_mm_loadl_epi64((const __m128i *)(roots + pair - 1))), pairs);
+            wShoup = _mm256_permutevar8x32_epi32(_mm256_castsi128_si256(_mm_loadl_epi64((const __m128i *)(rootsShoup + pair - 1))), pairs);
+            inverseButterfliesAVX2(_mm256_shuffle_epi32(x, 0x44), _mm256_shuffle_epi32(x, 0xEE), w, wShoup, p, twoP, sum, difference);
+            x = _mm256_blend_epi32(sum, difference, 0xCC);
+
+            inverseTwiddle(prime, s, scalarW, scalarWShoup);
+            inverseButterfliesAVX2(_mm256_permute2x128_si256(x, x, 0x00), _mm256_permute2x128_si256(x, x, 0x11),
+                                   _mm256_set1_epi32(scalarW), _mm256_set1_epi32(scalarWShoup), p, twoP, sum, difference);
+            _mm256_storeu_si256((__m256i *)(a + 8 * s), _mm256_blend_epi32(sum, difference, 0xF0));
+        }
+        return;
+    }
+
+    for (size_t s = first; s < last; s++)
+    {
+        inverseTwiddle(prime, s, scalarW, scalarWShoup);
+        const __m256i w = _mm256_set1_epi32(scalarW), wShoup = _mm256_set1_epi32(scalarWShoup);
+        uint32_t *lo = a + 2 * s * len, *hi = lo + len;
+        for (size_t j = 0; j < len; j += 8)
+        {
+            inverseButterfliesAVX2(_mm256_loadu_si256((const __m256i *)(lo + j)), _mm256_loadu_si256((const __m256i *)(hi + j)),
+                                   w, wShoup, p, twoP, sum, difference);
+            _mm256_storeu_si256((__m256i *)(lo + j), sum);
+            _mm256_storeu_si256((__m256i *)(hi + j), difference);
+        }
+    }
+}
+
+// The same transform with 8 butterflies per step; transforms shorter than two vectors are
+// left to the scalar kernel.
+void nttAVX2(uint32_t *a, int log, const NttPrime &prime, bool inverse)
+{
+    if (log < 4)
+        return nttScalar(a, log, prime, inverse);
+    runNtt<forwardLevelAVX2, inverseLevelAVX2, 4>(a, log, prime, inverse);
+}
+#endif
+
+// Picks the widest kernel the CPU supports.
+NttKernel selectNttKernel()
+{
+#if HAS_X86_SIMD
+    if (__builtin_cpu_supports("avx2"))
+        return nttAVX2;
+#endif
+    return nttScalar;
+}
+
+/*
+The i-th CRT prime of the engine: the primes c * 2^23 + 1 below 2^30, largest first, so that
+every one supports the longest transform and each adds almost 30 bits to the CRT modulus.
+*/
+const NttPrime &nttCrtPrime(NttEngine &engine, size_t i)
+{
+    uint32_t c = engine.primes.empty() ? 128 : engine.primes.back().p >> NTT_MAX_LOG;
+    while (engine.primes.size() <= i)
+    {
+        while (!isPrime(((uBigInt)--c << NTT_MAX_LOG) + 1))
+            ;
+        engine.primes.push_back(makeNttPrime((c << NTT_MAX_LOG) + 1));
+    }
+    return engine.primes[i];
+}
+
+/*
+Cyclic convolution of 'left' and 'right' (both of size 2^log) modulo prime.p, into 'left' with
+the values fully reduced. 'right' is overwritten by its transform.
+*/
+void convolveModPrime(NttEngine &engine, vector<uint32_t> &left, vector<uint32_t> &right, int log, NttPrime &prime)
+{
+    prepareNttPrime(prime, log);
+    uint32_t p = prime.p, twoP = 2 * p;
+    engine.kernel(left.data(), log, prime, false);
+    engine.kernel(right.data(), log, prime, false);
+
+    BarrettContext ctx = makeBarrettContext(p);
+    size_t n = (size_t)1 << log;
+    for (size_t j = 0; j < n; j++)
+    {
+        uint32_t x = left[j] >= twoP ? left[j] - twoP : left[j], y = right[j] >= twoP ? right[j] - twoP : right[j];
+        left[j] = barrettMulMod(ctx, x >= p ? x - p : x, y >= p ? y - p : y);
+    }
+    engine.kernel(left.data(), log, prime, true);
+
+    uint32_t scale = modInverse<bigInt>((bigInt)(n % p), p), scaleShoup = shoupPrecompute(scale, p);
+    for (size_t j = 0; j < n; j++)
+    {
+        uint32_t x = shoupMultiply(left[j], scale, scaleShoup, p);
+        left[j] = x >= p ? x - p : x;
+    }
+}
+
+/*
+product = a * b with coefficients modulo m (all coefficients of a and b in [0, m)); false if
+the product has more than 2^NTT_MAX_LOG coefficients. An NTT prime m of up to 30 bits is
+used directly. Any other m gets the exact integer product from enough CRT primes that their
+product exceeds min(|a|, |b|) * (m - 1)^2, the largest possible coefficient, recombined with
+Garner's algorithm as in garnerCRT() (the inverses are the same for every coefficient, so
+they are computed once), and the mixed radix digits are reduced modulo m.
+*/
+bool multiplyPolynomials(NttEngine &engine, const vector<uBigInt> &a, const vector<uBigInt> &b, uBigInt m, vector<uBigInt> &product)
+{
+    product.clear();
+    if (a.empty() || b.empty())
+        return true;
+    size_t size = a.size() + b.size() - 1;
+    int log = 0;
+    while (((size_t)1 << log) < size)
+        log++;
+    if (log > NTT_MAX_LOG)
+        return false;
+    if (m == 1)
+    {
+        product.assign(size, 0);
+        return true;
+    }
+    if (!engine.kernel)
+        engine.kernel = selectNttKernel();
+
+    size_t n = (size_t)1 << log;
+    auto load = [&](const vector<uBigInt> &poly, vector<uint32_t> &out, uint32_t p) {
+        out.assign(n, 0);
+        if (m <= p)
+        {
+            copy(poly.begin(), poly.end(), out.begin());
+            return;
+        }
+        uBigInt mu = ~0ULL / p; // x - ((x * mu) >> 64) * p is below 3p
+        for (size_t j = 0; j < poly.size(); j++)
+        {
+            uBigInt x = poly[j];
+#if HAS_INT128
+            x -= (uBigInt)(((uInt128)x * mu) >> 64) * p;
+            while (x >= p)
+                x -= p;
+#else
+            x %= p;
+#endif
+            out[j] = x;
+        }
+    };
+
+    if (m < (1u << 30) && (int)countTrailingZeros(m - 1) >= log && isPrime(m))
+    {
+        if (engine.direct.p != m)
+            engine.direct = makeNttPrime(m);
+        load(a, engine.left, m);
+        load(b, engine.right, m);
+        convolveModPrime(engine, engine.left, engine.right, log, engine.direct);
+        product.assign(engine.left.begin(), engine.left.begin() + size);
+        return true;
+    }
+
+    double bits = 2 * log2((double)(m - 1)) + log2((double)min(a.size(), b.size())) + 1;
+    size_t k = 0;
+    for (double have = 0; have < bits; k++)
+        have += log2((double)nttCrtPrime(engine, k).p);
+
+    // Garner digit i is ((r_i - v_0) / p_0 - v_1) / p_1 ... modulo p_i. Even 64-bit moduli need
+    // only six primes, all in (2^29, 2^30), so a digit is reduced modulo a later prime with one
+    // subtraction.
+    engine.digits.resize(k * size);
+    for (size_t i = 0; i < k; i++)
+    {
+        NttPrime &prime = engine.primes[i];
+        uint32_t p = prime.p;
+        load(a, engine.left, p);
+        load(b, engine.right, p);
+        convolveModPrime(engine, engine.left, engine.right, log, prime);
+
+        vector<uint32_t> inverses(i), inversesShoup(i);
+        for (size_t j = 0; j < i; j++)
+        {
+            inverses[j] = modInverse<bigInt>(engine.primes[j].p % p, p);
+            inversesShoup[j] = shoupPrecompute(inverses[j], p);
+        }
+        uint32_t *digits = engine.digits.data() + i * size;
+        for (size_t c = 0; c < size; c++)
+        {
+            uint32_t x = engine.left[c];
+            for (size_t j = 0; j < i; j++)
+            {
+                uint32_t v = engine.digits[j * size + c];
+                x = shoupMultiply(x + p - (v >= p ? v - p : v), inverses[j], inversesShoup[j], p);
+                x = x >= p ? x - p : x;
+            }
+            digits[c] = x;
+        }
+    }
+
+    vector<uBigInt> radix(k); // p_0 * ... * p_(j-1) mod m
+    radix[0] = 1 % m;
+    for (size_t j = 1; j < k; j++)
+        radix[j] = mulMod(radix[j - 1], engine.primes[j - 1].p, m);
+    product.resize(size);
+    for (size_t c = 0; c < size; c++)
+    {
+#if HAS_INT128
+        uInt128 sum = 0;
+        for (size_t j = 0; j < k; j++)
+            sum += (uInt128)engine.digits[j * size + c] * radix[j];
+        product[c] = (uBigInt)(sum % m);
+#else
+        uBigInt sum = 0;
+        for (size_t j = 0; j < k; j++)
+            sum = addMod(sum, mulMod(engine.digits[j * size + c], radix[j], m), m);
+        product[c] = sum;
+#endif
+    }
+    return true;
+}
+
+// Schoolbook O(n^2) product, the reference for multiplyPolynomials().
+vector<uBigInt> multiplyPolynomialsNaive(const vector<uBigInt> &a, const vector<uBigInt> &b, uBigInt m)
+{
+    if (a.empty() || b.empty())
+        return {};
+    vector<uBigInt> product(a.size() + b.size() - 1, 0);
+    BarrettContext ctx = makeBarrettContext(m);
+    for (size_t i = 0; i < a.size(); i++)
+        for (size_t j = 0; j < b.size(); j++)
+            product[i + j] = addMod(product[i + j], barrettMulMod(ctx, a[i], b[j]), m);
+    return product;
+}
+
+// ************ Matrix and Recurrence Functions ******************
+
+/*
+How many products below (m-1)^2 a 128-bit accumulator holding a value below m can take before
+it may overflow. For m < 2^32 that is effectively unlimited; for m near 2^63 it is 4.
+*/
+size_t lazyProductLimit(uBigInt m)
+{
+#if HAS_INT128
+    if (m <= 2)
+        return SIZE_MAX;
+    uInt128 square = (uInt128)(m - 1) * (m - 1);
+    uInt128 limit = (~(uInt128)0 - (m - 1)) / square;
+    return limit > SIZE_MAX ? SIZE_MAX : (size_t)limit;
+#else
+    return 1;
+#endif
+}
+
+ModMatrix identityMatrix(size_t k, uBigInt m)
+{
+    ModMatrix identity;
+    identity.k = k;
+    identity.m = m;
+    identity.entries.assign(k * k, 0);
+    for (size_t i = 0; i < k; i++)
+        identity.entries[i * k + i] = 1 % m;
+    return identity;
+}
+
+/*
+a * b over Z/mZ. Row i of the product is accumulated as sum_t a[i][t] * (row t of b) in 128-bit
+sums that are reduced only every lazyProductLimit(m) terms, so small moduli pay one division per
+entry instead of one per product. The columns are processed in tiles of MATRIX_TILE, which keeps
+the accumulators in L1 and the tile of b in L2 while every row of a streams past; zero entries
+of a (common in companion and transition matrices) are skipped.
+*/
+ModMatrix multiplyMatrices(const ModMatrix &a, const ModMatrix &b)
+{
+    size_t k = a.k;
+    uBigInt m = a.m;
+    ModMatrix product;
+    product.k = k;
+    product.m = m;
+    product.entries.assign(k * k, 0);
+
+#if HAS_INT128
+    size_t limit = lazyProductLimit(m);
+    uInt128 sums[MATRIX_TILE];
+    for (size_t column = 0; column < k; column += MATRIX_TILE)
+    {
+        size_t width = min(MATRIX_TILE, k - column);
+        for (size_t i = 0; i < k; i++)
+        {
+            fill(sums, sums + width, 0);
+            size_t pending = 0;
+            for (size_t t = 0; t < k; t++)
+            {
+                uBigInt x = a.entries[i * k + t];
+                if (!x)
+                    continue;
+                const uBigInt *row = &b.entries[t * k + column];
+                for (size_t j = 0; j < width; j++)
+                    sums[j] += (uInt128)x * row[j];
+                if (++pending == limit)
+                {
+                    for (size_t j = 0; j < width; j++)
+                        sums[j] %= m;
+                    pending = 0;
+                }
+            }
+            for (size_t j = 0; j < width; j++)
+                product.entries[i * k + column + j] = (uBigInt)(sums[j] % m);
+        }
+    }
+#else
+    for (size_t i = 0; i < k; i++)
+        for (size_t t = 0; t < k; t++)
+        {
+            uBigInt x = a.entries[i * k + t];
+            for (size_t j = 0; x && j < k; j++)
+                product.entries[i * k + j] = addMod(product.entries[i * k + j], mulMod(x, b.entries[t * k + j], m), m);
+        }
+#endif
+    return product;
+}
+
+/*
+The generic square-and-multiply loop behind matrixPower() and the Kitamasa recurrence solver:
+walks the bits of n from the top, squaring 'result' for every bit and applying step() (one
+multiplication by the base) for every 1 bit, the same binary expansion as modularExponentiation().
+'result' starts as the identity; the leading 1 bit skips squaring it.
+*/
+template <typename T, typename Square, typename Step>
+T powerBySquaring(uBigInt n, T result, Square square, Step step)
+{
+    if (n == 0)
+        return result;
+    int bit = 63 - __builtin_clzll(n);
+    result = step(result);
+    while (bit-- > 0)
+    {
+        result = square(result);
+        if ((n >> bit) & 1)
+            result = step(result);
+    }
+    return result;
+}
+
+ModMatrix matrixPower(const ModMatrix &base, uBigInt n)
+{
+    return powerBySquaring(n, identityMatrix(base.k, base.m),
+                           [](const ModMatrix &x) { return multiplyMatrices(x, x); },
+                           [&](const ModMatrix &x) { return multiplyMatrices(x, base); });
+}
+
+/*
+a_n for a_i = c_1 a_(i-1) + ... + c_k a_(i-k) (mod m) with a_0..a_(k-1) given, via the k x k
+companion matrix C: (a_(t+k-1), ..., a_t) = C^t (a_(k-1), ..., a_0). O(k^3 log n).
+*/
+uBigInt linearRecurrenceMatrix(const vector<uBigInt> &coefficients, const vector<uBigInt> &initial, uBigInt n, uBigInt m)
+{
+    size_t k = coefficients.size();
+    ModMatrix companion;
+    companion.k = k;
+    companion.m = m;
+    companion.entries.assign(k * k, 0);
+    for (size_t i = 0; i < k; i++)
+    {
+        companion.entries[i] = coefficients[i] % m;
+        if (i + 1 < k)
+            companion.entries[(i + 1) * k + i] = 1 % m;
+    }
+
+    ModMatrix power = matrixPower(companion, n);
+    uBigInt value = 0;
+    for (size_t j = 0; j < k; j++)
+        value = addMod(value, mulMod(power.entries[(k - 1) * k + j], initial[k - 1 - j] % m, m), m);
+    return value;
+}
+
+/*
+Kitamasa's method: with f(x) = x^k - c_1 x^(k-1) - ... - c_k, a_n = sum r_i a_i where
+r(x) = x^n mod f(x), because x^k may be replaced by c_1 x^(k-1) + ... + c_k in any polynomial
+without changing the combination of a_i it stands for. x^n mod f comes from powerBySquaring()
+over polynomials of degree < k: a step multiplies by x (a shift plus one reduction, O(k)), a
+square is a product plus a reduction mod f. Below KITAMASA_NTT_ORDER both are schoolbook O(k^2)
+with lazy 128-bit sums (the reduction is sum_d p_d * (x^d mod f) for the k-1 precomputed
+x^d mod f, d >= k); from there the product goes through multiplyPolynomials() and the
+reduction uses the power series inverse of the reversed f (Newton iteration), O(k log k).
+*/
+uBigInt linearRecurrenceKitamasa(const vector<uBigInt> &coefficients, const vector<uBigInt> &initial, uBigInt n, uBigInt m)
+{
+    size_t k = coefficients.size();
+    vector<uBigInt> c(k);
+    for (size_t i = 0; i < k; i++)
+        c[i] = coefficients[i] % m;
+
+    // r(x) * x mod f: the x^k term folds back as top * (c_1 x^(k-1) + ... + c_k).
+    auto step = [&](vector<uBigInt> r) {
+        uBigInt top = r[k - 1];
+        for (size_t i = k - 1; i > 0; i--)
+            r[i] = addMod(r[i - 1], mulMod(top, c[k - 1 - i], m), m);
+        r[0] = mulMod(top, c[k - 1], m);
+        return r;
+    };
+
+    vector<uBigInt> one(k, 0);
+    one[0] = 1 % m;
+    vector<uBigInt> r;
+    if (k < KITAMASA_NTT_ORDER)
+    {
+        // folded[d - k] = x^d mod f for d = k .. 2k-2, stored column-wise for the reduction
+        vector<uBigInt> folded((k - 1) * k);
+        vector<uBigInt> power(k, 0);
+        power[k - 1] = 1 % m;
+        for (size_t d = 0; d + 1 < k; d++)
+        {
+            power = step(power);
+            for (size_t j = 0; j < k; j++)
+                folded[j * (k - 1) + d] = power[j];
+        }
+
+        size_t limit = lazyProductLimit(m);
+        auto square = [&](const vector<uBigInt> &x) {
+            vector<uBigInt> product(2 * k - 1);
+            for (size_t d = 0; d < 2 * k - 1; d++)
+            {
+                size_t first = d < k ? 0 : d - k + 1, last = min(d, k - 1);
+                product[d] = lazyDotProduct(&x[first], &x[d - last], last - first + 1, m, limit, true);
+            }
+            vector<uBigInt> reduced(k);
+            for (size_t j = 0; j < k; j++)
+                reduced[j] = addMod(product[j], lazyDotProduct(&product[k], &folded[j * (k - 1)], k - 1, m, limit, false), m);
+            return reduced;
+        };
+        r = powerBySquaring(n, one, square, step);
+    }
+    else
+    {
+        // inverse = 1 / rev(f) mod x^(k-1), where rev(f) = 1 - c_1 x - ... - c_k x^k
+        NttEngine engine;
+        vector<uBigInt> reversed(k + 1), f(k + 1);
+        reversed[0] = 1 % m;
+        for (size_t i = 0; i < k; i++)
+            reversed[i + 1] = (m - c[i]) % m;
+        for (size_t i = 0; i <= k; i++)
+            f[i] = reversed[k - i];
+        vector<uBigInt> inverse = inversePowerSeries(engine, reversed, k - 1, m);
+
+        vector<uBigInt> product, quotient, multiple;
+        auto square = [&](const vector<uBigInt> &x) {
+            multiplyPolynomials(engine, x, x, m, product);
+            product.resize(2 * k - 1, 0);
+            // quotient = rev(rev(product) * inverse mod x^(k-1)), then product - quotient * f
+            vector<uBigInt> top(product.rbegin(), product.rbegin() + (k - 1));
+            multiplyPolynomials(engine, top, inverse, m, quotient);
+            quotient.resize(k - 1, 0);
+            reverse(quotient.begin(), quotient.end());
+            multiplyPolynomials(engine, quotient, f, m, multiple);
+            vector<uBigInt> reduced(k);
+            for (size_t j = 0; j < k; j++)
+                reduced[j] = subMod(product[j], j < multiple.size() ? multiple[j] : 0, m);
+            return reduced;
+        };
+        r = powerBySquaring(n, one, square, step);
+    }
+
+    uBigInt value = 0;
+    for (size_t i = 0; i < k; i++)
+        value = addMod(value, mulMod(r[i], initial[i] % m, m), m);
+    return value;
+}
+
+/*
+sum a[i] * b[i] mod m over 'count' terms (b read backwards when 'reversed' is set, for
+convolutions), with the 128-bit sum reduced only every 'limit' terms.
+*/
+uBigInt lazyDotProduct(const uBigInt *a, const uBigInt *b, size_t count, uBigInt m, size_t limit, bool reversed)
+{
+#if HAS_INT128
+    uInt128 sum = 0;
+    size_t pending = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        sum += (uInt128)a[i] * (reversed ? b[count - 1 - i] : b[i]);
+        if (++pending == limit)
+        {
+            sum %= m;
+            pending = 0;
+        }
+    }
+    return (uBigInt)(sum % m);
+#else
+    uBigInt sum = 0;
+    for (size_t i = 0; i < count; i++)
+        sum = addMod(sum, mulMod(a[i], reversed ? b[count - 1 - i] : b[i], m), m);
+    return sum;
+#endif
+}
+
+/*
+The first 'length' coefficients of 1/g for a power series g with g(0) = 1, by Newton's iteration
+h -> h * (2 - g*h), which doubles the number of correct coefficients each round.
+*/
+vector<uBigInt> inversePowerSeries(NttEngine &engine, const vector<uBigInt> &g, size_t length, uBigInt m)
+{
+    vector<uBigInt> h(1, 1 % m), gh, correction;
+    for (size_t known = 1; known < length;)
+    {
+        known = min(2 * known, length);
+        vector<uBigInt> head(g.begin(), g.begin() + min(known, g.size()));
+        multiplyPolynomials(engine, head, h, m, gh);
+        gh.resize(known, 0);
+        for (uBigInt &x : gh)
+            x = (m - x) % m;
+        gh[0] = addMod(gh[0], 2 % m, m);
+        multiplyPolynomials(engine, h, gh, m, correction);
+        correction.resize(known, 0);
+        h.swap(correction);
+    }
+    h.resize(length, 0);
+    return h;
+}
+
+// a_n of the recurrence. Kitamasa's method beats the companion matrix from order 2 on (its k^2
+// against k^3 per step), so the matrix version only serves as the reference.
+uBigInt linearRecurrence(const vector<uBigInt> &coefficients, const vector<uBigInt> &initial, uBigInt n, uBigInt m)
+{
+    if (n < initial.size())
+        return initial[n] % m;
+    return linearRecurrenceKitamasa(coefficients, initial, n, m);
+}
+
+// ************ Result Cache Functions ******************
+
+// Sizes the cache for 'bytes' of entries (rounded down to whole sets per shard); 0 turns it off.
+void configureResultCache(ResultCache &cache, size_t bytes)
+{
+    const size_t shards = (size_t)1 << CACHE_SHARD_BITS;
+    size_t sets = bytes / (sizeof(CacheEntry) * CACHE_WAYS * shards);
+    cache.capacity = 0;
+    cache.shards.reset();
+    if (sets == 0)
+        return;
+    while (sets & (sets - 1))
+        sets &= sets - 1;
+
+    cache.shards.reset(new CacheShard[shards]);
+    for (size_t i = 0; i < shards; i++)
+    {
+        cache.shards[i].entries.reset(new CacheEntry[sets * CACHE_WAYS]);
+        cache.shards[i].setMask = sets - 1;
+    }
+    cache.capacity = shards * sets * CACHE_WAYS;
+}
+
+uint64_t cacheHash(uint64_t op, uint64_t a, uint64_t b, uint64_t c)
+{
+    uint64_t h = op * 0x9E3779B97F4A7C15ULL;
+    for (uint64_t word : {a, b, c})
+    {
+        h = (h ^ word) * 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 32;
+    }
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    return h ^ (h >> 29);
+}
+
+bool lookupResult(ResultCache &cache, uint8_t op, bigInt a, bigInt b, bigInt c, bigInt &value)
+{
+    if (!cache.capacity)
+        return false;
+    uint64_t h = cacheHash(op, a, b, c);
+    CacheShard &shard = cache.shards[h >> (64 - CACHE_SHARD_BITS)];
+    CacheEntry *set = &shard.entries[(h & shard.setMask) * CACHE_WAYS];
+    for (int way = 0; way < CACHE_WAYS; way++)
+    {
+        CacheEntry &entry = set[way];
+        uint64_t version = entry.version.load(memory_order_acquire);
+        bool match = entry.op.load(memory_order_relaxed) == op && entry.a.load(memory_order_relaxed) == (uint64_t)a &&
+                     entry.b.load(memory_order_relaxed) == (uint64_t)b && entry.c.load(memory_order_relaxed) == (uint64_t)c;
+        uint64_t result = entry.value.load(memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        if (match && !(version & 1) && entry.version.load(memory_order_relaxed) == version)
+        {
+            if (!entry.referenced.load(memory_order_relaxed))
+                entry.referenced.store(1, memory_order_relaxed);
+            shard.hits.fetch_add(1, memory_order_relaxed);
+            value = (bigInt)result;
+            return true;
+        }
+    }
+    shard.misses.fetch_add(1, memory_order_relaxed);
+    return false;
+}
+
+void storeResult(ResultCache &cache, uint8_t op, bigInt a, bigInt b, bigInt c, bigInt value)
+{
+    if (!cache.capacity)
+        return;
+    uint64_t h = cacheHash(op, a, b, c);
+    CacheShard &shard = cache.shards[h >> (64 - CACHE_SHARD_BITS)];
+    CacheEntry *set = &shard.entries[(h & shard.setMask) * CACHE_WAYS];
+    lock_guard<mutex> guard(shard.lock);
+
+    CacheEntry *victim = nullptr;
+    for (int way = 0; way < CACHE_WAYS && !victim; way++)
+    {
+        CacheEntry &entry = set[way];
+        if (entry.op.load(memory_order_relaxed) == op && entry.a.load(memory_order_relaxed) == (uint64_t)a &&
+            entry.b.load(memory_order_relaxed) == (uint64_t)b && entry.c.load(memory_order_relaxed) == (uint64_t)c)
+            return; // another thread stored it first
+        if (entry.op.load(memory_order_relaxed) == 0)
+            victim = &entry;
+    }
+    while (!victim)
+    {
+        CacheEntry &entry = set[set->hand];
+        set->hand = (set->hand + 1) % CACHE_WAYS;
+        if (entry.referenced.load(memory_order_relaxed))
+            entry.referenced.store(0, memory_order_relaxed);
+        else
+        {
+            victim = &entry;
+            shard.evictions.fetch_add(1, memory_order_relaxed);
+        }
+    }
+
+    uint64_t version = victim->version.load(memory_order_relaxed);
+    victim->version.store(version + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    victim->op.store(op, memory_order_relaxed);
+    victim->a.store(a, memory_order_relaxed);
+    victim->b.store(b, memory_order_relaxed);
+    victim->c.store(c, memory_order_relaxed);
+    victim->value.store(value, memory_order_relaxed);
+    victim->referenced.store(0, memory_order_relaxed);
+    victim->version.store(version + 2, memory_order_release);
+}
+
+// compute() through the result cache: the stored result if there is one, otherwise compute() is
+// run and its result stored.
+template <typename Compute>
+bigInt memoizedResult(uint8_t op, bigInt a, bigInt b, bigInt c, Compute compute)
+{
+    bigInt value;
+    if (lookupResult(resultCache, op, a, b, c, value))
+        return value;
+    value = compute();
+    storeResult(resultCache, op, a, b, c, value);
+    return value;
+}
+
+// The counters for the menu and the --summary line.
+string describeResultCache(const ResultCache &cache)
+{
+    uint64_t hits = 0, misses = 0, evictions = 0;
+    for (size_t i = 0; cache.capacity && i < ((size_t)1 << CACHE_SHARD_BITS); i++)
+    {
+        hits += cache.shards[i].hits.load(memory_order_relaxed);
+        misses += cache.shards[i].misses.load(memory_order_relaxed);
+        evictions += cache.shards[i].evictions.load(memory_order_relaxed);
+    }
+    char line[160];
+    snprintf(line, sizeof line, "cache: %llu hits, %llu misses, %llu evictions (%.1f%% hits, %zu entries, %zu KiB)",
+             (unsigned long long)hits, (unsigned long long)misses, (unsigned long long)evictions,
+             hits + misses ? 100.0 * hits / (hits + misses) : 0.0, cache.capacity,
+             cache.capacity * sizeof(CacheEntry) >> 10);
+    return line;
+}
+
+// ************ Metrics Functions ******************
+
+// The histogram bucket of 'value': the value itself below 32, above that its top 5 bits and
+// their position.
+int metricBucket(uint64_t value)
+{
+    value = min(value, ((uint64_t)1 << METRIC_MAX_BITS) - 1);
+    if (value < (2u << METRIC_SUB_BITS))
+        return (int)value;
+    int shift = 64 - __builtin_clzll(value) - METRIC_SUB_BITS - 1;
+    return (shift << METRIC_SUB_BITS) + (int)(value >> shift);
+}
+
+// The largest value that lands in 'bucket'.
+uint64_t metricBucketLimit(int bucket)
+{
+    if (bucket < (2 << METRIC_SUB_BITS))
+        return bucket;
+    int shift = (bucket >> METRIC_SUB_BITS) - 1;
+    uint64_t mantissa = bucket - (shift << METRIC_SUB_BITS);
+    return ((mantissa + 1) << shift) - 1;
+}
+
+// The calling thread's block, registered on its first use.
+MetricsBlock &threadMetrics()
+{
+    thread_local MetricsBlock *block = nullptr;
+    if (!block)
+    {
+        block = new MetricsBlock();
+        lock_guard<mutex> guard(metrics.lock);
+        metrics.blocks.emplace_back(block);
+    }
+    return *block;
+}
+
+// Nanoseconds for timing an operation, or 0 while the metrics are off.
+uint64_t metricClock()
+{
+    if constexpr (METRICS_ENABLED)
+    {
+        if (metrics.active)
+            return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    return 0;
+}
+
+// Only the owning thread writes a histogram, so plain loads and stores are enough.
+void recordMetric(MetricHistogram &histogram, uint64_t value)
+{
+    histogram.count.store(histogram.count.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    histogram.sum.store(histogram.sum.load(memory_order_relaxed) + value, memory_order_relaxed);
+    if (value > histogram.max.load(memory_order_relaxed))
+        histogram.max.store(value, memory_order_relaxed);
+    atomic<uint64_t> &bucket = histogram.buckets[metricBucket(value)];
+    bucket.store(bucket.load(memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+// Records one call of METRIC_OPERATIONS[op] that started at metricClock() time 'started'.
+void recordOperation(int op, uint64_t started, bool failed)
+{
+    if constexpr (METRICS_ENABLED)
+    {
+        if (!metrics.active)
+            return;
+        OperationMetrics &operation = threadMetrics().operations[op];
+        recordMetric(operation.latency, metricClock() - started);
+        if (failed)
+            operation.errors.store(operation.errors.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    }
+}
+
+void countEuclidSteps(uint64_t steps)
+{
+    if constexpr (METRICS_ENABLED)
+    {
+        if (metrics.active)
+            recordMetric(threadMetrics().euclidSteps, steps);
+    }
+}
+
+void countFallback(int reason)
+{
+    if constexpr (METRICS_ENABLED)
+    {
+        if (!metrics.active)
+            return;
+        atomic<uint64_t> &count = threadMetrics().fallbacks[reason];
+        count.store(count.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    }
+}
+
+// The METRIC_OPERATIONS index of a batch operation name.
+int metricOperation(const string &op)
+{
+    for (int i = 0; i < METRIC_OPERATION_COUNT - 1; i++)
+        if (op == METRIC_OPERATIONS[i])
+            return i;
+    return METRIC_OPERATION_COUNT - 1;
+}
+
+void addHistogram(HistogramTotals &totals, const MetricHistogram &histogram)
+{
+    totals.count += histogram.count.load(memory_order_relaxed);
+    totals.sum += histogram.sum.load(memory_order_relaxed);
+    totals.max = max(totals.max, histogram.max.load(memory_order_relaxed));
+    for (int i = 0; i < METRIC_BUCKETS; i++)
+        totals.buckets[i] += histogram.buckets[i].load(memory_order_relaxed);
+}
+
+// The value at quantile q: the top of the bucket holding it (never above the largest value seen).
+uint64_t histogramQuantile(const HistogramTotals &totals, double q)
+{
+    uint64_t rank = max<uint64_t>(1, (uint64_t)ceil(q * totals.count)), seen = 0;
+    for (int i = 0; i < METRIC_BUCKETS; i++)
+    {
+        seen += totals.buckets[i];
+        if (seen >= rank)
+            return min(metricBucketLimit(i), totals.max);
+    }
+    return totals.max;
+}
+
+/*
+Everything recorded so far, as JSON or in the Prometheus text format. Only the operations that were
+called are listed; a histogram lists its non-empty buckets, by their largest value ('le': the
+buckets are cumulative in the Prometheus format, plain counts in JSON).
+*/
+string formatMetrics(const string &format)
+{
+    vector<HistogramTotals> latencies(METRIC_OPERATION_COUNT);
+    vector<uint64_t> errors(METRIC_OPERATION_COUNT), fallbacks(METRIC_FALLBACK_COUNT);
+    HistogramTotals euclid;
+    {
+        lock_guard<mutex> guard(metrics.lock);
+        for (const unique_ptr<MetricsBlock> &block : metrics.blocks)
+        {
+            for (int op = 0; op < METRIC_OPERATION_COUNT; op++)
+            {
+                addHistogram(latencies[op], block->operations[op].latency);
+                errors[op] += block->operations[op].errors.load(memory_order_relaxed);
+            }
+            addHistogram(euclid, block->euclidSteps);
+            for (int i = 0; i < METRIC_FALLBACK_COUNT; i++)
+                fallbacks[i] += block->fallbacks[i].load(memory_order_relaxed);
+        }
+    }
+
+    string out;
+    char line[256];
+    if (format == "prometheus")
+    {
+        // name{labels,le="..."} lines for one histogram; 'scale' converts the recorded unit.
+        auto appendHistogram = [&](const char *name, const string &labels, const HistogramTotals &totals,
+                                   double scale) {
+            string prefix = labels.empty() ? "{" : "{" + labels + ",";
+            uint64_t cumulative = 0;
+            for (int i = 0; i < METRIC_BUCKETS; i++)
+            {
+                if (!totals.buckets[i])
+                    continue;
+                cumulative += totals.buckets[i];
+                snprintf(line, sizeof line, "%s_bucket%sle=\"%.9g\"} %llu\n", name, prefix.c_str(),
+                         metricBucketLimit(i) * scale, (unsigned long long)cumulative);
+                out += line;
+            }
+            snprintf(line, sizeof line, "%s_bucket%sle=\"+Inf\"} %llu\n%s_sum%s %.9g\n%s_count%s %llu\n", name,
+                     prefix.c_str(), (unsigned long long)totals.count, name,
+                     labels.empty() ? "" : ("{" + labels + "}").c_str(), totals.sum * scale, name,
+                     labels.empty() ? "" : ("{" + labels + "}").c_str(), (unsigned long long)totals.count);
+            out += line;
+        };
+
+        out += "# HELP modcalc_operations_total Operations run, by operation.\n"
+               "# TYPE modcalc_operations_total counter\n";
+        for (int op = 0; op < METRIC_OPERATION_COUNT; op++)
+            if (latencies[op].count)
+            {
+                snprintf(line, sizeof line, "modcalc_operations_total{op=\"%s\"} %llu\n", METRIC_OPERATIONS[op],
+                         (unsigned long long)latencies[op].count);
+                out += line;
+            }
+        out += "# HELP modcalc_operation_errors_total Operations that ended with an error.\n"
+               "# TYPE modcalc_operation_errors_total counter\n";
+        for (int op = 0; op < METRIC_OPERATION_COUNT; op++)
+            if (latencies[op].count)
+            {
+                snprintf(line, sizeof line, "modcalc_operation_errors_total{op=\"%s\"} %llu\n",
+                         METRIC_OPERATIONS[op], (unsigned long long)errors[op]);
+                out += line;
+            }
+        out += "# HELP modcalc_operation_duration_seconds Time per operation.\n"
+               "# TYPE modcalc_operation_duration_seconds histogram\n";
+        for (int op = 0; op < METRIC_OPERATION_COUNT; op++)
+            if (latencies[op].count)
+                appendHistogram("modcalc_operation_duration_seconds",
+                                string("op=\"") + METRIC_OPERATIONS[op] + "\"", latencies[op], 1e-9);
+        out += "# HELP modcalc_euclid_steps Division steps per Euclid run.\n"
+               "# TYPE modcalc_euclid_steps histogram\n";
+        appendHistogram("modcalc_euclid_steps", "", euclid, 1);
+        out += "# HELP modcalc_overflow_fallbacks_total 64-bit operations redone over big numbers.\n"
+               "# TYPE modcalc_overflow_fallbacks_total counter\n";
+        for (int i = 0; i < METRIC_FALLBACK_COUNT; i++)
+        {
+            snprintf(line, sizeof line, "modcalc_overflow_fallbacks_total{reason=\"%s\"} %llu\n",
+                     METRIC_FALLBACKS[i], (unsigned long long)fallbacks[i]);
+            out += line;
+        }
+        return out;
+    }
+
+    // "count", "mean", quantiles, "max" and the buckets as [largest value, count] pairs.
+    auto appendHistogram = [&](const HistogramTotals &totals) {
+        snprintf(line, sizeof line,
+                 "{\"count\": %llu, \"mean\": %.1f, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, "
+                 "\"p999\": %llu, \"max\": %llu, \"buckets\": [",
+                 (unsigned long long)totals.count, totals.count ? (double)totals.sum / totals.count : 0.0,
+                 (unsigned long long)histogramQuantile(totals, 0.5), (unsigned long long)histogramQuantile(totals, 0.9),
+                 (unsigned long long)histogramQuantile(totals, 0.99),
+                 (unsigned long long)histogramQuantile(totals, 0.999), (unsigned long long)totals.max);
+        out += line;
+        bool first = true;
+        for (int i = 0; i < METRIC_BUCKETS; i++)
+            if (totals.buckets[i])
+            {
+                snprintf(line, sizeof line, "%s[%llu, %llu]", first ? "" : ", ",
+                         (unsigned long long)metricBucketLimit(i), (unsigned long long)totals.buckets[i]);
+                out += line;
+                first = false;
+            }
+        out += "]}";
+    };
+
+    out += "{\n  \"operations\": {";
+    bool first = true;
+    for (int op = 0; op < METRIC_OPERATION_COUNT; op++)
+        if (latencies[op].count)
+        {
+            snprintf(line, sizeof line, "%s\n    \"%s\": {\"calls\": %llu, \"errors\": %llu, \"latency_ns\": ",
+                     first ? "" : ",", METRIC_OPERATIONS[op], (unsigned long long)latencies[op].count,
+                     (unsigned long long)errors[op]);
+            out += line;
+            appendHistogram(latencies[op]);
+            out += "}";
+            first = false;
+        }
+    out += first ? "},\n" : "\n  },\n";
+    out += "  \"euclid_steps\": ";
+    appendHistogram(euclid);
+    out += ",\n  \"overflow_fallbacks\": {";
+    for (int i = 0; i < METRIC_FALLBACK_COUNT; i++)
+    {
+        snprintf(line, sizeof line, "%s\"%s\": %llu", i ? ", " : "", METRIC_FALLBACKS[i],
+                 (unsigned long long)fallbacks[i]);
+        out += line;
+    }
+    out += "}\n}\n";
+    return out;
+}
+
+volatile sig_atomic_t metricsRequested = 0;
+
+// Turns recording on; SIGUSR1 then asks for a dump at the next dumpRequestedMetrics().
+void startMetrics(const string &format)
+{
+    if (format.empty())
+        return;
+    metrics.active = true;
+#if !defined(_WIN32)
+    struct sigaction request = {};
+    request.sa_handler = [](int) { metricsRequested = 1; };
+    request.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &request, nullptr);
+#endif
+}
+
+// Writes the metrics to stderr if SIGUSR1 arrived since the last call.
+void dumpRequestedMetrics(const string &format)
+{
+    if (!metricsRequested)
+        return;
+    metricsRequested = 0;
+    string text = formatMetrics(format);
+    fwrite(text.data(), 1, text.size(), stderr);
+    fflush(stderr);
+}
+
+// ************ Benchmark Functions ******************
+
+void printBenchmarkResult(const BenchmarkResult &result)
+{
+    printf("%-30s %6d %12.2f %12.2f %14.0f", result.name.c_str(), result.size, result.medianNs, result.p99Ns,
+           1e9 / result.medianNs);
+    if (result.bytesPerOp > 0)
+        printf(" %9.2f", result.bytesPerOp / result.medianNs);
+    else
+        printf(" %9s", "");
+    if (result.writesPerOp >= 0)
+        printf(" %9.2f", result.writesPerOp);
+    printf("\n");
+}
+
+/*
+Runs body() options.warmup times untimed, then options.repetitions times timed. Every call performs
+'ops' operations and returns a checksum of its results, which goes into suite.sink so that no run
+can be optimized away. Records the median and p99 (nearest rank) time per operation and returns
+the checksum of the last run, for the agreement checks between variants.
+*/
+template <typename Body>
+uint64_t measureBenchmark(BenchmarkSuite &suite, const string &name, int size, double ops, Body body,
+                          double bytesPerOp)
+{
+    for (int i = 0; i < suite.options.warmup; i++)
+        suite.sink += body();
+
+    uint64_t checksum = 0, writesBefore = 0, writesAfter = 0;
+    vector<double> samples;
+    bool countWrites = countWriteSyscalls(writesBefore);
+    for (int i = 0; i < suite.options.repetitions; i++)
+    {
+        auto start = chrono::steady_clock::now();
+        checksum = body();
+        samples.push_back(chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / ops);
+        suite.sink += checksum;
+    }
+    countWrites = countWrites && countWriteSyscalls(writesAfter);
+    sort(samples.begin(), samples.end());
+
+    BenchmarkResult result;
+    result.name = name;
+    result.size = size;
+    result.medianNs = samples[samples.size() / 2];
+    result.p99Ns = samples[(samples.size() * 99 + 99) / 100 - 1];
+    result.bytesPerOp = bytesPerOp;
+    if (countWrites)
+        result.writesPerOp = (writesAfter - writesBefore) / (ops * suite.options.repetitions);
+    suite.results.push_back(result);
+    if (suite.options.format == "table")
+        printBenchmarkResult(result);
+    return checksum;
+}
+
+// The number of write() system calls this process has made so far (Linux: /proc/self/io), so the
+// benchmarks can show how many an operation needs; false where it isn't available.
+bool countWriteSyscalls(uint64_t &writes)
+{
+    FILE *io = fopen("/proc/self/io", "r");
+    if (!io)
+        return false;
+    char line[128];
+    bool found = false;
+    while (!found && fgets(line, sizeof line, io))
+        found = sscanf(line, "syscw: %llu", (unsigned long long *)&writes) == 1;
+    fclose(io);
+    return found;
+}
+
+// Writes the collected results as CSV or JSON (the table is printed while running).
+void writeBenchmarkResults(const BenchmarkSuite &suite, FILE *out)
+{
+    if (suite.options.format == "csv")
+    {
+        fprintf(out, "name,size,median_ns,p99_ns,ops_per_sec,gb_per_sec,writes_per_op,repetitions\n");
+        for (const BenchmarkResult &result : suite.results)
+            fprintf(out, "%s,%d,%.3f,%.3f,%.0f,%.3f,%.3f,%d\n", result.name.c_str(), result.size, result.medianNs,
+                    result.p99Ns, 1e9 / result.medianNs, result.bytesPerOp / result.medianNs, result.writesPerOp,
+                    suite.options.repetitions);
+    }
+    else if (suite.options.format == "json")
+    {
+        fprintf(out, "{\n  \"warmup\": %d,\n  \"repetitions\": %d,\n  \"benchmarks\": [\n", suite.options.warmup,
+                suite.options.repetitions);
+        for (size_t i = 0; i < suite.results.size(); i++)
+        {
+            const BenchmarkResult &result = suite.results[i];
+            fprintf(out,
+                    "    {\"name\": \"%s\", \"size\": %d, \"median_ns\": %.3f, \"p99_ns\": %.3f, "
+                    "\"ops_per_sec\": %.0f, \"gb_per_sec\": %.3f, \"writes_per_op\": %.3f}%s\n",
+                    result.name.c_str(), result.size, result.medianNs, result.p99Ns, 1e9 / result.medianNs,
+                    result.bytesPerOp / result.medianNs, result.writesPerOp, i + 1 < suite.results.size() ? "," : "");
+        }
+        fprintf(out, "  ]\n}\n");
+    }
+}
+
+// A random non-negative BigNumber of exactly 'bits' bits (a multiple of 32).
+BigNumber randomBigNumber(mt19937_64 &rng, int bits)
+{
+    BigNumber value;
+    for (int i = 0; i < bits / 32; i++)
+        value.limbs.push_back((uint32_t)rng());
+    value.limbs.back() |= 0x80000000u;
+    return value;
+}
+
+#ifndef _WIN32
+/*
+Starts this program on a new pseudo-terminal (so it sees a terminal, as a user would), types
+'keys' and waits for the first ">> " prompt; returns the number of bytes drawn before it. The
+child is killed once the prompt is seen.
+*/
+uint64_t runToFirstPrompt(const char *option, const char *keys)
+{
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+        return 0;
+    string slaveName = ptsname(master);
+    pid_t child = fork();
+    if (child == 0)
+    {
+        setsid();
+        int slave = open(slaveName.c_str(), O_RDWR);
+        for (int fd = 0; fd < 3; fd++)
+            dup2(slave, fd);
+        close(slave);
+        close(master);
+        execl("/proc/self/exe", "modular_calculator", option, (char *)nullptr);
+        _exit(127);
+    }
+
+    if (write(master, keys, strlen(keys)) < 0)
+        keys = "";
+    string screen;
+    char buffer[4096];
+    while (child > 0 && screen.find(">> ") == string::npos)
+    {
+        ssize_t n = read(master, buffer, sizeof buffer);
+        if (n <= 0)
+            break;
+        screen.append(buffer, n);
+    }
+    if (child > 0)
+    {
+        kill(child, SIGKILL);
+        waitpid(child, nullptr, 0);
+    }
+    close(master);
+    return screen.size();
+}
+#endif
+
+/*
+Times every kernel on random inputs, for moduli of 8, 16, 32 and 63 bits and for big numbers:
+ - one modular multiplication through a native 64-bit '%' (only valid below 2^32), the 128-bit
+   mulMod() and the Barrett path,
+ - modular exponentiation: plain loop, Montgomery ladder, sliding window, fixed base and BigNumber,
+ - gcd (Euclid, binary, and Euclid against Lehmer on big numbers), extended gcd, linear
+   congruences and inverses (single, batch and BigNumber),
+ - CRT: incremental merge against Garner, and over BigNumber,
+ - primality (Miller-Rabin, Baillie-PSW) and the segmented sieve, Pollard-Brent factorization and
+   multiplicative orders,
+ - discrete logarithms (safe primes, smooth group orders) and square roots (Tonelli-Shanks,
+   Cipolla, p = 3 mod 4, composite moduli),
+ - the NTT (scalar and AVX2) and polynomial products (schoolbook against NTT),
+ - matrix products (lazy accumulation against a reduction per product) and linear recurrences
+   (companion matrix against Kitamasa),
+ - the UPC/ISBN validators and the popcount/parity kernels, with their throughput in GB/s,
+ - batch mode on 1, 2, 4, ... threads and with --metrics recording, and the result cache (misses
+   against hits),
+ - the screen renderer (a frame per screen against a write per piece, the ANSI clear against
+   starting clear) and the time to the first menu prompt on a pseudo-terminal.
+Variants of the same operation must agree; a disagreement fails the run.
+*/
+int runBenchmarks(const BenchmarkOptions &options)
+{
+    const int count = 20000; // operations per timed run
+    const int modBits[] = {8, 16, 32, 63};
+    vector<bigInt> bases(count), exponents(count);
+    mt19937_64 rng(12345);
+    BenchmarkSuite suite;
+    suite.options = options;
+
+    if (options.format == "table")
+        printf("%-30s %6s %12s %12s %14s %9s %9s\n", "benchmark", "size", "median ns/op", "p99 ns/op", "ops/sec", "GB/s",
+               "writes/op");
+    for (int bits : modBits)
+    {
+        bigInt m = (bigInt)(rng() >> (64 - bits)) | ((bigInt)1 << (bits - 1)) | 1;
+        for (int i = 0; i < count; i++)
+        {
+            bases[i] = rng() % m;
+            exponents[i] = rng() >> 1;
+        }
+
+        uBigInt mulSum = 0;
+        if (bits <= 32)
+        {
+            mulSum = measureBenchmark(suite, "mulmod/native64", bits, count, [&]() {
+                uBigInt sum = 0;
+                for (int i = 0; i < count; i++)
+                    sum += (uBigInt)bases[i] * (uBigInt)bases[count - 1 - i] % m;
+                return sum;
+            }, 0);
+        }
+        uBigInt wideSum = measureBenchmark(suite, "mulmod/int128", bits, count, [&]() {
+            uBigInt sum = 0;
+            for (int i = 0; i < count; i++)
+                sum += mulMod(bases[i], bases[count - 1 - i], m);
+            return sum;
+        }, 0);
+        BarrettContext barrett = makeBarrettContext(m);
+        uBigInt barrettSum = measureBenchmark(suite, "mulmod/barrett", bits, count, [&]() {
+            uBigInt sum = 0;
+            for (int i = 0; i < count; i++)
+                sum += barrettMulMod(barrett, bases[i], bases[count - 1 - i]);
+            return sum;
+        }, 0);
+        if (wideSum != barrettSum || (bits <= 32 && mulSum != wideSum))
+        {
+            fprintf(stderr, "mulmod variants disagree for m = %lld\n", m);
+            return 1;
+        }
+
+        uBigInt plainSum = measureBenchmark(suite, "modexp/plain", bits, count, [&]() {
+            uBigInt sum = 0;
+            for (int i = 0; i < count; i++)
+                sum += modularExponentiation(bases[i], exponents[i], m);
+            return sum;
+        }, 0);
+        MontgomeryContext ctx = makeMontgomeryContext(m);
+        uBigInt montSum = measureBenchmark(suite, "modexp/montgomery", bits, count, [&]() {
+            uBigInt sum = 0;
+            for (int i = 0; i < count; i++)
+                sum += montgomeryModPow(ctx, bases[i], exponents[i]);
+            return sum;
+        }, 0);
+        uBigInt slidingSum = measureBenchmark(suite, "modexp/sliding-window", bits, count, [&]() {
+            uBigInt sum = 0;
+            for (int i = 0; i < count; i++)
+                sum += slidingWindowModPow(ctx, bases[i], exponents[i]);
+            return sum;
+        }, 0);
+        FixedBaseContext fixed = makeFixedBaseContext(bases[0], m, 32 << 10);
+        uBigInt fixedSum = measureBenchmark(suite, "modexp/fixed-base", bits, count, [&]() {
+            uBigInt sum = 0;
+            for (int i = 0; i < count; i++)
+                sum += fixedBaseModPow(fixed, exponents[i]);
+            return sum;
+        }, 0);
+
+        for (int i = 0; i < count; i++)
+            fixedSum -= montgomeryModPow(ctx, bases[0], exponents[i]);
+        if (plainSum != montSum || slidingSum != montSum || fixedSum != 0)
+        {
+            fprintf(stderr, "modexp variants disagree for m = %lld\n", m);
+            return 1;
+        }
+    }
+
+    // Division-based Euclid against the binary gcd, the extended gcd loop and linear
+    // congruences modulo random (mostly composite) moduli.
+    for (int bits : modBits)
+    {
+        vector<bigInt> xs(count), ys(count), ms(count);
+        for (int i = 0; i < count; i++)
+        {
+            xs[i] = rng() >> (64 - bits);
+            ys[i] = rng() >> (64 - bits);
+            ms[i] = (bigInt)(rng() >> (64 - bits)) | ((bigInt)1 << (bits - 1));
+        }
+
+        uBigInt euclidSum = measureBenchmark(suite, "gcd/euclid", bits, count, [&]() {
+            uBigInt sum = 0;
+            for (int i = 0; i < count; i++)
+            {
+                bigInt a = xs[i], b = ys[i];
+                while (b != 0)
+                {
+                    bigInt r = a % b;
+                    a = b;
+                    b = r;
+                }
+                sum += a;
+            }
+            return sum;
+        }, 0);
+        uBigInt binarySum = measureBenchmark(suite, "gcd/binary", bits, count, [&]() {
+            uBigInt sum = 0;
+            for (int i = 0; i < count; i++)
+                sum += gcd(xs[i], ys[i]);
+            return sum;
+        }, 0);
+        uBigInt extendedSum = measureBenchmark(suite, "extgcd/iterative", bits, count, [&]() {
+            uBigInt sum = 0;
+            for (int i = 0; i < count; i++)
+            {
+                bigInt s, t;
+                sum += extendedGcd(xs[i], ys[i], s, t, false);
+            }
+            return sum;
+        }, 0);
+        if (euclidSum != binarySum || euclidSum != extendedSum)
+        {
+            fprintf(stderr, "gcd variants disagree for %d-bit inputs\n", bits);
+            return 1;
+        }
+
+        measureBenchmark(suite, "lincong", bits, count, [&]() {
+            uBigInt sum = 0;
+            for (int i = 0; i < count; i++)
+                sum += linearCongruence(xs[i], ys[i], ms[i]);
+            return sum;
+        }, 0);
+    }
+
+    // n separate inversions against one batch inversion of the same values, for the largest
+    // prime modulus of each size (so only zeros are not invertible).
+    const bigInt primeMods[] = {251, 65521, 4294967291LL, 9223372036854775783LL};
+    for (int k = 0; k < 4; k++)
+    {
+        int bits = modBits[k];
+        bigInt m = primeMods[k];
+        vector<bigInt> values(count);
+        for (int i = 0; i < count; i++)
+            values[i] = rng() % m;
+
+        vector<bigInt> single(count), batch;
+        measureBenchmark(suite, "inverse/single", bits, count, [&]() {
+            for (int i = 0; i < count; i++)
+                single[i] = modInverse(values[i], m);
+            return (uint64_t)single[count - 1];
+        }, 0);
+        measureBenchmark(suite, "inverse/batch", bits, count, [&]() {
+            batch = batchModInverse(values, m);
+            return (uint64_t)batch[count - 1];
+        }, 0);
+        if (single != batch)
+        {
+            fprintf(stderr, "inverse/batch disagrees with inverse/single for m = %lld\n", m);
+            return 1;
+        }
+    }
+
+    // CRT systems: 8 congruences modulo 7-bit primes (the product fits in 64 bits), then one
+    // system of 1000 congruences modulo 30-bit primes, solved with Garner's digits and with
+    // the incremental merge over BigNumber.
+    {
+        vector<bigInt> primes;
+        for (bigInt p = 127; primes.size() < 8; p -= 2)
+        {
+            bool isPrime = true;
+            for (bigInt d = 3; d * d <= p; d += 2)
+                isPrime = isPrime && p % d != 0;
+            if (isPrime)
+                primes.push_back(p);
+        }
+
+        const int systems = count / 8;
+        vector<bigInt> storage(systems * 16);
+        vector<bigInt *> rows(systems * 8);
+        for (int i = 0; i < systems * 8; i++)
+        {
+            storage[2 * i] = rng() % primes[i % 8];
+            storage[2 * i + 1] = primes[i % 8];
+            rows[i] = &storage[2 * i];
+        }
+
+        uBigInt incrementalSum = measureBenchmark(suite, "crt/incremental-k8", 7, systems, [&]() {
+            uBigInt sum = 0;
+            for (int i = 0; i < systems; i++)
+            {
+                bigInt M;
+                sum += chineseRemainderTheorem(&rows[8 * i], M, 8);
+            }
+            return sum;
+        }, 0);
+
+        vector<bigInt> digits;
+        bigInt M = 1;
+        for (int j = 0; j < 8; j++)
+            M *= primes[j];
+        uBigInt garnerSum = measureBenchmark(suite, "crt/garner-k8", 7, systems, [&]() {
+            uBigInt sum = 0;
+            for (int i = 0; i < systems; i++)
+            {
+                garnerCRT(&rows[8 * i], 8, digits);
+                sum += mixedRadixMod(digits, &rows[8 * i], M);
+            }
+            return sum;
+        }, 0);
+        if (incrementalSum != garnerSum)
+        {
+            fprintf(stderr, "crt/garner disagrees with crt/incremental\n");
+            return 1;
+        }
+
+        primes.clear();
+        for (bigInt p = (1LL << 30) - 1; primes.size() < 1000; p -= 2)
+        {
+            bool isPrime = true;
+            for (bigInt d = 3; d * d <= p && isPrime; d += 2)
+                isPrime = p % d != 0;
+            if (isPrime)
+                primes.push_back(p);
+        }
+        vector<bigInt> bigStorage(2000);
+        vector<bigInt *> bigRows(1000);
+        vector<BigNumber> numberStorage(2000);
+        vector<BigNumber *> numberRows(1000);
+        for (int i = 0; i < 1000; i++)
+        {
+            bigStorage[2 * i] = rng() % primes[i];
+            bigStorage[2 * i + 1] = primes[i];
+            bigRows[i] = &bigStorage[2 * i];
+            numberStorage[2 * i] = BigNumber(bigStorage[2 * i]);
+            numberStorage[2 * i + 1] = BigNumber(primes[i]);
+            numberRows[i] = &numberStorage[2 * i];
+        }
+
+        BigNumber garnerM, incrementalM, garnerX, incrementalX;
+        measureBenchmark(suite, "crt/garner-k1000", 30, 1, [&]() {
+            garnerCRT(bigRows.data(), 1000, digits);
+            garnerX = mixedRadixToBigNumber(digits, bigRows.data(), garnerM);
+            return (uint64_t)garnerX.limbs[0];
+        }, 0);
+        measureBenchmark(suite, "crt/incremental-bignum-k1000", 30, 1, [&]() {
+            incrementalX = chineseRemainderTheorem(numberRows.data(), incrementalM, 1000);
+            return (uint64_t)incrementalX.limbs[0];
+        }, 0);
+        if (garnerX != incrementalX || garnerM != incrementalM)
+        {
+            fprintf(stderr, "crt/garner-k1000 disagrees with crt/incremental-bignum-k1000\n");
+            return 1;
+        }
+    }
+
+    // Big numbers: textbook Euclid against Lehmer's algorithm, the extended gcd, inverses and
+    // linear congruences (through Lehmer's extended gcd).
+    const int gcdBits[] = {256, 1024, 4096};
+    for (int bits : gcdBits)
+    {
+        BigNumber x = randomBigNumber(rng, bits), y = randomBigNumber(rng, bits);
+        BigNumber m = randomBigNumber(rng, bits);
+        int reps = bits <= 1024 ? 20 : 2;
+
+        BigNumber euclid, lehmer;
+        measureBenchmark(suite, "gcd/bignum-euclid", bits, reps, [&]() {
+            for (int i = 0; i < reps; i++)
+            {
+                BigNumber a = x, b = y;
+                while (!b.isZero())
+                {
+                    BigNumber r = a % b;
+                    a = b;
+                    b = r;
+                }
+                euclid = a;
+            }
+            return (uint64_t)euclid.limbs[0];
+        }, 0);
+        measureBenchmark(suite, "gcd/bignum-lehmer", bits, reps, [&]() {
+            for (int i = 0; i < reps; i++)
+                lehmer = gcd(x, y);
+            return (uint64_t)lehmer.limbs[0];
+        }, 0);
+        if (euclid != lehmer)
+        {
+            fprintf(stderr, "gcd/bignum-lehmer disagrees with gcd/bignum-euclid for %d bits\n", bits);
+            return 1;
+        }
+
+        measureBenchmark(suite, "extgcd/bignum", bits, reps, [&]() {
+            BigNumber s, t, g;
+            for (int i = 0; i < reps; i++)
+                g = extendedGcd(x, y, s, t, false);
+            return (uint64_t)g.limbs[0];
+        }, 0);
+        measureBenchmark(suite, "inverse/bignum", bits, reps, [&]() {
+            BigNumber inv;
+            for (int i = 0; i < reps; i++)
+                inv = modInverse(x, m);
+            return inv.isZero() ? 0 : (uint64_t)inv.limbs[0];
+        }, 0);
+        measureBenchmark(suite, "lincong/bignum", bits, reps, [&]() {
+            BigNumber solution;
+            for (int i = 0; i < reps; i++)
+                solution = linearCongruence(x, y, m);
+            return solution.isZero() ? 0 : (uint64_t)solution.limbs[0];
+        }, 0);
+    }
+
+    // Full-size exponents against RSA-sized odd moduli.
+    const int bigBits[] = {1024, 2048, 4096};
+    for (int bits : bigBits)
+    {
+        BigNumber m = randomBigNumber(rng, bits), b = randomBigNumber(rng, bits), n = randomBigNumber(rng, bits);
+        m.limbs[0] |= 1;
+        b = b % m;
+
+        measureBenchmark(suite, "modexp/bignum", bits, 1, [&]() {
+            return (uint64_t)modularExponentiation(b, n, m).limbs[0];
+        }, 0);
+    }
+
+    // Primality: random odd 64-bit candidates (mostly rejected by trial division or the first
+    // base), 64-bit primes (every base runs), Baillie-PSW on big primes, and the segmented sieve.
+    {
+        vector<uBigInt> candidates(count), primes(count / 20);
+        for (uBigInt &candidate : candidates)
+            candidate = rng() | 1 | (1ULL << 63);
+        for (uBigInt &prime : primes)
+            prime = nextPrime(rng() | (1ULL << 63));
+        measureBenchmark(suite, "isprime/random64", 64, count, [&]() {
+            uint64_t found = 0;
+            for (uBigInt candidate : candidates)
+                found += isPrime(candidate);
+            return found;
+        }, 0);
+        uint64_t found = measureBenchmark(suite, "isprime/prime64", 64, primes.size(), [&]() {
+            uint64_t found = 0;
+            for (uBigInt prime : primes)
+                found += isPrime(prime);
+            return found;
+        }, 0);
+        if (found != primes.size())
+        {
+            fprintf(stderr, "isprime/prime64 rejected a prime\n");
+            return 1;
+        }
+    }
+
+    // Factorization of random 64-bit numbers (mostly small factors and one large prime) and of
+    // the hard case for rho, products of two 32-bit primes.
+    {
+        vector<uBigInt> randoms(count / 100), semiprimes(count / 1000);
+        for (uBigInt &value : randoms)
+            value = max<uBigInt>(rng(), 2);
+        for (uBigInt &value : semiprimes)
+            value = nextPrime(rng() >> 33 | (1ULL << 31)) * nextPrime(rng() >> 33 | (1ULL << 31));
+        measureBenchmark(suite, "factor/random64", 64, randoms.size(), [&]() {
+            uint64_t sum = 0;
+            for (uBigInt value : randoms)
+                sum += factorize(value).back().prime;
+            return sum;
+        }, 0);
+        measureBenchmark(suite, "factor/semiprime64", 64, semiprimes.size(), [&]() {
+            uint64_t sum = 0;
+            for (uBigInt value : semiprimes)
+                sum += factorize(value)[0].prime;
+            return sum;
+        }, 0);
+        measureBenchmark(suite, "order/random64", 64, randoms.size(), [&]() {
+            uint64_t sum = 0;
+            for (size_t i = 0; i < randoms.size(); i++)
+                sum += multiplicativeOrder(randoms[randoms.size() - 1 - i], randoms[i] | 1);
+            return sum;
+        }, 0);
+    }
+
+    // Discrete logarithms modulo safe primes p = 2q + 1 (Pohlig-Hellman can only split off the
+    // factor 2, so the time is baby-step giant-step on a group of order q, growing as sqrt(p)),
+    // and modulo a 62-bit prime with smooth p - 1. Every call builds its own table.
+    for (int bits = 16; bits <= 40; bits += 8)
+    {
+        uBigInt p;
+        do
+            p = 2 * nextPrime((rng() >> (65 - bits)) | (1ULL << (bits - 2))) + 1;
+        while (!isPrime(p));
+        uBigInt b = rng() % (p - 3) + 2, y = rng() % (p - 1) + 1;
+        measureBenchmark(suite, "dlog/safe-prime", bits, 1, [&]() {
+            BabyStepTable table;
+            return (uint64_t)discreteLog(b, y, p, table, 64 << 20);
+        }, 0);
+    }
+    {
+        uBigInt p = 1;
+        while (p == 1 || !isPrime(p))
+        {
+            p = 2;
+            for (uBigInt q = smallOddPrimes()[rng() % 100]; p <= (1ULL << 62) / q; q = smallOddPrimes()[rng() % 100])
+                p *= q;
+            p++;
+        }
+        uBigInt b = rng() % (p - 3) + 2, y = modPow64(makeMontgomeryContext(p), b, rng());
+        measureBenchmark(suite, "dlog/smooth-order", (int)numberBitLength((bigInt)p), 1, [&]() {
+            BabyStepTable table;
+            return (uint64_t)discreteLog(b, y, p, table, 64 << 20);
+        }, 0);
+    }
+
+    // Square roots modulo a 62-bit prime p = k * 2^s + 1 for growing s, where Tonelli-Shanks
+    // pays s^2 squarings and Cipolla stays flat (size: s; the two must agree up to sign), then
+    // the p = 3 (mod 4) closed form and all roots modulo a squarefree 60-bit composite.
+    {
+        const int twoPowers[] = {8, 24, 40};
+        for (int s : twoPowers)
+        {
+            uBigInt p;
+            do
+                p = ((rng() >> (s + 2)) << s | (1ULL << 61) | (1ULL << s)) + 1;
+            while (countTrailingZeros(p - 1) != s || !isPrime(p));
+            MontgomeryContext ctx = makeMontgomeryContext(p);
+            vector<uBigInt> squares(count / 100);
+            for (uBigInt &square : squares)
+                square = mulMod(rng() % (p - 1) + 1, rng() % (p - 1) + 1, p), square = mulMod(square, square, p);
+            auto canonical = [p](uBigInt root) { return min(root, p - root); };
+            uint64_t tonelli = measureBenchmark(suite, "sqrt/tonelli-shanks", s, squares.size(), [&]() {
+                uint64_t sum = 0;
+                for (uBigInt square : squares)
+                    sum += canonical(tonelliShanks(ctx, square));
+                return sum;
+            }, 0);
+            uint64_t cipollaSum = measureBenchmark(suite, "sqrt/cipolla", s, squares.size(), [&]() {
+                uint64_t sum = 0;
+                for (uBigInt square : squares)
+                    sum += canonical(cipolla(ctx, square));
+                return sum;
+            }, 0);
+            if (tonelli != cipollaSum)
+            {
+                fprintf(stderr, "sqrt/tonelli-shanks and sqrt/cipolla disagree\n");
+                return 1;
+            }
+        }
+
+        uBigInt p;
+        do
+            p = rng() >> 2 | (1ULL << 61) | 3;
+        while (!isPrime(p));
+        MontgomeryContext ctx = makeMontgomeryContext(p);
+        vector<uBigInt> values(count / 10);
+        for (uBigInt &value : values)
+            value = rng() % p;
+        measureBenchmark(suite, "sqrt/p3mod4", 62, values.size(), [&]() {
+            uint64_t sum = 0;
+            for (uBigInt value : values)
+            {
+                uBigInt root;
+                sum += sqrtModPrime(ctx, value, root) ? root : 1;
+            }
+            return sum;
+        }, 0);
+
+        bigInt m = 1;
+        for (int i = 0; i < 6; i++)
+            m *= nextPrime((rng() >> 55) | (1ULL << 9));
+        vector<PrimeFactor> factors = factorize(m);
+        SquareRootSet roots;
+        measureBenchmark(suite, "sqrt/composite", (int)numberBitLength(m), values.size(), [&]() {
+            uint64_t sum = 0;
+            for (uBigInt value : values)
+            {
+                uBigInt x = value % m;
+                if (sqrtMod(mulMod(x, x, m), m, roots, &factors))
+                    sum += roots.residues.size();
+            }
+            return sum;
+        }, 0);
+    }
+    // Number-theoretic transforms of 2^log values modulo 998244353 (size: log), scalar against
+    // AVX2, then polynomial products of two length-2^log polynomials: schoolbook against NTT for
+    // an NTT prime modulus (used directly), a 31-bit one (three CRT primes) and a 61-bit one
+    // (five or six); every size both run at must give the same product.
+    {
+        vector<pair<string, NttKernel>> kernels = {{"scalar", nttScalar}};
+#if HAS_X86_SIMD
+        if (__builtin_cpu_supports("avx2"))
+            kernels.push_back({"avx2", nttAVX2});
+#endif
+        NttPrime prime = makeNttPrime(998244353);
+        const int transformLogs[] = {10, 16, 20};
+        for (int log : transformLogs)
+        {
+            prepareNttPrime(prime, log);
+            vector<uint32_t> data((size_t)1 << log);
+            for (uint32_t &x : data)
+                x = rng() % prime.p;
+            vector<uint64_t> checksums;
+            for (auto &kernel : kernels)
+            {
+                vector<uint32_t> work = data;
+                checksums.push_back(measureBenchmark(suite, "ntt/" + kernel.first, log, 1, [&]() {
+                    kernel.second(work.data(), log, prime, false);
+                    uint64_t sum = 0;
+                    for (uint32_t x : work)
+                        sum += x % prime.p;
+                    return sum;
+                }, 0));
+            }
+            if (std::count(checksums.begin(), checksums.end(), checksums[0]) != (ptrdiff_t)checksums.size())
+            {
+                fprintf(stderr, "ntt kernels disagree\n");
+                return 1;
+            }
+        }
+
+        const pair<const char *, uBigInt> moduli[] = {{"m30", 998244353}, {"m31", 2147483647}, {"m61", (1ULL << 61) - 1}};
+        const int productLogs[] = {8, 10, 12, 16, 20};
+        NttEngine engine;
+        for (auto &modulus : moduli)
+        {
+            uBigInt m = modulus.second;
+            for (int log : productLogs)
+            {
+                vector<uBigInt> a((size_t)1 << log), b((size_t)1 << log), product;
+                for (size_t i = 0; i < a.size(); i++)
+                {
+                    a[i] = rng() % m;
+                    b[i] = rng() % m;
+                }
+                uint64_t naive = 0, fast = 0;
+                bool naiveRuns = log <= (m >> 32 ? 10 : 12);
+                if (naiveRuns)
+                    naive = measureBenchmark(suite, string("polymul/naive/") + modulus.first, log, 1, [&]() {
+                        vector<uBigInt> result = multiplyPolynomialsNaive(a, b, m);
+                        return accumulate(result.begin(), result.end(), (uint64_t)0);
+                    }, 0);
+                fast = measureBenchmark(suite, string("polymul/ntt/") + modulus.first, log, 1, [&]() {
+                    multiplyPolynomials(engine, a, b, m, product);
+                    return accumulate(product.begin(), product.end(), (uint64_t)0);
+                }, 0);
+                if (naiveRuns && naive != fast)
+                {
+                    fprintf(stderr, "polymul/ntt/%s disagrees with the schoolbook product\n", modulus.first);
+                    return 1;
+                }
+            }
+        }
+    }
+    // Matrix products over a 31-bit and a 61-bit modulus (size: k): lazily reduced 128-bit sums
+    // against one mulMod per product, which must agree. Then linear recurrences of order k at
+    // n ~ 2^60: companion matrix powers against Kitamasa's method, schoolbook and with NTT
+    // products, each for the orders where it is within reach; all must give the same a_n.
+    {
+        const uBigInt moduli[] = {2147483647, (1ULL << 61) - 1};
+        const int orders[] = {32, 128};
+        for (uBigInt m : moduli)
+            for (int k : orders)
+            {
+                ModMatrix a = identityMatrix(k, m), b = identityMatrix(k, m);
+                for (uBigInt &x : a.entries)
+                    x = rng() % m;
+                for (uBigInt &x : b.entries)
+                    x = rng() % m;
+                string suffix = m >> 32 ? "/m61" : "/m31";
+                uint64_t lazy = measureBenchmark(suite, "matmul/lazy" + suffix, k, 1, [&]() {
+                    ModMatrix product = multiplyMatrices(a, b);
+                    return accumulate(product.entries.begin(), product.entries.end(), (uint64_t)0);
+                }, 0);
+                uint64_t eager = measureBenchmark(suite, "matmul/mulmod" + suffix, k, 1, [&]() {
+                    vector<uBigInt> product(k * k, 0);
+                    for (int i = 0; i < k; i++)
+                        for (int t = 0; t < k; t++)
+                            for (int j = 0; j < k; j++)
+                                product[i * k + j] = addMod(product[i * k + j], mulMod(a.entries[i * k + t], b.entries[t * k + j], m), m);
+                    return accumulate(product.begin(), product.end(), (uint64_t)0);
+                }, 0);
+                if (lazy != eager)
+                {
+                    fprintf(stderr, "matmul/lazy disagrees with matmul/mulmod\n");
+                    return 1;
+                }
+            }
+
+        const uBigInt m = 998244353, n = rng() >> 4;
+        const int recurrenceOrders[] = {2, 8, 32, 64, 128, 512, 2048};
+        for (int k : recurrenceOrders)
+        {
+            vector<uBigInt> coefficients(k), initial(k);
+            for (int i = 0; i < k; i++)
+            {
+                coefficients[i] = rng() % m;
+                initial[i] = rng() % m;
+            }
+            vector<uint64_t> values;
+            if (k <= 32)
+                values.push_back(measureBenchmark(suite, "linrec/matrix", k, 1, [&]() {
+                    return (uint64_t)linearRecurrenceMatrix(coefficients, initial, n, m);
+                }, 0));
+            values.push_back(measureBenchmark(suite, k < (int)KITAMASA_NTT_ORDER ? "linrec/kitamasa" : "linrec/kitamasa-ntt", k, 1, [&]() {
+                return (uint64_t)linearRecurrenceKitamasa(coefficients, initial, n, m);
+            }, 0));
+            if (std::count(values.begin(), values.end(), values[0]) != (ptrdiff_t)values.size())
+            {
+                fprintf(stderr, "linrec/matrix and linrec/kitamasa disagree\n");
+                return 1;
+            }
+        }
+    }
+    const int primeBits[] = {128, 256, 1024};
+    for (int bits : primeBits)
+    {
+        BigNumber prime = nextPrime(randomBigNumber(rng, bits));
+        measureBenchmark(suite, "isprime/bpsw", bits, 1, [&]() {
+            return (uint64_t)isPrime(prime);
+        }, 0);
+    }
+    {
+        const uBigInt lo = 1000000000000ULL, span = 1 << 22;
+        FILE *sink = fopen("/dev/null", "w");
+        if (sink)
+        {
+            measureBenchmark(suite, "sieve/segmented", 40, span, [&]() {
+                return (uint64_t)runPrimeSieve(lo, lo + span - 1, sink);
+            }, 0);
+            fclose(sink);
+        }
+    }
+
+    // Barcode validation kernels over one in-memory buffer of valid codes, one per line
+    // (size: digits per code).
+    const BarcodeFormat *formats[] = {&UPC_FORMAT, &ISBN10_FORMAT};
+    for (const BarcodeFormat *format : formats)
+    {
+        const int codes = 1 << 18;
+        string text;
+        text.reserve((size_t)codes * (format->length + 1));
+        for (int i = 0; i < codes; i++)
+        {
+            string code;
+            for (int j = 0; j < format->length - 1; j++)
+                code += (char)('0' + rng() % 10);
+            int sum = barcodeWeightedSum(code, *format);
+            int check = 0;
+            while ((sum + format->weights[format->length - 1] * check) % format->modulus != 0)
+                check++;
+            text += code + (check == 10 ? 'X' : (char)('0' + check)) + '\n';
+        }
+
+        vector<pair<string, BarcodeKernel>> kernels = {{"scalar", validateBarcodesScalar}};
+#if HAS_X86_SIMD
+        if (__builtin_cpu_supports("sse2"))
+            kernels.push_back({"sse2", validateBarcodesSSE2});
+        if (__builtin_cpu_supports("avx2"))
+            kernels.push_back({"avx2", validateBarcodesAVX2});
+#endif
+        for (auto &kernel : kernels)
+        {
+            uint64_t valid = measureBenchmark(suite, string(format->name) + "/" + kernel.first, format->length, codes, [&]() {
+                BarcodeStats stats;
+                validateBarcodeBlock(text.data(), text.data() + text.size(), true, *format, kernel.second, stats, nullptr);
+                return (uint64_t)stats.valid;
+            }, format->length + 1);
+            if (valid != (uint64_t)codes)
+            {
+                fprintf(stderr, "%s/%s rejected valid codes\n", format->name, kernel.first.c_str());
+                return 1;
+            }
+        }
+    }
+
+    // Popcount kernels over a 1 MiB buffer (in cache, so this is the kernel and not memory
+    // bandwidth), then per-block parity with the selected kernel (size: block bits).
+    {
+        const size_t words = 1 << 17;
+        vector<uint64_t> data(words);
+        for (uint64_t &word : data)
+            word = rng();
+        const unsigned char *bytes = (const unsigned char *)data.data();
+
+        vector<pair<string, PopcountKernel>> kernels = {{"popcount/scalar", popcountScalar}};
+#if HAS_X86_SIMD
+        if (__builtin_cpu_supports("popcnt"))
+            kernels.push_back({"popcount/popcnt", popcountPopcnt});
+        if (__builtin_cpu_supports("avx2"))
+            kernels.push_back({"popcount/avx2", popcountAVX2});
+        if (__builtin_cpu_supports("avx512vpopcntdq"))
+            kernels.push_back({"popcount/avx512-vpopcntdq", popcountAVX512});
+#endif
+        uint64_t expected = popcountScalar(bytes, words);
+        for (auto &kernel : kernels)
+        {
+            uint64_t ones = measureBenchmark(suite, kernel.first, 64, words, [&]() {
+                return kernel.second(bytes, words);
+            }, 8);
+            if (ones != expected)
+            {
+                fprintf(stderr, "%s disagrees with popcount/scalar\n", kernel.first.c_str());
+                return 1;
+            }
+        }
+
+        const size_t blockSizes[] = {1, 8, 64, 7, 4096};
+        for (size_t block : blockSizes)
+        {
+            ParityEngine engine;
+            engine.kernel = selectPopcountKernel();
+            engine.blockBits = block;
+            engine.parities.reserve(words / block + 1);
+            uint64_t ones = measureBenchmark(suite, "parity/blocks", (int)block, words, [&]() {
+                engine.ones = 0;
+                engine.parities.clear();
+                feedParity(engine, bytes, 64 * words);
+                return engine.ones;
+            }, 8);
+            if (ones != expected)
+            {
+                fprintf(stderr, "parity/blocks miscounted the ones for %d-bit blocks\n", (int)block);
+                return 1;
+            }
+        }
+    }
+
+    // Batch mode scaling: the same mixed job (modexp, inv and crt lines with 63-bit moduli) on
+    // 1, 2, 4, ... worker threads up to the number of cores (size: threads).
+    {
+        const int lines = 1 << 15;
+        string jobs;
+        for (int i = 0; i < lines; i++)
+        {
+            bigInt m = (bigInt)(rng() >> 1) | 1;
+            if (i % 4 == 3)
+                jobs += "crt " + to_string(rng() % 1000003) + " 1000003 " + to_string(rng() % 998244353) + " 998244353\n";
+            else if (i % 4 == 2)
+                jobs += "inv " + to_string(rng() % m) + " " + to_string(m) + "\n";
+            else
+                jobs += "modexp " + to_string(rng() % m) + " " + to_string(rng() >> 1) + " " + to_string(m) + "\n";
+        }
+
+        int cores = max(1, (int)thread::hardware_concurrency());
+        uint64_t singleThread = 0;
+        for (int threads = 1;; threads = min(2 * threads, cores))
+        {
+            WorkStealingPool pool;
+            startWorkers(pool, threads);
+            vector<BatchState> states(threads);
+            vector<string> outputs;
+            uint64_t checksum = measureBenchmark(suite, "batch/threads", threads, lines, [&]() {
+                runBatchChunks(pool, states, outputs, jobs.data(), jobs.data() + jobs.size(), true, nullptr,
+                               processBatchLine);
+                return (uint64_t)outputs[0].size();
+            }, (double)jobs.size() / lines);
+            stopWorkers(pool);
+            if (threads == 1)
+                singleThread = checksum;
+            if (threads == cores)
+                break;
+        }
+
+        // The same job on one thread while --metrics records every line: the cost of the
+        // instrumentation (two clock reads and a histogram update per operation).
+        if constexpr (METRICS_ENABLED)
+        {
+            WorkStealingPool pool;
+            startWorkers(pool, 1);
+            vector<BatchState> states(1);
+            vector<string> outputs;
+            metrics.active = true;
+            uint64_t checksum = measureBenchmark(suite, "batch/metrics", 1, lines, [&]() {
+                runBatchChunks(pool, states, outputs, jobs.data(), jobs.data() + jobs.size(), true, nullptr,
+                               processBatchLine);
+                return (uint64_t)outputs[0].size();
+            }, (double)jobs.size() / lines);
+            metrics.active = false;
+            stopWorkers(pool);
+            if (checksum != singleThread)
+            {
+                fprintf(stderr, "batch/metrics changed the output\n");
+                return 1;
+            }
+        }
+    }
+
+    {
+        // The result cache in front of modexp on 63-bit moduli: misses (lookup, Montgomery
+        // exponentiation, insert; every run uses new exponents) against the last run's keys again,
+        // which hit unless a full set evicted them.
+        const size_t cacheMemory = 8 << 20;
+        ResultCache cache;
+        configureResultCache(cache, cacheMemory);
+        bigInt m = (bigInt)(rng() >> 1) | 1;
+        MontgomeryContext ctx = makeMontgomeryContext(m);
+        vector<bigInt> values(count);
+        for (int i = 0; i < count; i++)
+            values[i] = rng() % m;
+        bigInt salt = 0;
+        auto exponent = [&](int i) { return (values[count - 1 - i] ^ salt) & LLONG_MAX; };
+        auto run = [&]() {
+            uBigInt sum = 0;
+            for (int i = 0; i < count; i++)
+            {
+                bigInt value;
+                if (!lookupResult(cache, CACHE_MODEXP, values[i], exponent(i), m, value))
+                {
+                    value = montgomeryModPow(ctx, values[i], exponent(i));
+                    storeResult(cache, CACHE_MODEXP, values[i], exponent(i), m, value);
+                }
+                sum += value;
+            }
+            return sum;
+        };
+        uBigInt missSum = measureBenchmark(suite, "memo/modexp-miss", 63, count, [&]() {
+            salt = rng() >> 1;
+            return run();
+        }, 0);
+        uBigInt hitSum = measureBenchmark(suite, "memo/modexp-hit", 63, count, run, 0);
+        if (hitSum != missSum)
+        {
+            fprintf(stderr, "memo/modexp mismatch: the cached results differ from the computed ones\n");
+            return 1;
+        }
+    }
+
+#ifndef _WIN32
+    {
+        // Screens drawn into /dev/null: one frame (one write) per screen against writing every
+        // insertion as it comes, which is what flushing each character and line used to cost, and
+        // the ANSI clear against starting clear(1).
+        FrameBuffer renderer;
+        renderer.fd = open("/dev/null", O_WRONLY);
+        streambuf *console = cout.rdbuf(&renderer);
+        string options[] = {"Modular exponentiation (b^n mod m)", "Modular inverse (a^-1 mod m)",
+                            "Solve linear congruence ax ≡ b (mod m)", "Chinese Remainder Theorem",
+                            "Applications of congruences", "Number theory tools", "Run sample tests", "Exit program"};
+        string desc = "A modular square root of a is any x with\nx² ≡ a (mod m). For a prime m there are at most\n"
+                      "two (Tonelli-Shanks or Cipolla's algorithm);\nfor a composite m the roots modulo each prime\n"
+                      "power are lifted with Hensel's lemma and joined\nwith the Chinese Remainder Theorem.";
+        for (bool writeThrough : {false, true})
+        {
+            renderer.writeThrough = writeThrough;
+            const char *suffix = writeThrough ? "-unbuffered" : "";
+            measureBenchmark(suite, string("render/menu") + suffix, 0, 1, [&]() {
+                drawMenu(options, 8, "Main Menu");
+                cout.flush();
+                return (uint64_t)1;
+            }, 0);
+            measureBenchmark(suite, string("render/intro") + suffix, 0, 1, [&]() {
+                showScreenIntro("Modular Square Root", desc);
+                cout.flush();
+                return (uint64_t)1;
+            }, 0);
+        }
+        renderer.writeThrough = false;
+        measureBenchmark(suite, "render/clear-ansi", 0, 1, []() {
+            clearScreen();
+            cout.flush();
+            return (uint64_t)1;
+        }, 0);
+        measureBenchmark(suite, "render/clear-process", 0, 1, []() {
+            return (uint64_t)system("clear > /dev/null 2>&1");
+        }, 0);
+        cout.rdbuf(console);
+        close(renderer.fd);
+    }
+
+    // Time to the first prompt of the interactive menu, process start included: with animations
+    // off, and with animations on but skipped by a key that is already waiting.
+    measureBenchmark(suite, "startup/fast", 0, 1, []() { return runToFirstPrompt("--fast", ""); }, 0);
+    measureBenchmark(suite, "startup/key-skip", 0, 1, []() { return runToFirstPrompt(nullptr, "\n"); }, 0);
+#endif
+
+    writeBenchmarkResults(suite, stdout);
+    return 0;
+}
+
+// ************ Thread Pool Functions ******************
+
+// Starts threads - 1 workers; the caller of runOnPool() is worker 0.
+void startWorkers(WorkStealingPool &pool, int threads)
+{
+    for (int i = 0; i < threads; i++)
+        pool.queues.emplace_back(new WorkQueue);
+    for (int i = 1; i < threads; i++)
+        pool.threads.emplace_back(workerLoop, ref(pool), i);
+}
+
+void stopWorkers(WorkStealingPool &pool)
+{
+    {
+        lock_guard<mutex> guard(pool.lock);
+        pool.stopping = true;
+    }
+    pool.wake.notify_all();
+    for (thread &worker : pool.threads)
+        worker.join();
+    pool.threads.clear();
+}
+
+// Sleeps until a job is posted, helps with it until no task is left anywhere, and repeats.
+void workerLoop(WorkStealingPool &pool, int worker)
+{
+    uint64_t seen = 0;
+    while (true)
+    {
+        {
+            unique_lock<mutex> guard(pool.lock);
+            pool.wake.wait(guard, [&]() { return pool.stopping || pool.generation != seen; });
+            if (pool.stopping)
+                return;
+            seen = pool.generation;
+        }
+        drainTasks(pool, worker);
+    }
+}
+
+// Takes the newest task of the worker's own queue, or else steals the oldest task of another one.
+bool takeTask(WorkStealingPool &pool, int worker, size_t &task)
+{
+    int n = pool.queues.size();
+    for (int k = 0; k < n; k++)
+    {
+        WorkQueue &queue = *pool.queues[(worker + k) % n];
+        lock_guard<mutex> guard(queue.lock);
+        if (queue.tasks.empty())
+            continue;
+        if (k == 0)
+        {
+            task = queue.tasks.back();
+            queue.tasks.pop_back();
+        }
+        else
+        {
+            task = queue.tasks.front();
+            queue.tasks.pop_front();
+        }
+        return true;
+    }
+    return false;
+}
+
+void drainTasks(WorkStealingPool &pool, int worker)
+{
+    size_t task;
+    while (takeTask(pool, worker, task))
+    {
+        (*pool.body)(task, worker);
+        if (pool.remaining.fetch_sub(1) == 1)
+        {
+            lock_guard<mutex> guard(pool.lock);
+            pool.done.notify_all();
+        }
+    }
+}
+
+/*
+Runs body(task, worker) for every task in [0, count) and returns once all of them are done.
+Each worker is dealt a contiguous range of tasks (in reverse, so that popping from the back runs
+them in order) and steals when it runs out.
+*/
+void runOnPool(WorkStealingPool &pool, size_t count, const function<void(size_t, int)> &body)
+{
+    if (count == 0)
+        return;
+
+    // The job must be in place before any task becomes visible: a worker still looking for
+    // tasks of the previous job may take one as soon as it is queued.
+    pool.body = &body;
+    pool.remaining = count;
+    size_t n = pool.queues.size();
+    for (size_t w = 0; w < n; w++)
+    {
+        lock_guard<mutex> guard(pool.queues[w]->lock);
+        for (size_t task = (w + 1) * count / n; task > w * count / n; task--)
+            pool.queues[w]->tasks.push_back(task - 1);
+    }
+    {
+        lock_guard<mutex> guard(pool.lock);
+        pool.generation++;
+    }
+    pool.wake.notify_all();
+
+    drainTasks(pool, 0);
+    unique_lock<mutex> guard(pool.lock);
+    pool.done.wait(guard, [&]() { return pool.remaining == 0; });
+}
+
+// ************ Batch Mode Functions ******************
+
+// Handles the non-interactive command line options.
+//
+// Args:
+//   argc, argv: The arguments given to main().
+// Returns:
+//   The process exit code.
+int runCommandLine(int argc, char *argv[])
+{
+    string inputPath = "-";
+    bool batch = false;
+    BatchOptions options;
+    ValidateOptions validateOptions;
+    ParityOptions parityOptions;
+    bool parity = false;
+    BenchmarkOptions benchOptions;
+    bool bench = false;
+    bool primeRange = false;
+    uBigInt primesFrom = 0, primesTo = 0;
+    string serveEndpoint;
+    LoadTestOptions loadOptions;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--batch")
+        {
+            batch = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+                inputPath = argv[++i];
+            else if (i + 1 < argc && string(argv[i + 1]) == "-")
+                i++;
+        }
+        else if (arg == "--filter-primes")
+            batch = options.filterPrimes = true;
+        else if (arg == "--primes" && i + 2 < argc)
+        {
+            primeRange = true;
+            primesFrom = strtoull(argv[++i], nullptr, 10);
+            primesTo = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--validate" && i + 1 < argc)
+        {
+            string type = argv[++i];
+            if (type == "upc")
+                validateOptions.format = &UPC_FORMAT;
+            else if (type == "isbn")
+                validateOptions.format = &ISBN10_FORMAT;
+            else
+            {
+                fprintf(stderr, "Unknown code type '%s'\n", type.c_str());
+                printUsage();
+                return 2;
+            }
+        }
+        else if (arg == "--parity")
+            parity = true;
+        else if (arg == "--block-bits" && i + 1 < argc)
+            parityOptions.blockBits = strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--verify-parity" && i + 1 < argc)
+            parityOptions.verifyPath = argv[++i];
+        else if (arg == "--summary")
+            options.summary = validateOptions.summary = parityOptions.summary = true;
+        else if (arg == "--threads" && i + 1 < argc)
+            options.threads = max(0, atoi(argv[++i]));
+        else if (arg == "--fixed-base-memory" && i + 1 < argc)
+            options.fixedBaseMemory = strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--dlog-memory" && i + 1 < argc)
+            options.dlogMemory = strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--cache-memory" && i + 1 < argc)
+            options.cacheMemory = strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--metrics" && i + 1 < argc)
+        {
+            options.metricsFormat = argv[++i];
+            if (options.metricsFormat != "json" && options.metricsFormat != "prometheus")
+            {
+                fprintf(stderr, "Unknown metrics format '%s'\n", argv[i]);
+                printUsage();
+                return 2;
+            }
+            if (!METRICS_ENABLED)
+            {
+                fprintf(stderr, "This build has no metrics (it was compiled with -DNDEBUG or -DCALC_METRICS=0)\n");
+                return 2;
+            }
+        }
+        else if (arg == "--serve" && i + 1 < argc)
+            serveEndpoint = argv[++i];
+        else if (arg == "--load-test" && i + 1 < argc)
+            loadOptions.endpoint = argv[++i];
+        else if (arg == "--connections" && i + 1 < argc)
+            loadOptions.connections = max(1, atoi(argv[++i]));
+        else if (arg == "--pipeline" && i + 1 < argc)
+            loadOptions.pipeline = max(1, atoi(argv[++i]));
+        else if (arg == "--requests" && i + 1 < argc)
+            loadOptions.requests = max(1LL, atoll(argv[++i]));
+        else if (arg == "--no-animation" || arg == "--fast")
+            continue; // only used by the interactive menu (see main())
+        else if (arg == "--bench")
+            bench = true;
+        else if (arg == "--bench-format" && i + 1 < argc)
+        {
+            benchOptions.format = argv[++i];
+            if (benchOptions.format != "table" && benchOptions.format != "csv" && benchOptions.format != "json")
+            {
+                fprintf(stderr, "Unknown benchmark format '%s'\n", argv[i]);
+                printUsage();
+                return 2;
+            }
+        }
+        else if (arg == "--bench-reps" && i + 1 < argc)
+            benchOptions.repetitions = max(1, atoi(argv[++i]));
+        else if (arg == "--bench-warmup" && i + 1 < argc)
+            benchOptions.warmup = max(0, atoi(argv[++i]));
+        else if ((arg[0] != '-' || arg == "-") && (batch || validateOptions.format || parity))
+            inputPath = arg;
+        else if (arg == "--help" || arg == "-h")
+        {
+            printUsage();
+            return 0;
+        }
+        else
+        {
+            fprintf(stderr, "Unknown option '%s'\n", argv[i]);
+            printUsage();
+            return 2;
+        }
+    }
+
+    if (bench)
+        return runBenchmarks(benchOptions);
+    if (!serveEndpoint.empty())
+        return runServer(serveEndpoint, options);
+    if (!loadOptions.endpoint.empty())
+        return runLoadTest(loadOptions);
+    if (primeRange)
+        return runPrimeSieve(primesFrom, primesTo, stdout);
+    if (validateOptions.format)
+        return runBarcodeValidation(inputPath, stdout, validateOptions);
+    if (parity && !parityOptions.verifyPath.empty() && parityOptions.blockBits == 0)
+    {
+        // The stored file holds packed block parities; without the block size there is nothing to compare.
+        fprintf(stderr, "--verify-parity needs the --block-bits the parity file was written with\n");
+        printUsage();
+        return 2;
+    }
+    if (parity)
+        return runParity(inputPath, stdout, parityOptions);
+    if (!batch)
+    {
+        printUsage();
+        return 2;
+    }
+
+    return runBatchMode(inputPath, stdout, options);
+}
+
+void printUsage()
+{
+    fprintf(stderr,
+            "Usage:\n"
+            "  modular_calculator [--fast]             interactive menu (--fast or --no-animation: no loading\n"
+            "                                          screen or typing effects; also off when not on a terminal)\n"
+            "  modular_calculator --batch [file|-]     run one operation per line (default: stdin)\n"
+            "  modular_calculator --validate upc|isbn [file|-]\n"
+            "                                          check one UPC-A / ISBN-10 code per line and print\n"
+            "                                          the failing ones as 'line:code'\n"
+            "  modular_calculator --parity [file|-]    parity of a raw binary file (bit i = bit i mod 8 of byte i/8)\n"
+            "  modular_calculator --filter-primes [file|-]\n"
+            "                                          copy the lines holding a prime number (one number per line)\n"
+            "  modular_calculator --primes LO HI       print the primes in [LO, HI], one per line\n"
+            "  modular_calculator --bench              time the math kernels (median/p99 ns per operation)\n"
+            "  modular_calculator --serve PATH|PORT    answer binary requests on a Unix socket, or on 127.0.0.1:PORT\n"
+            "  modular_calculator --load-test PATH|PORT\n"
+            "                                          send a request mix to a server; print throughput and latency\n"
+            "\n"
+            "Options:\n"
+            "  --summary                               print line/error counts to stderr when done\n"
+            "                                          (--validate: print only the counts)\n"
+            "  --block-bits N                          --parity: write one parity bit per N-bit block, packed\n"
+            "                                          8 per byte, instead of the parity of the whole input\n"
+            "  --verify-parity FILE                    --parity: compare the block parities with FILE and print\n"
+            "                                          the indices of the blocks that differ (needs --block-bits)\n"
+            "  --bench-format table|csv|json           --bench: output format (default table)\n"
+            "  --bench-reps N                          --bench: timed runs per kernel (default 15)\n"
+            "  --bench-warmup N                        --bench: untimed runs first (default 2)\n"
+            "  --fixed-base-memory BYTES               table size for repeated modexp bases (default 32768)\n"
+            "  --dlog-memory BYTES                     baby-step table size for dlog (default 64 MiB)\n"
+            "  --cache-memory BYTES                    remember modexp/inv results in a cache of this size\n"
+            "                                          (--batch, --serve and the menu; default 0: off)\n"
+            "  --metrics json|prometheus               --batch, --filter-primes, --serve: per-operation calls, errors\n"
+            "                                          and latency histograms, Euclid steps and 64-bit overflow\n"
+            "                                          fallbacks, written to stderr at the end and on SIGUSR1\n"
+            "  --threads N                             --batch, --filter-primes, --serve: worker threads (default:\n"
+            "                                          one per core)\n"
+            "  --connections N                         --load-test: connections, one thread each (default 4)\n"
+            "  --pipeline N                            --load-test: requests in flight per connection (default 32)\n"
+            "  --requests N                            --load-test: requests per connection (default 100000)\n"
+            "\n"
+            "Batch operations (one per line, '#' starts a comment):\n"
+            "  modexp b n m                            b^n mod m\n"
+            "  inv a m                                 a^-1 mod m, or 'none'\n"
+            "  lincong a b m [limit]                   x with ax = b (mod m/g), or 'none'; with a limit, every\n"
+            "                                          solution mod m as 'count: x1 x2 ...', listing at most\n"
+            "                                          'limit' of them and then '... last'\n"
+            "  batchinv m a1 a2 ...                    ai^-1 mod m for every ai ('none' if not invertible)\n"
+            "  crt a1 m1 a2 m2 ...                     'x M' with x = ai (mod mi) and M the lcm of the mi,\n"
+            "                                          or 'none i j' when equations i and j contradict\n"
+            "  isprime n                               'prime' or 'not prime' (exact below 2^64, Baillie-PSW above)\n"
+            "  nextprime n                             the smallest prime above n\n"
+            "  factor n                                prime factorization as 'p^e q ...' (n < 2^64)\n"
+            "  totient n                               Euler's phi(n)\n"
+            "  carmichael n                            Carmichael's lambda(n)\n"
+            "  order a n                               multiplicative order of a mod n, or 'none'\n"
+            "  dlog b y m                              smallest x with b^x = y (mod m), or 'none' (m < 2^63)\n"
+            "  sqrt a m [limit]                        the roots of x^2 = a (mod m) in increasing order, at most\n"
+            "                                          'limit' of them (default 64, '...' marks a cut), or 'none'\n"
+            "  linrec n m c1 ... ck a0 ... a(k-1)      a_n mod m for a_i = c1 a_(i-1) + ... + ck a_(i-k)\n"
+            "  matpow n m x11 x12 ... xkk              the k x k matrix X^n mod m, row by row\n");
+}
+
+/*
+Streams operations from a file ("-" for stdin) to 'out' without touching the menu UI.
+Input arrives in large blocks whose lines are split into chunks for the worker threads; every
+chunk has its own output buffer and the buffers are written in input order, so the output is the
+same for any number of threads.
+*/
+int runBatchMode(const string &path, FILE *out, const BatchOptions &options)
+{
+    int threads = options.threads > 0 ? options.threads : max(1, (int)thread::hardware_concurrency());
+    WorkStealingPool pool;
+    startWorkers(pool, threads);
+    configureResultCache(resultCache, options.cacheMemory);
+    startMetrics(options.metricsFormat);
+    vector<BatchState> states(threads); // per worker, so the scratch space needs no locking
+    for (BatchState &state : states)
+    {
+        state.fixedBaseMemory = options.fixedBaseMemory;
+        state.dlogMemory = options.dlogMemory;
+    }
+    vector<string> outputs;
+    LineProcessor process = options.filterPrimes ? filterPrimeLine : processBatchLine;
+
+    size_t blockBytes = max((size_t)1 << 22, (size_t)threads << 19); // at least 8 chunks per worker
+    bool opened = streamInput(path, blockBytes, [&](const char *begin, const char *end, bool atEnd) {
+        const char *stop = runBatchChunks(pool, states, outputs, begin, end, atEnd, out, process);
+        dumpRequestedMetrics(options.metricsFormat); // SIGUSR1: between blocks
+        return stop;
+    });
+    stopWorkers(pool);
+    fflush(out);
+    if (!opened)
+        return 1;
+
+    BatchStats stats;
+    for (const BatchState &state : states)
+    {
+        stats.lines += state.stats.lines;
+        stats.errors += state.stats.errors;
+    }
+    if (options.summary)
+    {
+        fprintf(stderr, "lines: %lld, errors: %lld\n", stats.lines, stats.errors);
+        if (resultCache.capacity)
+            fprintf(stderr, "%s\n", describeResultCache(resultCache).c_str());
+    }
+    if (!options.metricsFormat.empty())
+        fprintf(stderr, "%s", formatMetrics(options.metricsFormat).c_str());
+    return stats.errors ? 1 : 0;
+}
+
+/*
+Runs process() over the complete lines of [begin, end) on the pool in chunks of up to 64 KiB (smaller when
+needed to give every worker about 8 chunks to balance) and writes their results to 'out' in
+input order, if 'out' isn't null. A last line without '\n' is only taken at the end of the input;
+returns where the unfinished line starts otherwise.
+*/
+const char *runBatchChunks(WorkStealingPool &pool, vector<BatchState> &states, vector<string> &outputs,
+                           const char *begin, const char *end, bool atEnd, FILE *out, LineProcessor process)
+{
+    const size_t chunkBytes = max((size_t)1 << 12, min((size_t)1 << 16, (end - begin) / (8 * pool.queues.size())));
+    const char *stop = end;
+    if (!atEnd)
+    {
+        while (stop > begin && stop[-1] != '\n')
+            stop--;
+    }
+
+    vector<const char *> bounds = {begin};
+    while (bounds.back() < stop)
+    {
+        const char *p = bounds.back();
+        const char *next = stop;
+        if ((size_t)(stop - p) > chunkBytes)
+        {
+            const char *newline = (const char *)memchr(p + chunkBytes, '\n', stop - p - chunkBytes);
+            next = newline ? newline + 1 : stop;
+        }
+        bounds.push_back(next);
+    }
+
+    size_t chunks = bounds.size() - 1;
+    if (outputs.size() < chunks)
+        outputs.resize(chunks);
+    function<void(size_t, int)> body = [&](size_t chunk, int worker) {
+        string &output = outputs[chunk];
+        output.clear();
+        const char *lineStart = bounds[chunk], *chunkEnd = bounds[chunk + 1];
+        while (lineStart < chunkEnd)
+        {
+            const char *newline = (const char *)memchr(lineStart, '\n', chunkEnd - lineStart);
+            if (!newline)
+                newline = chunkEnd; // last line without a trailing newline
+            process(lineStart, newline, output, states[worker]);
+            lineStart = newline + 1;
+        }
+    };
+    runOnPool(pool, chunks, body);
+
+    if (out)
+    {
+        for (size_t i = 0; i < chunks; i++)
+            fwrite(outputs[i].data(), 1, outputs[i].size(), out);
+    }
+    return stop;
+}
+
+// Parses one signed decimal integer, skipping leading blanks.
+//
+// Args:
+//   p: Parse position, advanced past the number.
+//   end: End of the line.
+//   value: Receives the parsed number.
+// Returns:
+//   False if there is no number or it does not fit in bigInt.
+bool parseBatchNumber(const char *&p, const char *end, bigInt &value)
+{
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+
+    bool isNegative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        isNegative = *p++ == '-';
+
+    const char *digits = p;
+    unsigned long long num = 0;
+    while (p < end && *p >= '0' && *p <= '9')
+    {
+        unsigned long long digit = *p - '0';
+        if (num > (ULLONG_MAX - digit) / 10)
+            return false;
+        num = num * 10 + digit;
+        p++;
+    }
+    if (p == digits || (p < end && *p != ' ' && *p != '\t'))
+        return false;
+    if (num > (unsigned long long)LLONG_MAX + isNegative)
+        return false;
+
+    value = isNegative ? (bigInt)(0 - num) : (bigInt)num;
+    return true;
+}
+
+void appendNumber(string &output, bigInt value)
+{
+    char digits[24];
+    char *last = to_chars(digits, digits + sizeof(digits), value).ptr;
+    output.append(digits, last);
+}
+
+void appendNumber(string &output, uBigInt value)
+{
+    char digits[24];
+    char *last = to_chars(digits, digits + sizeof(digits), value).ptr;
+    output.append(digits, last);
+}
+
+void appendNumber(string &output, const BigNumber &value)
+{
+    output += numberToString(value);
+}
+
+// b^n mod m for the modexp lines and requests. Consecutive operations that share the modulus reuse
+// its Montgomery context, and a (base, modulus) pair that keeps repeating gets a fixed-base table.
+bigInt cachedModPow(BatchState &state, bigInt b, bigInt n, bigInt m)
+{
+    const int repeatsBeforeTable = 16;
+    if (b == state.lastBase && m == state.lastMod)
+        state.baseRepeats++;
+    else
+    {
+        state.lastBase = b;
+        state.lastMod = m;
+        state.baseRepeats = 0;
+    }
+
+    if (state.baseRepeats >= repeatsBeforeTable)
+    {
+        if (state.fixedBase.base != b || state.fixedBase.m != m)
+            state.fixedBase = makeFixedBaseContext(b, m, state.fixedBaseMemory);
+        return fixedBaseModPow(state.fixedBase, n);
+    }
+    if (state.montgomery.m != (uBigInt)m)
+        state.montgomery = makeMontgomeryContext(m);
+    return montgomeryModPow(state.montgomery, b, n);
+}
+
+/*
+Executes a single batch line and appends its result (or an 'error: ...' line) to output.
+Blank lines and lines starting with '#' produce no output. Lines whose numbers don't fit in
+bigInt are run again over BigNumber.
+*/
+void processBatchLine(const char *p, const char *end, string &output, BatchState &state)
+{
+    if (end > p && end[-1] == '\r')
+        end--;
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    if (p == end || *p == '#')
+        return;
+
+    state.stats.lines++;
+    const char *opStart = p;
+    while (p < end && *p != ' ' && *p != '\t')
+        p++;
+    string op(opStart, p);
+    const char *numbersStart = p;
+
+    vector<bigInt> &nums = state.numbers;
+    nums.clear();
+    bool fits = true;
+    while (true)
+    {
+        while (p < end && (*p == ' ' || *p == '\t'))
+            p++;
+        if (p == end)
+            break;
+        bigInt value;
+        if (!parseBatchNumber(p, end, value))
+        {
+            fits = false;
+            break;
+        }
+        nums.push_back(value);
+    }
+
+    uint64_t started = metricClock();
+    const char *error = nullptr;
+    if (fits)
+        error = runBatchOperation(op, nums, output, state);
+    else
+    {
+        vector<BigNumber> bigNums;
+        p = numbersStart;
+        while (p < end)
+        {
+            while (p < end && (*p == ' ' || *p == '\t'))
+                p++;
+            const char *tokenStart = p;
+            while (p < end && *p != ' ' && *p != '\t')
+                p++;
+            if (p == tokenStart)
+                break;
+            bigNums.emplace_back();
+            if (!parseBigNumber(string(tokenStart, p), bigNums.back()))
+            {
+                error = "invalid number";
+                break;
+            }
+        }
+        if (!error)
+        {
+            countFallback(FALLBACK_BIGNUM_INPUT); // every token is a number, so one is past 64 bits
+            error = runBatchOperation(op, bigNums, output, state);
+        }
+    }
+    if (METRICS_ENABLED && metrics.active)
+        recordOperation(metricOperation(op), started, error != nullptr);
+
+    if (error)
+    {
+        state.stats.errors++;
+        output += "error: ";
+        output += error;
+    }
+    output += '\n';
+}
+
+/*
+--filter-primes: every line holds one non-negative number, and the line is copied to the output
+when the number is prime. Numbers of up to 19 digits are parsed straight into a machine word,
+longer ones go through BigNumber and the Baillie-PSW test.
+*/
+void filterPrimeLine(const char *p, const char *end, string &output, BatchState &state)
+{
+    if (end > p && end[-1] == '\r')
+        end--;
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    while (end > p && (end[-1] == ' ' || end[-1] == '\t'))
+        end--;
+    if (p == end || *p == '#')
+        return;
+
+    state.stats.lines++;
+    uint64_t started = metricClock();
+    bool valid = true, prime = false;
+    if (end - p <= 19)
+    {
+        uBigInt value = 0;
+        for (const char *digit = p; digit < end; digit++)
+        {
+            if (*digit < '0' || *digit > '9')
+            {
+                valid = false;
+                break;
+            }
+            value = value * 10 + (*digit - '0');
+        }
+        prime = valid && isPrime(value);
+    }
+    else
+    {
+        BigNumber value;
+        valid = parseBigNumber(string(p, end), value);
+        prime = valid && isPrime(value);
+    }
+    if (METRICS_ENABLED && metrics.active)
+    {
+        static const int isprime = metricOperation("isprime");
+        recordOperation(isprime, started, !valid);
+    }
+
+    if (!valid)
+    {
+        state.stats.errors++;
+        output += "error: invalid number\n";
+    }
+    else if (prime)
+    {
+        output.append(p, end);
+        output += '\n';
+    }
+}
+
+// Dispatches one parsed batch operation; returns an error message or nullptr.
+template <typename T>
+const char *runBatchOperation(const string &op, vector<T> &nums, string &output, BatchState &state)
+{
+    if (op == "modexp")
+    {
+        if (nums.size() != 3)
+            return "modexp expects b n m";
+        if (nums[2] <= T(0))
+            return "'mod' must be positive";
+
+        if constexpr (is_same<T, bigInt>::value)
+            appendNumber(output, memoizedResult(CACHE_MODEXP, nums[0], nums[1], nums[2],
+                                                [&]() { return cachedModPow(state, nums[0], nums[1], nums[2]); }));
+        else
+            appendNumber(output, modularExponentiation(nums[0], nums[1], nums[2]));
+    }
+    else if (op == "inv")
+    {
+        if (nums.size() != 2)
+            return "inv expects a m";
+        if (nums[1] <= T(0))
+            return "'mod' must be positive";
+
+        T res;
+        if constexpr (is_same<T, bigInt>::value)
+            res = memoizedResult(CACHE_INVERSE, nums[0], nums[1], 0, [&]() { return modInverse(nums[0], nums[1]); });
+        else
+            res = modInverse(nums[0], nums[1]);
+        if (res < T(0))
+            output += "none";
+        else
+            appendNumber(output, res);
+    }
+    else if (op == "lincong")
+    {
+        if (nums.size() != 3 && nums.size() != 4)
+            return "lincong expects a b m [limit]";
+        if (nums[2] <= T(0))
+            return "'mod' must be positive";
+
+        if (nums.size() == 3)
+        {
+            T res = linearCongruence(nums[0], nums[1], nums[2]);
+            if (res < T(0))
+                output += "none";
+            else
+                appendNumber(output, res);
+            return nullptr;
+        }
+
+        if (nums[3] < T(0))
+            return "'limit' must not be negative";
+        CongruenceSolutions<T> solutions = linearCongruenceSolutions(nums[0], nums[1], nums[2]);
+        if (solutions.count == T(0))
+        {
+            output += "none";
+            return nullptr;
+        }
+        appendNumber(output, solutions.count);
+        output += ':';
+        T listed = T(0);
+        for (auto it = solutions.begin(); listed < nums[3] && it != solutions.end(); ++it, listed = listed + T(1))
+        {
+            output += ' ';
+            appendNumber(output, *it);
+        }
+        if (listed < solutions.count)
+        {
+            output += " ... ";
+            appendNumber(output, solutions.last());
+        }
+    }
+    else if (op == "batchinv")
+    {
+        if (nums.size() < 2)
+            return "batchinv expects m a1 a2 ...";
+        if (nums[0] <= T(0))
+            return "'mod' must be positive";
+        if constexpr (!is_same<T, bigInt>::value)
+            return "batchinv supports 64-bit values only";
+        else
+        {
+            vector<bigInt> values(nums.begin() + 1, nums.end());
+            vector<bigInt> inverses = batchModInverse(values, nums[0]);
+            for (size_t i = 0; i < inverses.size(); i++)
+            {
+                if (i)
+                    output += ' ';
+                if (inverses[i] == LLONG_MIN)
+                    output += "none";
+                else
+                    appendNumber(output, inverses[i]);
+            }
+        }
+    }
+    else if (op == "crt")
+    {
+        int k = nums.size() / 2;
+        if (nums.size() < 2 || nums.size() % 2)
+            return "crt expects pairs a m";
+
+        vector<T *> localRows;
+        vector<T *> *rows = &localRows;
+        if constexpr (is_same<T, bigInt>::value)
+            rows = &state.crtRows;
+        rows->resize(k);
+        for (int i = 0; i < k; i++)
+        {
+            (*rows)[i] = &nums[2 * i];
+            if ((*rows)[i][1] <= T(0))
+                return "'mod' must be positive";
+        }
+
+        T M;
+        int conflict[2];
+        T res = chineseRemainderTheorem(rows->data(), M, k, conflict);
+        if constexpr (is_same<T, bigInt>::value)
+        {
+            if (res == LLONG_MIN && M == 0)
+            {
+                // The solution's modulus left 64 bits: rebuild it from Garner's mixed radix
+                // digits, or over BigNumber when the moduli share factors.
+                vector<bigInt> digits;
+                if (garnerCRT(rows->data(), k, digits))
+                {
+                    BigNumber bigM;
+                    appendNumber(output, mixedRadixToBigNumber(digits, rows->data(), bigM));
+                    output += ' ';
+                    appendNumber(output, bigM);
+                    return nullptr;
+                }
+                vector<BigNumber> bigNums(nums.begin(), nums.end());
+                return runBatchOperation(op, bigNums, output, state);
+            }
+        }
+        if (res < T(0))
+        {
+            output += "none ";
+            appendNumber(output, (bigInt)conflict[0] + 1);
+            output += ' ';
+            appendNumber(output, (bigInt)conflict[1] + 1);
+        }
+        else
+        {
+            appendNumber(output, res);
+            output += ' ';
+            appendNumber(output, M);
+        }
+    }
+    else if (op == "isprime")
+    {
+        if (nums.size() != 1)
+            return "isprime expects n";
+        bool prime;
+        if constexpr (is_same<T, bigInt>::value)
+            prime = nums[0] > 0 && isPrime((uBigInt)nums[0]);
+        else
+            prime = isPrime(nums[0]);
+        output += prime ? "prime" : "not prime";
+    }
+    else if (op == "nextprime")
+    {
+        if (nums.size() != 1)
+            return "nextprime expects n";
+        if constexpr (is_same<T, bigInt>::value)
+            appendNumber(output, nextPrime((uBigInt)max<bigInt>(nums[0], 0))); // below 2^64 for any bigInt
+        else
+            appendNumber(output, nextPrime(nums[0]));
+    }
+    else if (op == "factor" || op == "totient" || op == "carmichael")
+    {
+        if (nums.size() != 1)
+            return op == "factor" ? "factor expects n" : op == "totient" ? "totient expects n" : "carmichael expects n";
+        vector<uBigInt> values;
+        if (const char *error = toUnsignedArguments(nums, values))
+            return error;
+        if (values[0] == 0)
+            return "n must be positive";
+
+        if (op == "factor")
+        {
+            if (values[0] == 1)
+                output += '1';
+            appendFactorization(output, factorize(values[0]));
+        }
+        else
+            appendNumber(output, op == "totient" ? eulerTotient(values[0]) : carmichaelLambda(values[0]));
+    }
+    else if (op == "order")
+    {
+        if (nums.size() != 2)
+            return "order expects a n";
+        vector<uBigInt> values;
+        if (const char *error = toUnsignedArguments(nums, values))
+            return error;
+        if (values[1] == 0)
+            return "n must be positive";
+
+        uBigInt order = multiplicativeOrder(values[0], values[1]);
+        if (order == 0)
+            output += "none";
+        else
+            appendNumber(output, order);
+    }
+    else if (op == "dlog")
+    {
+        if (nums.size() != 3)
+            return "dlog expects b y m";
+        if (nums[2] <= T(0))
+            return "'mod' must be positive";
+        if constexpr (!is_same<T, bigInt>::value)
+            return "dlog supports 64-bit values only";
+        else
+        {
+            bigInt x = discreteLog(nums[0], nums[1], nums[2], state.babySteps, state.dlogMemory);
+            if (x == LLONG_MIN)
+                output += "none";
+            else
+                appendNumber(output, x);
+        }
+    }
+    else if (op == "sqrt")
+    {
+        if (nums.size() != 2 && nums.size() != 3)
+            return "sqrt expects a m [limit]";
+        if (nums[1] <= T(0))
+            return "'mod' must be positive";
+        if constexpr (!is_same<T, bigInt>::value)
+            return "sqrt supports 64-bit values only";
+        else
+        {
+            if (nums.size() == 3 && nums[2] < 0)
+                return "'limit' must not be negative";
+            uBigInt limit = nums.size() == 3 ? nums[2] : 64;
+            if (state.sqrtModulus != nums[1])
+            {
+                state.sqrtModulus = nums[1];
+                state.sqrtFactors = factorize(nums[1]);
+            }
+
+            SquareRootSet &roots = state.squareRoots;
+            if (!sqrtMod(nums[0], nums[1], roots, &state.sqrtFactors))
+                output += "none";
+            else
+            {
+                uBigInt shown = min(limit, roots.count);
+                for (uBigInt i = 0; i < shown; i++)
+                {
+                    if (i)
+                        output += ' ';
+                    appendNumber(output, squareRootAt(roots, i));
+                }
+                if (shown < roots.count)
+                    output += shown ? " ..." : "...";
+            }
+        }
+    }
+    else if (op == "linrec" || op == "matpow")
+    {
+        bool recurrence = op == "linrec";
+        size_t k = recurrence ? (nums.size() - 2) / 2 : (size_t)sqrt((double)max<size_t>(nums.size(), 2) - 2);
+        if (nums.size() < (recurrence ? 4u : 3u) || (recurrence ? nums.size() % 2 : k * k + 2 != nums.size()))
+            return recurrence ? "linrec expects n m c1 ... ck a0 ... a(k-1)" : "matpow expects n m and k*k entries";
+        if (nums[1] <= T(0))
+            return "'mod' must be positive";
+        if (nums[0] < T(0))
+            return "'n' must not be negative";
+
+        // n and m below 2^64 (the BigNumber path brings moduli in [2^63, 2^64)); the other values
+        // may be any size and are reduced mod m.
+        vector<uBigInt> bounds;
+        if (const char *error = toUnsignedArguments(vector<T>(nums.begin(), nums.begin() + 2), bounds))
+            return error;
+        uBigInt n = bounds[0], m = bounds[1];
+        vector<uBigInt> values(nums.size() - 2);
+        for (size_t i = 0; i < values.size(); i++)
+        {
+            if constexpr (is_same<T, bigInt>::value)
+                values[i] = normalizeMod(nums[i + 2], nums[1]);
+            else
+            {
+                T residue = nums[i + 2] % nums[1];
+                if (residue < T(0))
+                    residue = residue + nums[1];
+                values[i] = toUBigInt(residue);
+            }
+        }
+
+        if (recurrence)
+        {
+            vector<uBigInt> coefficients(values.begin(), values.begin() + k), initial(values.begin() + k, values.end());
+            appendNumber(output, linearRecurrence(coefficients, initial, n, m));
+        }
+        else
+        {
+            ModMatrix matrix;
+            matrix.k = k;
+            matrix.m = m;
+            matrix.entries = values;
+            ModMatrix power = matrixPower(matrix, n);
+            for (size_t i = 0; i < power.entries.size(); i++)
+            {
+                if (i)
+                    output += ' ';
+                appendNumber(output, power.entries[i]);
+            }
+        }
+    }
+    else
+        return "unknown operation";
+
+    return nullptr;
+}
+
+// Converts the arguments of the 64-bit-only operations; returns an error message or nullptr.
+template <typename T>
+const char *toUnsignedArguments(const vector<T> &nums, vector<uBigInt> &values)
+{
+    for (const T &num : nums)
+    {
+        if constexpr (is_same<T, bigInt>::value)
+        {
+            if (num < 0)
+                return "numbers must be in [0, 2^64)";
+            values.push_back((uBigInt)num);
+        }
+        else
+        {
+            if (!fitsInUBigInt(num))
+                return "numbers must be in [0, 2^64)";
+            values.push_back(toUBigInt(num));
+        }
+    }
+    return nullptr;
+}
+
+// ************ Streaming Input Functions ******************
+
+/*
+Feeds a file ("-" for stdin) to consume(begin, end, atEnd) in chunks of about chunkSize bytes.
+The consumer handles what it can and returns where it stopped; the rest is handed to it again at
+the start of the next chunk, and everything left is passed with atEnd = true at the end.
+Regular files are memory-mapped where the platform allows it, anything else (stdin, pipes) is
+read in blocks as in batch mode. Returns false if the file can't be opened.
+*/
+template <typename Consumer>
+bool streamInput(const string &path, size_t chunkSize, Consumer consume)
+{
+#ifndef _WIN32
+    if (path != "-")
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            fprintf(stderr, "Cannot open '%s'\n", path.c_str());
+            return false;
+        }
+        struct stat info;
+        bool mapped = false;
+        if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0)
+        {
+            size_t size = info.st_size;
+            void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED)
+            {
+                madvise(data, size, MADV_SEQUENTIAL);
+                const char *p = (const char *)data, *end = p + size;
+                while (p < end)
+                {
+                    const char *chunkEnd = end - p > (ptrdiff_t)chunkSize ? p + chunkSize : end;
+                    const char *stop = consume(p, chunkEnd, chunkEnd == end);
+                    if (stop == p) // nothing complete in a whole chunk: take the rest at once
+                        stop = consume(p, end, true);
+                    p = stop;
+                }
+                munmap(data, size);
+                mapped = true;
+            }
+        }
+        close(fd);
+        if (mapped)
+            return true;
+    }
+#endif
+
+    FILE *in = path == "-" ? stdin : fopen(path.c_str(), "rb");
+    if (!in)
+    {
+        fprintf(stderr, "Cannot open '%s'\n", path.c_str());
+        return false;
+    }
+
+    vector<char> buffer(chunkSize);
+    size_t carry = 0;
+    while (true)
+    {
+        if (carry == buffer.size())
+            buffer.resize(buffer.size() * 2);
+
+        size_t got = fread(buffer.data() + carry, 1, buffer.size() - carry, in);
+        const char *begin = buffer.data();
+        const char *end = begin + carry + got;
+        const char *stop = consume(begin, end, got == 0);
+
+        if (got == 0)
+            break;
+        carry = end - stop;
+        memmove(buffer.data(), stop, carry);
+    }
+    if (in != stdin)
+        fclose(in);
+    return true;
+}
+
+// ************ Barcode Validation Functions ******************
+
+// Weighted digit sum of the first code.length() characters of a code ('X' counts as 10).
+int barcodeWeightedSum(const string &code, const BarcodeFormat &format)
+{
+    int sum = 0;
+    for (int i = 0; i < (int)code.length() && i < format.length; i++)
+        sum += format.weights[i] * (code[i] == 'X' ? 10 : code[i] - '0');
+    return sum;
+}
+
+/*
+Checks one line in full: '-' and ' ' separators are skipped, and 'X' (or 'x') may only be the
+check digit of formats that allow it.
+Returns 1 if the code is valid, 0 if its check digit is wrong and -1 if it is malformed.
+*/
+int checkBarcodeLine(const char *p, const char *end, const BarcodeFormat &format)
+{
+    int count = 0, sum = 0;
+    for (; p < end; p++)
+    {
+        char c = *p;
+        if (c == '-' || c == ' ')
+            continue;
+        if (count == format.length)
+            return -1; // too many digits
+
+        int value;
+        if (c >= '0' && c <= '9')
+            value = c - '0';
+        else if ((c == 'X' || c == 'x') && format.allowX && count == format.length - 1)
+            value = 10;
+        else
+            return -1;
+        sum += format.weights[count++] * value;
+    }
+    if (count != format.length)
+        return -1;
+    return sum % format.modulus == 0 ? 1 : 0;
+}
+
+// Counts one line (without its '\n') and appends it to 'failures' unless it is valid.
+void recordBarcodeLine(const char *p, const char *end, const BarcodeFormat &format, BarcodeStats &stats,
+                       string *failures)
+{
+    stats.lines++;
+    if (end > p && end[-1] == '\r')
+        end--;
+    if (p == end)
+        return; // blank lines are skipped
+
+    int result = checkBarcodeLine(p, end, format);
+    if (result == 1)
+    {
+        stats.valid++;
+        return;
+    }
+    if (result == 0)
+        stats.invalid++;
+    else
+        stats.malformed++;
+    if (failures)
+    {
+        appendNumber(*failures, stats.lines);
+        *failures += ':';
+        failures->append(p, end - p);
+        *failures += '\n';
+    }
+}
+
+// The portable kernel: every complete line goes through checkBarcodeLine().
+const char *validateBarcodesScalar(const char *p, const char *end, const BarcodeFormat &format,
+                                   BarcodeStats &stats, string *failures)
+{
+    while (p < end)
+    {
+        const char *newline = (const char *)memchr(p, '\n', end - p);
+        if (!newline)
+            break;
+        recordBarcodeLine(p, newline, format, stats, failures);
+        p = newline + 1;
+    }
+    return p;
+}
+
+#if HAS_X86_SIMD
+/*
+One line per 16-byte load. Bytes minus '0' are digits exactly when they are <= 9 unsigned;
+they are widened to 16 bits and multiplied by the weights (zero past the code, so the '\n' and
+the next line in the same load add nothing), and the four partial sums are folded together.
+Lines that are not exactly 'length' digits followed by '\n' or "\r\n" are left to the scalar
+path, which also decides what is wrong with them.
+*/
+__attribute__((target("sse2"))) const char *validateBarcodesSSE2(const char *p, const char *end,
+                                                                 const BarcodeFormat &format,
+                                                                 BarcodeStats &stats, string *failures)
+{
+    const int length = format.length;
+    const int fieldMask = (1 << length) - 1;
+    short lowWeights[8], highWeights[8];
+    char xLanes[16] = {0};
+    for (int i = 0; i < 8; i++)
+    {
+        lowWeights[i] = format.weights[i];
+        highWeights[i] = format.weights[i + 8];
+    }
+    if (format.allowX)
+        xLanes[length - 1] = -1;
+
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i asciiZero = _mm_set1_epi8('0');
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i ten = _mm_set1_epi8(10);
+    const __m128i xChar = _mm_set1_epi8('X');
+    const __m128i xMask = _mm_loadu_si128((const __m128i *)xLanes);
+    const __m128i lowWeight = _mm_loadu_si128((const __m128i *)lowWeights);
+    const __m128i highWeight = _mm_loadu_si128((const __m128i *)highWeights);
+
+    while (end - p >= 16)
+    {
+        const char *next;
+        if (p[length] == '\n')
+            next = p + length + 1;
+        else if (p[length] == '\r' && p[length + 1] == '\n')
+            next = p + length + 2;
+        else
+            break;
+
+        __m128i raw = _mm_loadu_si128((const __m128i *)p);
+        __m128i digits = _mm_sub_epi8(raw, asciiZero);
+        __m128i isDigit = _mm_cmpeq_epi8(_mm_min_epu8(digits, nine), digits);
+        __m128i isX = _mm_and_si128(_mm_cmpeq_epi8(raw, xChar), xMask);
+        if ((_mm_movemask_epi8(_mm_or_si128(isDigit, isX)) & fieldMask) != fieldMask)
+            break;
+
+        digits = _mm_or_si128(_mm_and_si128(digits, isDigit), _mm_and_si128(ten, isX));
+        __m128i sum = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi8(digits, zero), lowWeight),
+                                    _mm_madd_epi16(_mm_unpackhi_epi8(digits, zero), highWeight));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+
+        stats.lines++;
+        if (_mm_cvtsi128_si32(sum) % format.modulus == 0)
+            stats.valid++;
+        else
+        {
+            stats.invalid++;
+            if (failures)
+            {
+                appendNumber(*failures, stats.lines);
+                *failures += ':';
+                failures->append(p, length);
+                *failures += '\n';
+            }
+        }
+        p = next;
+    }
+    return p;
+}
+
+/*
+The SSE2 kernel for two lines at once: each 128-bit lane holds one line, maddubs multiplies the
+digit bytes by the byte weights directly and madd against ones finishes the pairwise sums.
+Whatever is left when no full pair fits goes through the SSE2 kernel.
+*/
+__attribute__((target("avx2"))) const char *validateBarcodesAVX2(const char *p, const char *end,
+                                                                 const BarcodeFormat &format,
+                                                                 BarcodeStats &stats, string *failures)
+{
+    const int length = format.length;
+    const unsigned pairMask = ((1u << length) - 1) * 0x10001u;
+    char xLanes[32] = {0};
+    if (format.allowX)
+        xLanes[length - 1] = xLanes[length + 15] = -1;
+
+    const __m256i asciiZero = _mm256_set1_epi8('0');
+    const __m256i nine = _mm256_set1_epi8(9);
+    const __m256i ten = _mm256_set1_epi8(10);
+    const __m256i xChar = _mm256_set1_epi8('X');
+    const __m256i ones = _mm256_set1_epi16(1);
+    const __m256i xMask = _mm256_loadu_si256((const __m256i *)xLanes);
+    const __m256i weights = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)format.weights));
+
+    while (end - p >= 16)
+    {
+        const char *second, *next;
+        if (p[length] == '\n')
+            second = p + length + 1;
+        else if (p[length] == '\r' && p[length + 1] == '\n')
+            second = p + length + 2;
+        else
+            break;
+        if (end - second < 16)
+            break;
+        if (second[length] == '\n')
+            next = second + length + 1;
+        else if (second[length] == '\r' && second[length + 1] == '\n')
+            next = second + length + 2;
+        else
+            break;
+
+        __m256i raw = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)p)),
+                                              _mm_loadu_si128((const __m128i *)second), 1);
+        __m256i digits = _mm256_sub_epi8(raw, asciiZero);
+        __m256i isDigit = _mm256_cmpeq_epi8(_mm256_min_epu8(digits, nine), digits);
+        __m256i isX = _mm256_and_si256(_mm256_cmpeq_epi8(raw, xChar), xMask);
+        if (((unsigned)_mm256_movemask_epi8(_mm256_or_si256(isDigit, isX)) & pairMask) != pairMask)
+            break;
+
+        digits = _mm256_or_si256(_mm256_and_si256(digits, isDigit), _mm256_and_si256(ten, isX));
+        __m256i sum = _mm256_madd_epi16(_mm256_maddubs_epi16(digits, weights), ones);
+        sum = _mm256_add_epi32(sum, _mm256_shuffle_epi32(sum, 0x4E));
+        sum = _mm256_add_epi32(sum, _mm256_shuffle_epi32(sum, 0xB1));
+
+        const char *lines[2] = {p, second};
+        int sums[2] = {_mm256_cvtsi256_si32(sum), _mm256_extract_epi32(sum, 4)};
+        for (int i = 0; i < 2; i++)
+        {
+            stats.lines++;
+            if (sums[i] % format.modulus == 0)
+                stats.valid++;
+            else
+            {
+                stats.invalid++;
+                if (failures)
+                {
+                    appendNumber(*failures, stats.lines);
+                    *failures += ':';
+                    failures->append(lines[i], length);
+                    *failures += '\n';
+                }
+            }
+        }
+        p = next;
+    }
+    return validateBarcodesSSE2(p, end, format, stats, failures);
+}
+#endif
+
+// Picks the widest kernel the CPU supports.
+BarcodeKernel selectBarcodeKernel()
+{
+#if HAS_X86_SIMD
+    if (__builtin_cpu_supports("avx2"))
+        return validateBarcodesAVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return validateBarcodesSSE2;
+#endif
+    return validateBarcodesScalar;
+}
+
+/*
+Validates the lines in [p, end): the kernel takes every run of well-formed fixed-width lines and
+each line it stops at is checked on its own. A final line without '\n' is only taken at the end
+of the input; returns where the unfinished line starts otherwise.
+*/
+const char *validateBarcodeBlock(const char *p, const char *end, bool atEnd, const BarcodeFormat &format,
+                                 BarcodeKernel kernel, BarcodeStats &stats, string *failures)
+{
+    while (p < end)
+    {
+        p = kernel(p, end, format, stats, failures);
+        if (p == end)
+            break;
+
+        const char *newline = (const char *)memchr(p, '\n', end - p);
+        if (!newline)
+        {
+            if (!atEnd)
+                break;
+            newline = end;
+        }
+        recordBarcodeLine(p, newline, format, stats, failures);
+        p = newline == end ? end : newline + 1;
+    }
+    return p;
+}
+
+/*
+Streams a file of codes (one per line) through the validator and writes the failing lines as
+'line:code', or only the counters with options.summary.
+*/
+int runBarcodeValidation(const string &path, FILE *out, const ValidateOptions &options)
+{
+    const BarcodeFormat &format = *options.format;
+    BarcodeKernel kernel = selectBarcodeKernel();
+    BarcodeStats stats;
+    string output;
+    string *failures = options.summary ? nullptr : &output;
+
+    bool opened = streamInput(path, 1 << 24, [&](const char *begin, const char *end, bool atEnd) {
+        const char *stop = validateBarcodeBlock(begin, end, atEnd, format, kernel, stats, failures);
+        fwrite(output.data(), 1, output.size(), out); // failing lines are flushed after every chunk
+        output.clear();
+        return stop;
+    });
+    if (!opened)
+        return 1;
+
+    if (options.summary)
+        fprintf(out, "lines: %lld, valid: %lld, invalid: %lld, malformed: %lld\n", stats.lines, stats.valid,
+                stats.invalid, stats.malformed);
+    fflush(out);
+    return stats.invalid + stats.malformed ? 1 : 0;
+}
+
+// ************ Parity Functions ******************
+
+// Packs a string of '0'/'1' characters into a BitString.
+BitString packBits(const string &str)
+{
+    BitString bits;
+    bits.length = str.length();
+    bits.words.assign((str.length() + 63) / 64, 0);
+    for (size_t i = 0; i < str.length(); i++)
+    {
+        if (str[i] == '1')
+            bits.words[i / 64] |= 1ULL << (i % 64);
+    }
+    return bits;
+}
+
+// The portable kernel: SWAR bit counting, one word at a time.
+uint64_t popcountScalar(const unsigned char *data, size_t words)
+{
+    uint64_t ones = 0;
+    for (size_t i = 0; i < words; i++)
+    {
+        uint64_t x;
+        memcpy(&x, data + 8 * i, 8);
+        x = x - ((x >> 1) & 0x5555555555555555ULL);
+        x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+        x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+        ones += (x * 0x0101010101010101ULL) >> 56;
+    }
+    return ones;
+}
+
+#if HAS_X86_SIMD
+// One popcnt instruction per word, with four independent sums to keep the pipeline busy.
+__attribute__((target("popcnt"))) uint64_t popcountPopcnt(const unsigned char *data, size_t words)
+{
+    uint64_t sums[4] = {0, 0, 0, 0};
+    size_t i = 0;
+    for (; i + 4 <= words; i += 4)
+    {
+        uint64_t x[4];
+        memcpy(x, data + 8 * i, 32);
+        for (int j = 0; j < 4; j++)
+            sums[j] += __builtin_popcountll(x[j]);
+    }
+    for (; i < words; i++)
+    {
+        uint64_t x;
+        memcpy(&x, data + 8 * i, 8);
+        sums[0] += __builtin_popcountll(x);
+    }
+    return sums[0] + sums[1] + sums[2] + sums[3];
+}
+
+/*
+Nibble lookup: pshufb maps each 4-bit half of every byte to its bit count, the byte counts are
+summed for up to 31 vectors (at most 8 * 31 = 248 per byte) and then folded into 64-bit lanes
+with psadbw.
+*/
+__attribute__((target("avx2,popcnt"))) uint64_t popcountAVX2(const unsigned char *data, size_t words)
+{
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i lowNibble = _mm256_set1_epi8(0x0F);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i total = zero;
+    size_t i = 0;
+    while (i + 4 <= words)
+    {
+        size_t stop = min(words, i + 4 * 31);
+        __m256i counts = zero;
+        for (; i + 4 <= stop; i += 4)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(data + 8 * i));
+            __m256i low = _mm256_shuffle_epi8(lookup, _mm256_and_si256(v, lowNibble));
+            __m256i high = _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(v, 4), lowNibble));
+            counts = _mm256_add_epi8(counts, _mm256_add_epi8(low, high));
+        }
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(counts, zero));
+    }
+
+    uint64_t ones = _mm256_extract_epi64(total, 0) + _mm256_extract_epi64(total, 1) +
+                    _mm256_extract_epi64(total, 2) + _mm256_extract_epi64(total, 3);
+    for (; i < words; i++)
+    {
+        uint64_t x;
+        memcpy(&x, data + 8 * i, 8);
+        ones += __builtin_popcountll(x);
+    }
+    return ones;
+}
+
+// VPOPCNTDQ counts eight words per instruction; the tail goes through a masked load.
+__attribute__((target("avx512f,avx512vpopcntdq"))) uint64_t popcountAVX512(const unsigned char *data, size_t words)
+{
+    __m512i total = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + 8 <= words; i += 8)
+        total = _mm512_add_epi64(total, _mm512_popcnt_epi64(_mm512_loadu_si512(data + 8 * i)));
+    if (i < words)
+    {
+        __mmask8 mask = (__mmask8)((1u << (words - i)) - 1);
+        total = _mm512_add_epi64(total, _mm512_popcnt_epi64(_mm512_maskz_loadu_epi64(mask, data + 8 * i)));
+    }
+    // Summed through memory: GCC 12's _mm512_reduce_add_epi64 (and _mm512_extracti64x4_epi64)
+    // trips -Wuninitialized inside its own header.
+    alignas(64) uint64_t lanes[8];
+    _mm512_store_si512(lanes, total);
+    uint64_t ones = 0;
+    for (uint64_t lane : lanes)
+        ones += lane;
+    return ones;
+}
+#endif
+
+// Picks the fastest kernel the CPU supports.
+PopcountKernel selectPopcountKernel()
+{
+#if HAS_X86_SIMD
+    if (__builtin_cpu_supports("avx512vpopcntdq"))
+        return popcountAVX512;
+    if (__builtin_cpu_supports("avx2"))
+        return popcountAVX2;
+    if (__builtin_cpu_supports("popcnt"))
+        return popcountPopcnt;
+#endif
+    return popcountScalar;
+}
+
+uint64_t countOnes(const BitString &bits)
+{
+    static PopcountKernel kernel = selectPopcountKernel();
+    return kernel((const unsigned char *)bits.words.data(), bits.words.size());
+}
+
+/*
+Counts the one bits in positions [begin, end) of a little-endian bit stream: the partial words
+at both ends are masked and the whole words in between go through the kernel.
+*/
+uint64_t countOnesInRange(const unsigned char *data, size_t begin, size_t end, PopcountKernel kernel)
+{
+    if (begin >= end)
+        return 0;
+
+    size_t firstWord = begin / 64, lastWord = (end - 1) / 64;
+    uint64_t first, last;
+    memcpy(&first, data + 8 * firstWord, 8);
+    first >>= begin % 64;
+    if (firstWord == lastWord)
+    {
+        size_t count = end - begin;
+        if (count < 64)
+            first &= (1ULL << count) - 1;
+        return popcountScalar((const unsigned char *)&first, 1);
+    }
+
+    memcpy(&last, data + 8 * lastWord, 8);
+    size_t tail = end - 64 * lastWord; // 1..64 bits
+    if (tail < 64)
+        last &= (1ULL << tail) - 1;
+    uint64_t ones = popcountScalar((const unsigned char *)&first, 1) + popcountScalar((const unsigned char *)&last, 1);
+    if (lastWord - firstWord > 1)
+        ones += kernel(data + 8 * (firstWord + 1), lastWord - firstWord - 1);
+    return ones;
+}
+
+// Appends the lowest 'count' bits of 'value' (count <= 64) to the packed parity bits.
+void emitParityBits(ParityEngine &engine, uint64_t value, int count)
+{
+    if (count < 64)
+        value &= (1ULL << count) - 1;
+    engine.blocks += count;
+    engine.pending |= value << engine.pendingCount;
+    engine.pendingCount += count;
+    if (engine.pendingCount >= 64)
+    {
+        engine.parities.push_back(engine.pending);
+        engine.pendingCount -= 64;
+        engine.pending = engine.pendingCount ? value >> (count - engine.pendingCount) : 0;
+    }
+}
+
+/*
+Emits the parities of the Block-bit blocks of whole words: folding x ^= x >> s for
+s = Block/2, ..., 1 leaves the parity of every block in its lowest bit, and those bits are
+gathered 64 at a time.
+*/
+template <int Block>
+void feedParityWords(ParityEngine &engine, const unsigned char *p, size_t words)
+{
+    uint64_t batch = 0;
+    int batchCount = 0;
+    for (size_t w = 0; w < words; w++)
+    {
+        uint64_t x;
+        memcpy(&x, p + 8 * w, 8);
+        for (int shift = Block / 2; shift > 0; shift /= 2)
+            x ^= x >> shift;
+
+        uint64_t packed = 0;
+        if constexpr (Block == 1)
+            packed = x;
+        else if constexpr (Block == 8)
+            packed = ((x & 0x0101010101010101ULL) * 0x0102040810204080ULL) >> 56;
+        else
+        {
+            for (int j = 0; j < 64 / Block; j++)
+                packed |= ((x >> (j * Block)) & 1) << j;
+        }
+        batch |= packed << batchCount;
+        batchCount += 64 / Block;
+        if (batchCount == 64)
+        {
+            emitParityBits(engine, batch, 64);
+            batch = 0;
+            batchCount = 0;
+        }
+    }
+    if (batchCount > 0)
+        emitParityBits(engine, batch, batchCount);
+}
+
+/*
+Adds 'bits' bits of the stream (whole words must be readable at 'data'). Blocks that divide 64
+and start on a word go through feedParityWords(); other sizes count the ones of each block.
+*/
+void feedParity(ParityEngine &engine, const unsigned char *data, size_t bits)
+{
+    const size_t block = engine.blockBits;
+    engine.bits += bits;
+    if (block == 0)
+    {
+        uint64_t ones = countOnesInRange(data, 0, bits, engine.kernel);
+        engine.ones += ones;
+        engine.blockOnes += ones;
+        return;
+    }
+
+    size_t pos = 0;
+    while (pos < bits)
+    {
+        if (engine.filled == 0 && 64 % block == 0 && pos % 64 == 0 && bits - pos >= 64)
+        {
+            size_t words = min((bits - pos) / 64, (size_t)4096); // stays in L1 for the second pass
+            const unsigned char *p = data + pos / 8;
+            engine.ones += engine.kernel(p, words);
+            switch (block)
+            {
+            case 1:
+                feedParityWords<1>(engine, p, words);
+                break;
+            case 2:
+                feedParityWords<2>(engine, p, words);
+                break;
+            case 4:
+                feedParityWords<4>(engine, p, words);
+                break;
+            case 8:
+                feedParityWords<8>(engine, p, words);
+                break;
+            case 16:
+                feedParityWords<16>(engine, p, words);
+                break;
+            case 32:
+                feedParityWords<32>(engine, p, words);
+                break;
+            default:
+                feedParityWords<64>(engine, p, words);
+                break;
+            }
+            pos += words * 64;
+            continue;
+        }
+
+        size_t take = min(block - engine.filled, bits - pos);
+        uint64_t ones = countOnesInRange(data, pos, pos + take, engine.kernel);
+        engine.ones += ones;
+        engine.blockOnes += ones;
+        engine.filled += take;
+        pos += take;
+        if (engine.filled == block)
+        {
+            emitParityBits(engine, engine.blockOnes & 1, 1);
+            engine.blockOnes = 0;
+            engine.filled = 0;
+        }
+    }
+}
+
+// Emits the parity of the unfinished last block (or of the whole stream) and pads the last byte.
+void finishParity(ParityEngine &engine)
+{
+    if (engine.filled > 0 || (engine.blockBits == 0 && engine.bits > 0))
+    {
+        emitParityBits(engine, engine.blockOnes & 1, 1);
+        engine.blockOnes = 0;
+        engine.filled = 0;
+    }
+    if (engine.pendingCount > 0)
+    {
+        engine.parities.push_back(engine.pending);
+        engine.lastWordBytes = (engine.pendingCount + 7) / 8;
+        engine.pending = 0;
+        engine.pendingCount = 0;
+    }
+}
+
+/*
+Computes the parity of a raw binary file, bit i being bit i % 8 of byte i / 8.
+Without a block size the parity of the whole input is printed as text; otherwise the parity
+bits of every block are written packed (8 per byte, first block in the lowest bit), or, with
+options.verifyPath, compared against such a file and the indices of mismatching blocks printed.
+*/
+int runParity(const string &path, FILE *out, const ParityOptions &options)
+{
+    ParityEngine engine;
+    engine.kernel = selectPopcountKernel();
+    engine.blockBits = options.blockBits;
+
+    FILE *expected = nullptr;
+    if (!options.verifyPath.empty())
+    {
+        expected = fopen(options.verifyPath.c_str(), "rb");
+        if (!expected)
+        {
+            fprintf(stderr, "Cannot open '%s'\n", options.verifyPath.c_str());
+            return 1;
+        }
+    }
+
+    uint64_t flushedBytes = 0, mismatches = 0;
+    string stored, report;
+    auto flush = [&]() {
+        // The packed words are written out byte by byte in little-endian order.
+        const char *bytes = (const char *)engine.parities.data();
+        size_t size = engine.parities.empty() ? 0 : 8 * (engine.parities.size() - 1) + engine.lastWordBytes;
+        if (expected)
+        {
+            // Missing stored bytes count as mismatches of every block they should hold.
+            stored.assign(size, 0);
+            size_t got = fread(&stored[0], 1, size, expected);
+            for (size_t i = 0; i < size; i++)
+            {
+                unsigned char diff = i < got ? stored[i] ^ bytes[i] : 0xFF;
+                for (int bit = 0; diff && bit < 8; bit++)
+                {
+                    uint64_t index = (flushedBytes + i) * 8 + bit;
+                    if ((diff >> bit & 1) && index < engine.blocks)
+                    {
+                        mismatches++;
+                        appendNumber(report, (bigInt)index);
+                        report += '\n';
+                    }
+                }
+            }
+            fwrite(report.data(), 1, report.size(), out);
+            report.clear();
+        }
+        else if (options.blockBits)
+            fwrite(bytes, 1, size, out);
+        flushedBytes += size;
+        engine.parities.clear();
+    };
+
+    bool opened = streamInput(path, 1 << 24, [&](const char *begin, const char *end, bool atEnd) {
+        size_t bytes = end - begin;
+        size_t whole = bytes / 8 * 8;
+        feedParity(engine, (const unsigned char *)begin, whole * 8);
+        if (atEnd && whole < bytes)
+        {
+            uint64_t tail = 0; // the last partial word, zero padded
+            memcpy(&tail, begin + whole, bytes - whole);
+            feedParity(engine, (const unsigned char *)&tail, (bytes - whole) * 8);
+            whole = bytes;
+        }
+        flush();
+        return begin + whole;
+    });
+    if (!opened)
+    {
+        if (expected)
+            fclose(expected);
+        return 1;
+    }
+    finishParity(engine);
+    flush();
+    if (expected)
+        fclose(expected);
+
+    if (options.blockBits == 0 && !expected)
+        fprintf(out, "bits: %llu, ones: %llu, parity: %llu\n", (unsigned long long)engine.bits,
+                (unsigned long long)engine.ones, (unsigned long long)(engine.ones & 1));
+    if (options.summary)
+        fprintf(stderr, "bits: %llu, ones: %llu, blocks: %llu, mismatches: %llu\n", (unsigned long long)engine.bits,
+                (unsigned long long)engine.ones, (unsigned long long)engine.blocks, (unsigned long long)mismatches);
+    fflush(out);
+    return mismatches ? 1 : 0;
+}
+
+// ************ Server Functions ******************
+
+void appendLittleEndian(string &out, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+        out += (char)(value >> (8 * i));
+}
+
+uint64_t loadLittleEndian(const char *p, int bytes)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++)
+        value |= (uint64_t)(unsigned char)p[i] << (8 * i);
+    return value;
+}
+
+// Appends one request frame; 'payload' holds the arguments, already encoded.
+void appendRequest(string &out, uint32_t id, uint8_t op, const string &payload)
+{
+    appendLittleEndian(out, payload.size() + 5, 4);
+    appendLittleEndian(out, id, 4);
+    out += (char)op;
+    out += payload;
+}
+
+/*
+Answers one request frame ('frame' starts at its id, 'length' bytes long) by appending the
+response frame to 'output'. The checks and error messages are the ones of the batch operations.
+*/
+void answerRequest(const char *frame, size_t length, string &output, BatchState &state)
+{
+    uint64_t started = metricClock();
+    size_t start = output.size();
+    output.append(4, '\0'); // the length, filled in below
+    output.append(frame, 4);
+
+    uint8_t op = frame[4];
+    const char *payload = frame + 5;
+    size_t size = length - 5;
+    vector<bigInt> &nums = state.numbers;
+    nums.clear();
+    if (op <= SERVER_CRT && size % 8 == 0)
+        for (size_t i = 0; i < size; i += 8)
+            nums.push_back((bigInt)loadLittleEndian(payload + i, 8));
+
+    uint8_t status = SERVER_OK;
+    bigInt results[2];
+    int resultCount = 1;
+    const char *error = nullptr;
+    if (op == SERVER_MODEXP)
+    {
+        if (nums.size() != 3)
+            error = "modexp expects b n m";
+        else if (nums[2] <= 0)
+            error = "'mod' must be positive";
+        else
+            results[0] = memoizedResult(CACHE_MODEXP, nums[0], nums[1], nums[2],
+                                        [&]() { return cachedModPow(state, nums[0], nums[1], nums[2]); });
+    }
+    else if (op == SERVER_INVERSE || op == SERVER_LINCONG)
+    {
+        bool inverse = op == SERVER_INVERSE;
+        if (nums.size() != (inverse ? 2u : 3u))
+            error = inverse ? "inv expects a m" : "lincong expects a b m";
+        else if (nums.back() <= 0)
+            error = "'mod' must be positive";
+        else
+        {
+            if (inverse)
+                results[0] = memoizedResult(CACHE_INVERSE, nums[0], nums[1], 0, [&]() { return modInverse(nums[0], nums[1]); });
+            else
+                results[0] = linearCongruence(nums[0], nums[1], nums[2]);
+            if (results[0] < 0)
+                status = SERVER_NONE;
+        }
+    }
+    else if (op == SERVER_CRT)
+    {
+        int k = nums.size() / 2;
+        state.crtRows.resize(k);
+        for (int i = 0; i < k; i++)
+        {
+            state.crtRows[i] = &nums[2 * i];
+            if (nums[2 * i + 1] <= 0)
+                error = "'mod' must be positive";
+        }
+        if (nums.size() < 2 || nums.size() % 2)
+            error = "crt expects pairs a m";
+        else if (!error)
+        {
+            int conflict[2];
+            bigInt M;
+            results[0] = chineseRemainderTheorem(state.crtRows.data(), M, k, conflict);
+            results[1] = M;
+            resultCount = 2;
+            if (results[0] == LLONG_MIN && M == 0)
+                error = "the solution does not fit in 64 bits";
+            else if (results[0] < 0)
+            {
+                status = SERVER_NONE;
+                results[0] = conflict[0] + 1;
+                results[1] = conflict[1] + 1;
+            }
+        }
+    }
+    else if (op >= SERVER_UPC_CHECK && op <= SERVER_ISBN_VERIFY)
+    {
+        const BarcodeFormat &format = op <= SERVER_UPC_VERIFY ? UPC_FORMAT : ISBN10_FORMAT;
+        bool verify = op == SERVER_UPC_VERIFY || op == SERVER_ISBN_VERIFY;
+        if (verify)
+        {
+            int valid = checkBarcodeLine(payload, payload + size, format);
+            if (valid < 0)
+                error = "malformed code";
+            results[0] = valid;
+        }
+        else
+        {
+            string code(payload, size);
+            if (code.size() != (size_t)format.length - 1 || code.find_first_not_of("0123456789") != string::npos)
+                error = op == SERVER_UPC_CHECK ? "expected 11 digits" : "expected 9 digits";
+            else
+            {
+                // the check digit c makes sum + weight*c divisible by the modulus; the weight is 1 for
+                // UPC and 10 = -1 (mod 11) for ISBN-10
+                int sum = barcodeWeightedSum(code, format);
+                results[0] = op == SERVER_UPC_CHECK ? (10 - sum % 10) % 10 : sum % 11;
+            }
+        }
+    }
+    else
+        error = "unknown operation";
+
+    if (error)
+    {
+        output += (char)SERVER_ERROR;
+        output += error;
+    }
+    else
+    {
+        output += (char)status;
+        if (status == SERVER_OK || op == SERVER_CRT)
+            for (int i = 0; i < resultCount; i++)
+                appendLittleEndian(output, results[i], 8);
+    }
+    string length32;
+    appendLittleEndian(length32, output.size() - start - 4, 4);
+    output.replace(start, 4, length32);
+
+    if (METRICS_ENABLED && metrics.active)
+    {
+        // METRIC_OPERATIONS index by request op; the check-digit ops count as "upc" and "isbn".
+        static const int metricIndex[] = {
+            metricOperation("other"), metricOperation("modexp"), metricOperation("inv"), metricOperation("lincong"),
+            metricOperation("crt"),   metricOperation("upc"),    metricOperation("upc"), metricOperation("isbn"),
+            metricOperation("isbn")};
+        recordOperation(op <= SERVER_ISBN_VERIFY ? metricIndex[op] : metricIndex[0], started, error != nullptr);
+    }
+}
+
+#ifdef __linux__
+/*
+A listening (or, for the load generator, connected) stream socket for 'endpoint': a port number
+means TCP on 127.0.0.1, anything else is the path of a Unix domain socket. Returns -1 after
+printing the reason.
+*/
+int openSocket(const string &endpoint, bool listening)
+{
+    bool tcp = !endpoint.empty() && endpoint.find_first_not_of("0123456789") == string::npos;
+    sockaddr_storage address = {};
+    socklen_t addressLength;
+    if (tcp)
+    {
+        sockaddr_in &in = (sockaddr_in &)address;
+        in.sin_family = AF_INET;
+        in.sin_port = htons(atoi(endpoint.c_str()));
+        in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addressLength = sizeof in;
+    }
+    else
+    {
+        sockaddr_un &un = (sockaddr_un &)address;
+        if (endpoint.size() >= sizeof un.sun_path)
+        {
+            fprintf(stderr, "Socket path '%s' is too long\n", endpoint.c_str());
+            return -1;
+        }
+        un.sun_family = AF_UNIX;
+        strcpy(un.sun_path, endpoint.c_str());
+        addressLength = sizeof un;
+    }
+
+    int fd = socket(address.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int on = 1;
+    if (fd >= 0 && tcp)
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on);
+    if (fd >= 0 && listening)
+    {
+        struct stat info;
+        if (tcp)
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+        else if (stat(endpoint.c_str(), &info) == 0 && S_ISSOCK(info.st_mode))
+            unlink(endpoint.c_str()); // left behind by an earlier server
+        if (bind(fd, (sockaddr *)&address, addressLength) == 0 && listen(fd, SOMAXCONN) == 0 &&
+            fcntl(fd, F_SETFL, O_NONBLOCK) == 0)
+            return fd;
+    }
+    else if (fd >= 0 && connect(fd, (sockaddr *)&address, addressLength) == 0)
+        return fd;
+
+    fprintf(stderr, "Cannot %s '%s': %s\n", listening ? "listen on" : "connect to", endpoint.c_str(), strerror(errno));
+    if (fd >= 0)
+        close(fd);
+    return -1;
+}
+
+volatile sig_atomic_t serverStopping = 0;
+
+/*
+Serves requests on 'endpoint' until SIGINT or SIGTERM. One thread runs the epoll loop: every
+round it reads what the ready connections sent, splits their complete requests into tasks of up to
+SERVER_CHUNK requests for the worker pool (every worker with its own BatchState, as in batch mode),
+and queues the answers of each connection in request order.
+*/
+int runServer(const string &endpoint, const BatchOptions &options)
+{
+    int listener = openSocket(endpoint, true);
+    if (listener < 0)
+        return 1;
+
+    int threads = options.threads > 0 ? options.threads : max(1, (int)thread::hardware_concurrency());
+    WorkStealingPool pool;
+    startWorkers(pool, threads);
+    configureResultCache(resultCache, options.cacheMemory);
+    startMetrics(options.metricsFormat);
+    vector<BatchState> states(threads);
+    for (BatchState &state : states)
+    {
+        state.fixedBaseMemory = options.fixedBaseMemory;
+        state.dlogMemory = options.dlogMemory;
+    }
+
+    struct sigaction stop = {};
+    stop.sa_handler = [](int) { serverStopping = 1; };
+    sigaction(SIGINT, &stop, nullptr);
+    sigaction(SIGTERM, &stop, nullptr);
+
+    int poller = epoll_create1(EPOLL_CLOEXEC);
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr; // the listener
+    epoll_ctl(poller, EPOLL_CTL_ADD, listener, &event);
+    fprintf(stderr, "Serving on %s with %d worker thread%s\n", endpoint.c_str(), threads, threads == 1 ? "" : "s");
+
+    vector<epoll_event> events(256);
+    vector<ServerConnection *> ready;
+    vector<ServerTask> tasks;
+    long long served = 0, accepted = 0;
+    char buffer[1 << 16];
+    function<void(size_t, int)> answer = [&](size_t t, int worker) {
+        ServerTask &task = tasks[t];
+        const string &input = task.connection->input;
+        for (size_t p = task.begin; p < task.end;)
+        {
+            size_t length = loadLittleEndian(input.data() + p, 4);
+            answerRequest(input.data() + p + 4, length, task.output, states[worker]);
+            p += 4 + length;
+        }
+    };
+
+    while (!serverStopping)
+    {
+        int count = epoll_wait(poller, events.data(), events.size(), -1);
+        dumpRequestedMetrics(options.metricsFormat); // SIGUSR1 interrupts the wait
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            break;
+        }
+
+        ready.clear();
+        for (int i = 0; i < count; i++)
+        {
+            ServerConnection *connection = (ServerConnection *)events[i].data.ptr;
+            if (!connection)
+            {
+                int fd;
+                while ((fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+                {
+                    int on = 1;
+                    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on); // fails harmlessly on Unix sockets
+                    connection = new ServerConnection;
+                    connection->fd = fd;
+                    connection->events = EPOLLIN;
+                    event.events = EPOLLIN;
+                    event.data.ptr = connection;
+                    epoll_ctl(poller, EPOLL_CTL_ADD, fd, &event);
+                    accepted++;
+                }
+                continue;
+            }
+
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            {
+                for (size_t got = 0; got < SERVER_READ_LIMIT && !connection->inputDone;)
+                {
+                    ssize_t n = read(connection->fd, buffer, sizeof buffer);
+                    if (n > 0)
+                    {
+                        connection->input.append(buffer, n);
+                        got += n;
+                    }
+                    else if (n == 0)
+                        connection->inputDone = true;
+                    else
+                    {
+                        if (errno != EAGAIN && errno != EINTR)
+                            connection->broken = true;
+                        break;
+                    }
+                }
+            }
+            ready.push_back(connection);
+        }
+
+        // Split the complete requests into tasks; a frame that can't be valid ends the connection.
+        tasks.clear();
+        for (ServerConnection *connection : ready)
+        {
+            const string &input = connection->input;
+            size_t p = 0, begin = 0, requests = 0;
+            while (input.size() - p >= 4)
+            {
+                size_t length = loadLittleEndian(input.data() + p, 4);
+                if (length < 5 || length > SERVER_MAX_FRAME)
+                {
+                    connection->broken = true;
+                    break;
+                }
+                if (input.size() - p - 4 < length)
+                    break;
+                p += 4 + length;
+                if (++requests == SERVER_CHUNK)
+                {
+                    tasks.push_back({connection, begin, p, requests, string()});
+                    begin = p;
+                    requests = 0;
+                }
+            }
+            if (requests)
+                tasks.push_back({connection, begin, p, requests, string()});
+            connection->parsed = p;
+        }
+        if (tasks.size() == 1)
+            answer(0, 0); // not worth waking the workers
+        else
+            runOnPool(pool, tasks.size(), answer);
+
+        for (ServerTask &task : tasks)
+        {
+            task.connection->output += task.output;
+            served += task.requests;
+        }
+        for (ServerConnection *connection : ready)
+        {
+            connection->input.erase(0, connection->parsed);
+            connection->parsed = 0;
+            while (!connection->output.empty() && !connection->broken)
+            {
+                ssize_t n = send(connection->fd, connection->output.data(), connection->output.size(), MSG_NOSIGNAL);
+                if (n > 0)
+                    connection->output.erase(0, n);
+                else
+                {
+                    if (n < 0 && errno != EAGAIN && errno != EINTR)
+                        connection->broken = true;
+                    break;
+                }
+            }
+
+            if (connection->broken || (connection->inputDone && connection->output.empty()))
+            {
+                close(connection->fd); // also removes it from the epoll set
+                delete connection;
+                continue;
+            }
+            // Stop reading from a client that doesn't read its answers.
+            uint32_t wanted = (connection->output.empty() ? 0u : (uint32_t)EPOLLOUT) |
+                              (connection->inputDone || connection->output.size() > SERVER_MAX_PENDING ? 0u : (uint32_t)EPOLLIN);
+            if (wanted != connection->events)
+            {
+                connection->events = wanted;
+                event.events = wanted;
+                event.data.ptr = connection;
+                epoll_ctl(poller, EPOLL_CTL_MOD, connection->fd, &event);
+            }
+        }
+    }
+
+    close(poller);
+    close(listener);
+    if (endpoint.find_first_not_of("0123456789") != string::npos)
+        unlink(endpoint.c_str());
+    stopWorkers(pool);
+    if (options.summary)
+    {
+        fprintf(stderr, "connections: %lld, requests: %lld\n", accepted, served);
+        if (resultCache.capacity)
+            fprintf(stderr, "%s\n", describeResultCache(resultCache).c_str());
+    }
+    if (!options.metricsFormat.empty())
+        fprintf(stderr, "%s", formatMetrics(options.metricsFormat).c_str());
+    return 0;
+}
+
+// Appends the load generator's request number 'id': half modexp, then inverses, linear
+// congruences, CRT pairs and UPC check digits, on random 62-bit moduli.
+void appendLoadRequest(string &out, uint32_t id, mt19937_64 &rng)
+{
+    string payload;
+    bigInt m = (bigInt)(rng() >> 2) | 1;
+    uint8_t op;
+    int kind = id % 8;
+    if (kind < 4)
+    {
+        op = SERVER_MODEXP;
+        for (bigInt value : {(bigInt)(rng() % m), (bigInt)(rng() >> 1), m})
+            appendLittleEndian(payload, value, 8);
+    }
+    else if (kind == 4 || kind == 5)
+    {
+        op = kind == 4 ? SERVER_INVERSE : SERVER_LINCONG;
+        appendLittleEndian(payload, rng() % m, 8);
+        if (kind == 5)
+            appendLittleEndian(payload, rng() % m, 8);
+        appendLittleEndian(payload, m, 8);
+    }
+    else if (kind == 6)
+    {
+        op = SERVER_CRT;
+        for (bigInt value : {(bigInt)(rng() % 1000003), (bigInt)1000003, (bigInt)(rng() % 998244353), (bigInt)998244353})
+            appendLittleEndian(payload, value, 8);
+    }
+    else
+    {
+        op = SERVER_UPC_CHECK;
+        for (int i = 0; i < 11; i++)
+            payload += (char)('0' + rng() % 10);
+    }
+    appendRequest(out, id, op, payload);
+}
+
+/*
+Load generator for --serve: every connection runs on its own thread and keeps 'pipeline' requests
+in flight until it has sent 'requests'. Reports the throughput and the latency percentiles; a
+response that is out of order or an error counts as a failure.
+*/
+int runLoadTest(const LoadTestOptions &options)
+{
+    vector<vector<double>> latencies(options.connections);
+    atomic<long long> failures(0);
+    vector<thread> clients;
+    auto start = chrono::steady_clock::now();
+    for (int c = 0; c < options.connections; c++)
+        clients.emplace_back([&, c]() {
+            int fd = openSocket(options.endpoint, false);
+            if (fd < 0)
+            {
+                failures += options.requests;
+                return;
+            }
+            mt19937_64 rng(c + 1);
+            vector<chrono::steady_clock::time_point> sentAt(options.pipeline);
+            vector<double> &latency = latencies[c];
+            latency.reserve(options.requests);
+            string out, in;
+            char buffer[1 << 16];
+            long long sent = 0, received = 0;
+            while (received < options.requests)
+            {
+                out.clear();
+                auto now = chrono::steady_clock::now();
+                for (; sent < options.requests && sent - received < options.pipeline; sent++)
+                {
+                    appendLoadRequest(out, (uint32_t)sent, rng);
+                    sentAt[sent % options.pipeline] = now;
+                }
+                size_t written = 0;
+                while (written < out.size())
+                {
+                    ssize_t n = send(fd, out.data() + written, out.size() - written, MSG_NOSIGNAL);
+                    if (n <= 0)
+                        break;
+                    written += n;
+                }
+                ssize_t n = written == out.size() ? read(fd, buffer, sizeof buffer) : -1;
+                if (n <= 0)
+                    break;
+                in.append(buffer, n);
+                now = chrono::steady_clock::now();
+
+                size_t p = 0;
+                while (in.size() - p >= 4 && in.size() - p - 4 >= loadLittleEndian(in.data() + p, 4))
+                {
+                    size_t length = loadLittleEndian(in.data() + p, 4);
+                    if (length < 5 || loadLittleEndian(in.data() + p + 4, 4) != (uint32_t)received ||
+                        (uint8_t)in[p + 8] == SERVER_ERROR)
+                        failures++;
+                    latency.push_back(chrono::duration<double, micro>(now - sentAt[received % options.pipeline]).count());
+                    received++;
+                    p += 4 + length;
+                }
+                in.erase(0, p);
+            }
+            failures += options.requests - received;
+            close(fd);
+        });
+    for (thread &client : clients)
+        client.join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    vector<double> all;
+    for (const vector<double> &latency : latencies)
+        all.insert(all.end(), latency.begin(), latency.end());
+    sort(all.begin(), all.end());
+    auto percentile = [&](int p) { return all.empty() ? 0.0 : all[(all.size() * p + 99) / 100 - 1]; };
+    printf("requests: %zu on %d connection%s, %d in flight each\n", all.size(), options.connections,
+           options.connections == 1 ? "" : "s", options.pipeline);
+    printf("throughput: %.0f requests/s\n", all.size() / seconds);
+    printf("latency: p50 %.1f us, p99 %.1f us, max %.1f us\n", percentile(50), percentile(99), all.empty() ? 0.0 : all.back());
+    printf("failures: %lld\n", failures.load());
+    return failures ? 1 : 0;
+}
+#else
+int runServer(const string &, const BatchOptions &)
+{
+    fprintf(stderr, "--serve needs Linux (epoll)\n");
+    return 2;
+}
+
+int runLoadTest(const LoadTestOptions &)
+{
+    fprintf(stderr, "--load-test needs Linux\n");
+    return 2;
+}
+#endif